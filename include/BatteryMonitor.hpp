@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Arduino.h>
+
+// supply voltage (mV, filtered) below which a level is entered, it is only
+// left again BATTERY_HYSTERESIS_MV above
+#define BATTERY_WARNING_MV 4400
+#define BATTERY_LOW_MV 4200
+#define BATTERY_CRITICAL_MV 3900
+#define BATTERY_HYSTERESIS_MV 100
+
+// higher readings are bogus (AVcc is at most 5.5 V) and clamped, the
+// average holds mV * 8 in 16 bits
+#define BATTERY_MAX_MV 6000
+
+// the bandgap voltage differs from chip to chip (1.0 - 1.2 V), calibrate it
+// with a multimeter: BATTERY_BANDGAP_MV * measured / shown voltage
+#ifndef BATTERY_BANDGAP_MV
+#define BATTERY_BANDGAP_MV 1100UL
+#endif
+
+#define BATTERY_INTERVAL 1000               // ms between two measurements
+#define BATTERY_MAX_VOLUME 18               // volume cap from BatteryLevel::Warning on
+#define BATTERY_CARD_POLL_INTERVAL 250      // ms between card polls from BatteryLevel::Low on
+
+enum class BatteryLevel : uint8_t
+{
+    Normal,
+    Warning,    // warning prompt, volume capped
+    Low,        // cards are polled less often as well
+    Critical    // switch off before the DFPlayer browns out
+};
+
+// Monitors the supply voltage of the box (usually a powerbank) when
+// building with -D BATTERY_MONITOR, without extra parts: the ADC measures
+// the internal 1.1 V bandgap against AVcc, which gives AVcc.
+//
+// A measurement takes three loop() calls (select the input, let the
+// bandgap settle, convert), nothing waits. The readings are averaged over
+// about eight seconds, so the short dips of loud passages don't count.
+class BatteryMonitor
+{
+    public:
+        void begin(void);
+        bool loop(void);
+
+        BatteryLevel level(void);
+        uint8_t limitVolume(uint8_t volume);
+        bool cardPollDue(void);
+        void print(void);
+
+#ifdef BATTERY_MONITOR
+    private:
+        enum class Phase : uint8_t
+        {
+            Idle,
+            Settling,
+            Converting
+        };
+
+        void startMeasurement(void);
+        bool measurementDone(void);
+        uint16_t millivolts(void);
+        BatteryLevel levelFor(uint16_t millivolts);
+
+        Phase _phase = Phase::Idle;
+        unsigned long _phaseStart = 0;
+        unsigned long _lastCardPoll = 0;
+        uint16_t _average;          // mV * 8
+        uint16_t _minimum;
+        BatteryLevel _level = BatteryLevel::Normal;
+#endif
+};
+
+extern BatteryMonitor batteryMonitor;
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Arduino.h>
+
+// uncomment the below line to enable five button support
+//#define FIVEBUTTONS
+
+// What a button does. Next/Previous and VolumeUp/VolumeDown are swapped when
+// the volume buttons are inverted in the admin menu.
+enum class ButtonAction : uint8_t
+{
+    None,
+    PlayPause,          // pause, or continue the last card
+    TrackNumber,        // announce the number of the current track
+    Next,
+    Previous,
+    VolumeUp,
+    VolumeDown,
+    ShortCut0,          // play the shortcut folders of the admin menu
+    ShortCut1,
+    ShortCut2
+};
+
+// One button: its pin and its actions, depending on whether the DFPlayer is
+// playing. Short presses act on release, long presses after LONG_PRESS.
+typedef struct {
+    uint8_t pin;
+    ButtonAction shortPress;
+    ButtonAction longPress;
+    ButtonAction idleShortPress;
+    ButtonAction idleLongPress;
+    bool repeatLongPress;       // repeat the long press action while the button is held
+} ButtonBinding;
+
+// The button layouts. The polling and dispatch code is generated from the
+// table at compile time (see main.cpp), so each button only costs the code of
+// its own actions. The first three buttons are pause, up and down - the
+// menus, the admin menu combination and the reset at startup use them.
+#ifdef FIVEBUTTONS
+constexpr ButtonBinding buttonLayout[] = {
+    {A0, ButtonAction::PlayPause, ButtonAction::TrackNumber, ButtonAction::PlayPause, ButtonAction::ShortCut0, false},
+    {A1, ButtonAction::Next, ButtonAction::None, ButtonAction::Next, ButtonAction::None, false},
+    {A2, ButtonAction::Previous, ButtonAction::None, ButtonAction::Previous, ButtonAction::None, false},
+    {A3, ButtonAction::VolumeUp, ButtonAction::None, ButtonAction::ShortCut1, ButtonAction::None, false},
+    {A4, ButtonAction::VolumeDown, ButtonAction::None, ButtonAction::ShortCut2, ButtonAction::None, false},
+};
+#else
+constexpr ButtonBinding buttonLayout[] = {
+    {A0, ButtonAction::PlayPause, ButtonAction::TrackNumber, ButtonAction::PlayPause, ButtonAction::ShortCut0, false},
+    {A1, ButtonAction::Next, ButtonAction::VolumeUp, ButtonAction::Next, ButtonAction::ShortCut1, true},
+    {A2, ButtonAction::Previous, ButtonAction::VolumeDown, ButtonAction::Previous, ButtonAction::ShortCut2, true},
+};
+#endif
+
+constexpr uint8_t buttonCount = sizeof(buttonLayout) / sizeof(buttonLayout[0]);
@@ -3,6 +3,17 @@
 #include "Player.hpp"
 #include <MFRC522.h>
 #include "Types.hpp"
+#include "UidCardTable.hpp"
+
+// 0x1337 0xb347 magic cookie to identify our nfc tags
+#define NFC_TAG_COOKIE 0x1337b347UL
+
+// writing a card is retried for pages / blocks which don't read back right
+#define CARD_WRITE_ATTEMPTS 3
+
+// a command the MFRC522 doesn't finish in time is given up (its timer
+// already gives up after 25 ms when no tag answers)
+#define CARD_COMMAND_TIMEOUT 40
 
 
 // this object stores nfc tag data
@@ -14,6 +25,7 @@ typedef struct  {
   //  uint8_t mode;
   //  uint8_t special;
   //  uint8_t special2;
+  PlaylistEntry playlist[PLAYLIST_MAX_ENTRIES]; // only used by playlist cards
 } NfcTagObject;
 
 
@@ -21,7 +33,10 @@ enum CardManagerError
 {
     CardManagerSuccess,
     CardManagerAuthenticationFailed,
-    CardManagerWriteFailed,
+    CardManagerWriteFailed,     // the tag didn't accept a write (e.g. removed while writing)
+    CardManagerVerifyFailed,    // the tag accepted the writes, but reads back different data
+    CardManagerTagTooSmall,     // the playlist doesn't fit on the tag (plain MIFARE Ultralight)
+                                // or into the UID card table
 };
 
 class CardManager
@@ -36,9 +51,57 @@ class CardManager
         MFRC522 &GetReader(void) { return _mfrc522; }
 
         bool readCard(NfcTagObject &nfcTag);
+        bool reading(void);
         CardManagerError writeCard(const NfcTagObject &nfcTag);
 
     private:
+        bool authenticate(MFRC522::PICC_Type piccType);
+        bool reselect(MFRC522::PICC_Type piccType);
+        bool holdsPlaylist(MFRC522::PICC_Type piccType);
+        bool readChunk(MFRC522::PICC_Type piccType, byte chunk, byte *buffer);
+        bool writeUnits(MFRC522::PICC_Type piccType, byte *image, uint16_t pending);
+        uint16_t verifyUnits(MFRC522::PICC_Type piccType, byte *image, uint16_t pending);
+        static bool handledType(MFRC522::PICC_Type piccType);
+        bool unreadableCard(NfcTagObject &nfcTag);
+        void decodeCard(byte *buffer, const byte *entries, NfcTagObject &nfcTag);
+
         MFRC522 _mfrc522;
+#ifdef UID_CARD_TABLE
+        UidCardTable _uidTable;
+#endif
+
+#ifdef ASYNC_CARD_READ
+        // the steps of reading a card, each waits for the answer of the tag
+        enum class ReadStep : uint8_t
+        {
+            Idle,
+            Request,        // REQA, any tag in the field?
+            Anticollision,  // the UID bytes of the cascade level
+            Select,         // the SAK, more cascade levels to go?
+            Authenticate,
+            Read,           // chunk _chunk
+            Halt
+        };
+
+        bool readStep(NfcTagObject &nfcTag);
+        bool selected(void);
+        void startRequest(void);
+        void startAnticollision(void);
+        void startAuthentication(void);
+        void startRead(byte chunk);
+        void startHalt(bool cardRead);
+        void startCommand(byte command, byte *data, byte length, byte lastBits, byte waitIrq);
+        bool commandFinished(void);
+        MFRC522::StatusCode response(byte *buffer, byte *length);
+
+        ReadStep _step = ReadStep::Idle;
+        byte _waitIrq;
+        unsigned long _commandStart;
+        byte _cascadeLevel;
+        byte _chunk;
+        bool _cardRead;
+        MFRC522::PICC_Type _piccType;
+        byte _data[3 * 16];     // the chunks, see readChunk()
+#endif
 
 };
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "EepromLayout.hpp"
+
+// bytes waiting to be written, one bit of the dirty bitmap each
+#define EEPROM_CACHE_SLOTS 16
+
+// bytes looked at per loop() call when clearing stale regions
+#define EEPROM_CLEANUP_BYTES 8
+
+// All EEPROM access of the firmware goes through this class. Writing a byte
+// takes 3.3 ms on the ATmega328, during which EEPROM.write() blocks.
+//
+// When building with -D EEPROM_CACHE, update() and put() only store the
+// bytes in a few RAM slots and return. The EE_READY interrupt writes them
+// one after the other in the background, skipping bytes which haven't
+// changed. Only when all slots are taken does update() wait for the next
+// one to become free. Reads return pending bytes from the slots, so callers
+// always see the new value.
+//
+// The slots are lost when the box powers down: flush() waits until
+// everything is written and has to be called before that.
+//
+// Without the flag (and on the host) reads and writes go to EEPROM directly.
+//
+// Resetting the EEPROM doesn't clear it either: each region (see
+// EepromLayout.hpp) has a tag byte holding the generation epoch it was
+// written in, reset() only increments the epoch. Regions with an old tag
+// read as zeros. They are cleared from the start while the box is idle
+// (loop()). A write to such a region only clears the bytes in front of it
+// right away, the rest of the region is left to loop().
+class EepromCache
+{
+    public:
+        void begin(void);
+        void loop(void);
+        void reset(void);
+
+        uint8_t read(int address);
+        void update(int address, uint8_t value);
+        void flush(void);
+        void print(void);
+
+        template <typename T> T &get(int address, T &value)
+        {
+            uint8_t *bytes = (uint8_t *)&value;
+            for (unsigned i = 0; i < sizeof(T); i++)
+                bytes[i] = read(address + i);
+            return value;
+        }
+
+        template <typename T> const T &put(int address, const T &value)
+        {
+            const uint8_t *bytes = (const uint8_t *)&value;
+            for (unsigned i = 0; i < sizeof(T); i++)
+                update(address + i, bytes[i]);
+            return value;
+        }
+
+        // called by the EE_READY interrupt
+        void writeNext(void);
+
+    private:
+        int8_t staleRegion(int address);
+        void clearUpTo(uint8_t region, int address);
+        void tagRegion(uint8_t region);
+
+        uint8_t readByte(int address);
+        void writeByte(int address, uint8_t value);
+
+        uint8_t _epoch;
+        uint8_t _staleRegions = 0;
+        // end of the cleared part of each region, only used while it is stale
+        uint16_t _clearedTo[EEPROM_REGIONS];
+
+#ifdef EEPROM_CACHE
+        int8_t findSlot(int address);
+        void startWriting(void);
+
+        uint16_t _address[EEPROM_CACHE_SLOTS];
+        uint8_t _value[EEPROM_CACHE_SLOTS];
+        volatile uint16_t _dirty = 0;
+
+        volatile uint16_t _written = 0;
+        volatile uint16_t _skipped = 0;
+        uint16_t _waits = 0;
+#endif
+};
+
+extern EepromCache eepromCache;
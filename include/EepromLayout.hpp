@@ -0,0 +1,30 @@
+#pragma once
+
+// EEPROM usage (1024 bytes on the ATmega328)
+//
+//    0 -   99  audio book progress, one byte per folder
+//  100 -  163  admin settings (see Settings.hpp)
+//  164 -  167  watchdog record (see Watchdog.hpp)
+//  168 -  173  generation epoch and one tag per region (see EepromCache.hpp)
+//  192 -  447  usage statistics (see Statistics.hpp)
+//  512 - 1023  UID card table (see UidCardTable.hpp)
+
+#define EEPROM_PROGRESS_ADDRESS 0
+#define EEPROM_PROGRESS_SIZE 100
+
+#define EEPROM_SETTINGS_ADDRESS 100
+#define EEPROM_SETTINGS_SIZE 64
+
+#define EEPROM_WATCHDOG_ADDRESS 164
+#define EEPROM_WATCHDOG_SIZE 4
+
+#define EEPROM_EPOCH_ADDRESS 168
+#define EEPROM_REGION_TAGS_ADDRESS 169
+#define EEPROM_REGIONS 5
+
+#define EEPROM_STATISTICS_ADDRESS 192
+#define EEPROM_STATISTICS_SIZE 256
+
+#define EEPROM_UID_TABLE_ADDRESS 512
+#define EEPROM_UID_TABLE_SIZE 512
+#define EEPROM_UID_TABLE_SLOTS 64
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Arduino.h>
+
+// minimum time between two loop() iterations
+#define IDLE_LOOP_INTERVAL_US 10000UL
+
+// Puts the CPU into SLEEP_MODE_IDLE between loop() iterations when building
+// with -D IDLE_SLEEP. Timers, UART and pin change interrupts keep running in
+// idle mode, so any interrupt wakes the CPU: the timer0 tick every
+// millisecond, data from the DFPlayer (SoftwareSerial RX uses a pin change
+// interrupt) and the hardware serial port. Buttons and the card reader are
+// polled every IDLE_LOOP_INTERVAL_US, which is well below the debounce time.
+class IdleSleep
+{
+    public:
+        void waitForNextLoop(void);
+        void print(void);
+
+#ifdef IDLE_SLEEP
+    private:
+        unsigned long _loopStart = 0;
+        unsigned long _statsStart = 0;
+        uint32_t _loops = 0;
+        uint32_t _wakeups = 0;
+        uint32_t _sleepMicros = 0;
+        uint32_t _sleepMillis = 0;
+#endif
+};
+
+extern IdleSleep idleSleep;
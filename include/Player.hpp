@@ -24,27 +24,128 @@ public:
     {
         _onPlayFinishedHandler = handler;
     }
+    static void RegisterOnError(void(*handler)(uint16_t))
+    {
+        _onErrorHandler = handler;
+    }
 
 private:
     static void(*_onPlayFinishedHandler)(uint16_t);
+    static void(*_onErrorHandler)(uint16_t);
 };
 
+// number of distinct error counters, see Player::errorIndex()
+#define PLAYER_ERROR_CODES 12
+
+// play commands the DFPlayer reports as corrupted are sent again after 100,
+// 200 and 400 ms - as long as the error arrives within the retry window and
+// no query was sent in between
+#define PLAYER_MAX_RETRIES 3
+#define PLAYER_RETRY_BACKOFF 100
+#define PLAYER_RETRY_WINDOW 1000
+
+// waitForTrackToFinish() gives up on tracks playing longer than this
+#define PLAYER_TRACK_TIMEOUT 30000u
+
+// Prompt sequences (see Player::queuePrompt()): the number of queued
+// prompts, finish notifications arriving earlier than PLAYER_PROMPT_MIN_TIME
+// after the start of a prompt (or the end of the sequence) are duplicates of
+// the one before, a prompt not playing PLAYER_PROMPT_IDLE_TIME after its
+// start is skipped (missing file or lost notification)
+#define PLAYER_PROMPT_QUEUE 6
+#define PLAYER_PROMPT_MIN_TIME 200
+#define PLAYER_PROMPT_IDLE_TIME 1000
+
 class Player
 {
     public:
-        Player(uint8_t busyPin, SoftwareSerial serial) 
-            : _busyPin(busyPin), _player(serial) 
+        Player(uint8_t busyPin, SoftwareSerial &serial)
+            : _busyPin(busyPin), _player(serial)
             {}
 
-        void loop(void) { _player.loop(); }
+        void loop(void);
 
         Mp3Player &GetMp3Player(void) { return _player; }
         bool waitForTrackToFinish(void);
-        bool isPlaying(void) { return !digitalRead(_busyPin); }
+        bool isPlaying(void);
 
         void say(uint16_t track);
+
+        void queuePrompt(uint16_t track);
+        void queueFolderTrack(uint8_t folder, uint8_t track);
+        void cancelPrompts(void);
+        bool promptsPending(void) { return _promptState == PromptState::Playing; }
+        bool waitForPrompts(void);
+        bool promptFinished(void);
+
+        void playFolderTrack(uint8_t folder, uint8_t track);
+        void playMp3FolderTrack(uint16_t track);
+        void playAdvertisement(uint16_t track);
+        uint16_t getFolderTrackCount(uint8_t folder);
+
+        void handleError(uint16_t errorCode);
+        uint8_t errorRate(void);
+        void printErrors(void);
+
+        void trackFinished(void);
+        void printTransitions(void);
+
+        static uint8_t errorIndex(uint16_t errorCode);
+
     private:
+        enum class Command : uint8_t
+        {
+            None,
+            PlayFolderTrack,
+            PlayMp3FolderTrack,
+            PlayAdvertisement
+        };
+
+        enum class PromptState : uint8_t
+        {
+            Idle,
+            Playing,    // a prompt of the sequence is playing
+            Cancelled,  // the sequence is cancelled, its prompt may still play
+            Ended       // the sequence just ended, see PLAYER_PROMPT_MIN_TIME
+        };
+
+        void send(Command command, uint8_t folder, uint16_t track);
+        void queue(uint8_t folder, uint16_t track);
+        void playNextPrompt(void);
+        void endPrompts(void);
+        void replacePrompts(void);
+        void sendLastCommand(void);
+        static bool isLinkError(uint16_t errorCode);
+
         const uint8_t _busyPin;
         Mp3Player _player;
+
+        Command _lastCommand = Command::None;
+        uint8_t _lastFolder;
+        uint16_t _lastTrack;
+        unsigned long _lastCommandTime;
+        uint8_t _retries;
+        unsigned long _retryAt = 0;
+
+        uint16_t _errorCounts[PLAYER_ERROR_CODES] = {};
+        uint32_t _errorHistory = 0;     // one bit per command, 1 = failed
+        uint8_t _historyLength = 0;
+
+        // prompt sequence, folder 0 is the mp3 folder
+        uint8_t _promptFolders[PLAYER_PROMPT_QUEUE];
+        uint16_t _promptTracks[PLAYER_PROMPT_QUEUE];
+        uint8_t _firstPrompt = 0;
+        uint8_t _promptCount = 0;
+        PromptState _promptState = PromptState::Idle;
+        unsigned long _promptTime;      // start of the prompt, or end of the sequence
+
+        // time from a finish notification to the next play command
+        unsigned long _finishedAt;
+        bool _transitionPending = false;
+        uint16_t _transitions = 0;
+        uint32_t _transitionMicros = 0;
+        uint32_t _lastTransitionMicros = 0;
+        uint32_t _maxTransitionMicros = 0;
 };
 
+extern Player player;
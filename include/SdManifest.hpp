@@ -0,0 +1,11 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Track counts (and durations) of the SD card folders, generated at build
+// time by tools/create_sd_manifest.py into SdManifestData.hpp and compiled
+// into PROGMEM when building with -D SD_MANIFEST. Both functions return 0
+// if the information isn't available, callers have to ask the DFPlayer then.
+
+uint16_t sdManifestTrackCount(uint8_t folder);
+uint16_t sdManifestTrackDuration(uint8_t folder, uint16_t track);
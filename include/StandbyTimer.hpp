@@ -16,6 +16,7 @@ class StandbyTimer
 
         void start(unsigned long standbyMillis);
         void stop(void);
+        void powerOff(void);
 
     private:
         MFRC522 &_rfid;
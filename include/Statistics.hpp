@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "EepromLayout.hpp"
+
+// counter ids, each counter is a saturating 16 bit value in EEPROM
+#define STATISTICS_FOLDER_PLAYS 0       // 99 counters: plays of folder 1 - 99
+#define STATISTICS_CARD_TAPS 99
+#define STATISTICS_NEW_CARDS 100
+#define STATISTICS_MODIFIERS 101        // 6 counters: modifier cards 1 - 6
+#define STATISTICS_PLAYER_ERRORS 107    // 12 counters: DFPlayer error codes (see Player::errorIndex())
+#define STATISTICS_STANDBY 119
+#define STATISTICS_BOOTS 120
+#define STATISTICS_COUNTERS 121
+
+#define STATISTICS_VERSION 1
+#define STATISTICS_PENDING_SLOTS 12
+#define STATISTICS_FLUSH_INTERVAL (60UL * 60 * 1000)
+
+// Usage statistics (plays per folder, card taps, modifiers, DFPlayer errors,
+// standby entries) kept in EEPROM when building with -D USAGE_STATISTICS.
+//
+// Increments are collected in a few RAM slots and added to EEPROM only when
+// the slots are full, when going to standby and once an hour - so the
+// EEPROM cells see at most a few writes per hour.
+class Statistics
+{
+    public:
+        void begin(void);
+        void loop(void);
+
+        void count(uint8_t counter);
+        void countFolderPlay(uint8_t folder);
+        void countModifier(uint8_t modifier);
+        void countPlayerError(uint16_t errorCode);
+
+        void flush(void);
+        void print(void);
+        void clear(void);
+
+    private:
+        typedef struct {
+            uint8_t counter;
+            uint8_t delta;
+        } PendingCount;
+
+        static int counterAddress(uint8_t counter)
+        {
+            return EEPROM_STATISTICS_ADDRESS + 1 + counter * sizeof(uint16_t);
+        }
+        uint16_t read(uint8_t counter);
+
+#ifdef USAGE_STATISTICS
+        PendingCount _pending[STATISTICS_PENDING_SLOTS];
+        uint8_t _pendingCount;
+        unsigned long _lastFlush;
+#endif
+};
+
+extern Statistics statistics;
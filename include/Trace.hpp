@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Arduino.h>
+#include <MFRC522.h>
+
+#include "CardManager.hpp"
+
+// RAM used for the trace, the oldest records are dropped when it is full
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 160
+#endif
+
+// record types, the dump prints them as letters (see Trace::print())
+enum class TraceType : uint8_t
+{
+    Boot,               // S: random seed
+    Button,             // B: button index, pressed
+    Card,               // C: UID and the first 9 bytes of the card data
+    Playlist,           // L: playlist entries of the card before
+    PlayFinished,       // F: track
+    PlayerError,        // E: error code
+    Busy,               // P: DFPlayer playing (busy pin)
+    TrackCount          // Q: track count reported by the DFPlayer
+};
+
+// Records the inputs of the box - button edges, cards, DFPlayer notifications
+// and answers - with their time into a ring buffer in RAM when building with
+// -D EVENT_TRACE. `t` over Serial dumps the trace as text, sim/replay feeds
+// it into the firmware running on the PC.
+//
+// A record takes a header byte (type and payload length), the time since the
+// record before (1 byte up to 127 ms, 2 bytes up to 16 s) and the payload.
+class Trace
+{
+    public:
+        void begin(uint32_t randomSeed);
+
+        void buttons(uint8_t pressed);
+        void card(const MFRC522::Uid &uid, const NfcTagObject &nfcTag);
+        void cardPlaced(void);
+        void playFinished(uint16_t track);
+        void playerError(uint16_t errorCode);
+        void busy(bool playing);
+        void trackCount(uint16_t count);
+
+        void print(void);
+
+#ifdef EVENT_TRACE
+    private:
+        void record(TraceType type, const uint8_t *payload, uint8_t length);
+        void recordWord(TraceType type, uint16_t value);
+        void put(uint8_t value);
+        uint8_t at(uint16_t offset) { return _buffer[(_start + offset) % TRACE_BUFFER_SIZE]; }
+        void readDelta(uint16_t &offset, unsigned long &delta);
+        uint16_t recordSize(uint16_t offset);
+        void dropOldest(void);
+
+        uint8_t _buffer[TRACE_BUFFER_SIZE];
+        uint16_t _start = 0;
+        uint16_t _used = 0;
+        uint16_t _dropped = 0;
+        unsigned long _firstTime = 0;   // time of the oldest record
+        unsigned long _lastTime = 0;    // time of the newest record
+        uint8_t _buttons = 0;
+        bool _playing = false;
+#endif
+};
+
+extern Trace trace;
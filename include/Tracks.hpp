@@ -1,11 +1,15 @@
 #pragma once
 
 #define NEW_CARD 300
+#define BATTERY_LOW 306
+
+#define CARD_TOO_SMALL 402
 
 #define PLACE_CARD 800
 #define CANCELLED 802
 
 #define BATCH_CARD_INTRO 936
+#define PLAYLIST_CARD_INTRO 937
 
 #define SUM_OF 992
 #define PLUS 993
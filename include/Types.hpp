@@ -6,3 +6,14 @@ typedef struct {
   uint8_t special;
   uint8_t special2;
 } FolderSettings;
+
+// playback mode of playlist cards, special holds the number of entries
+#define PLAYLIST_MODE 10
+#define PLAYLIST_MAX_ENTRIES 10
+
+// one entry of a playlist card
+typedef struct {
+  uint8_t folder;
+  uint8_t firstTrack;
+  uint8_t lastTrack;   // 0 = up to the last track of the folder
+} PlaylistEntry;
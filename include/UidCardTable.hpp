@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Arduino.h>
+#include <MFRC522.h>
+
+#include "EepromLayout.hpp"
+#include "Types.hpp"
+
+// one slot of the table: 32 bit hash of the UID and the folder settings
+typedef struct {
+    uint32_t key;
+    FolderSettings folderSettings;
+} UidCardTableEntry;
+
+// Maps the UID of a tag to its folder settings, so tags don't need to be
+// authenticated, read or written at all. This allows read-only tags, bank
+// cards or toy figures to be used as cards.
+//
+// The table lives in EEPROM and uses open addressing with linear probing.
+// Cleared (0x00) and erased (0xFF) slots are treated as empty.
+//
+// Only the hash is stored, not the UID (up to 10 bytes would halve the
+// slots). Two UIDs with the same hash share one configuration: a foreign
+// tag plays a stored card's folder with a chance of 1 in 2^32 per stored
+// card, configuring it overwrites that card's entry.
+class UidCardTable
+{
+    public:
+        bool lookup(const MFRC522::Uid &uid, FolderSettings &folderSettings);
+        bool store(const MFRC522::Uid &uid, const FolderSettings &folderSettings);
+
+    private:
+        static uint32_t hash(const MFRC522::Uid &uid);
+        static bool isEmpty(uint32_t key) { return key == 0 || key == 0xFFFFFFFF; }
+        static int slotAddress(uint8_t slot)
+        {
+            return EEPROM_UID_TABLE_ADDRESS + slot * sizeof(UidCardTableEntry);
+        }
+};
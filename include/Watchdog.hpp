@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "EepromLayout.hpp"
+
+// what the firmware was doing when the watchdog was fed the last time
+enum class WatchdogActivity : uint8_t
+{
+    Boot = 1,
+    Loop,
+    AdminMenu,
+    VoiceMenu,
+    AskCode,
+    WaitForCard,
+    WaitForTrack,
+    WaitForPlayer,
+    Delay,
+    EepromReset,
+    Standby
+};
+
+// stored in EEPROM, survives watchdog resets
+typedef struct {
+    uint16_t watchdogResets;
+    uint8_t lastResetCause;     // MCUSR flags of the last start
+    uint8_t lastActivity;       // WatchdogActivity of the last watchdog reset
+} WatchdogRecord;
+
+// The hardware watchdog (enabled with -D WATCHDOG) resets the box if the
+// loop or one of the menus doesn't feed it for a second - e.g. because it
+// hangs waiting for the DFPlayer or the card reader.
+//
+// Needs a bootloader which disables the watchdog after a reset (like
+// optiboot), old Nano bootloaders end up in a reset loop!
+class Watchdog
+{
+    public:
+        void begin(void);
+        void feed(WatchdogActivity activity);
+        void delay(unsigned long ms);
+        void disable(void);
+        void print(void);
+};
+
+extern Watchdog watchdog;
@@ -0,0 +1,311 @@
+/*
+  Benchmarks of the firmware's core paths, running on the PC like replay.cpp.
+
+    make bench                   builds build/bench and checks bench_thresholds.txt
+    build/bench [--filter NAME] [--thresholds FILE]
+
+  Each benchmark runs a fixed number of operations a few times and reports
+  two numbers per operation:
+
+    host_ns  the fastest run on the PC, shows the cost of the code itself
+    sim_us   the simulated time on the board (see SimBoard.hpp), which
+             includes the modeled DFPlayer, card and EEPROM accesses and is
+             the same on every machine
+
+  The output has one line per benchmark with whitespace separated columns,
+  lines starting with `#` are comments. A benchmark exceeding one of its
+  limits in the thresholds file is marked FAIL and the exit code is 1.
+*/
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "CardManager.hpp"
+#include "EepromLayout.hpp"
+#include "Player.hpp"
+#include "Settings.hpp"
+#include "SimBoard.hpp"
+#include "SimCard.hpp"
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+void setup();
+void shuffleQueue();
+void previousButton();
+
+// state of the firmware, see main.cpp
+extern uint16_t numTracksInFolder;
+extern uint16_t currentTrack;
+extern uint16_t firstTrack;
+extern uint8_t currentEntry;
+extern uint8_t queue[255];
+extern NfcTagObject myCard;
+extern FolderSettings *myFolder;
+extern bool knownCard;
+extern CardManager cardManager;
+
+static const uint32_t cardCookie = 322417479;
+static const uint8_t busyPin = 4;
+
+#define BENCH_RUNS 5
+
+struct Benchmark
+{
+    const char *name;
+    unsigned iterations;
+    std::function<void()> prepare;      // before each run, not timed
+    std::function<void()> run;          // one operation
+};
+
+struct Limits
+{
+    double hostNs;
+    double simUs;
+};
+
+static void fail(const std::string &message)
+{
+    std::cerr << "ERROR: " << message << std::endl;
+    exit(1);
+}
+
+/**
+  A card as written by writeCard(): cookie, version 2, folder settings and
+  for playlist cards the entries in the following two chunks.
+*/
+static void placeCard(const std::vector<uint8_t> &uid, uint8_t folder, uint8_t mode, uint8_t special)
+{
+    uint8_t data[16] = {0x13, 0x37, 0xb3, 0x47, 2, folder, mode, special};
+    simCard.place(uid.data(), uid.size());
+    simCard.writeChunk(0, data, sizeof(data));
+
+    uint8_t entries[32] = {};
+    for (uint8_t i = 0; i < special && i < PLAYLIST_MAX_ENTRIES; i++)
+    {
+        entries[i * 3] = i + 1;
+        entries[i * 3 + 1] = 1;
+        entries[i * 3 + 2] = 12;
+    }
+    simCard.writeChunk(1, entries, 16);
+    simCard.writeChunk(2, entries + 16, 16);
+}
+
+/**
+  Plays a folder the way playFolder() leaves the state behind, without
+  asking the DFPlayer for the number of tracks.
+*/
+static void startFolder(uint8_t mode, uint16_t tracks)
+{
+    myCard.nfcFolderSettings.folder = 1;
+    myCard.nfcFolderSettings.mode = mode;
+    myCard.nfcFolderSettings.special = 0;
+    myFolder = &myCard.nfcFolderSettings;
+    knownCard = true;
+    firstTrack = 1;
+    numTracksInFolder = tracks;
+    currentTrack = 1;
+    currentEntry = 0;
+    if (mode == PLAYLIST_MODE)
+    {
+        myCard.nfcFolderSettings.special = PLAYLIST_MAX_ENTRIES;
+        for (uint8_t i = 0; i < PLAYLIST_MAX_ENTRIES; i++)
+            myCard.playlist[i] = PlaylistEntry{(uint8_t)(i + 1), 1, (uint8_t)tracks};
+    }
+    if (mode == 3)
+        shuffleQueue();
+}
+
+/**
+  Finishes the current track, which calls nextTrack() through the DFPlayer
+  notification. Starts over before the end of the folder is reached, the
+  standby timer isn't part of the benchmark.
+*/
+static void finishTrack(void)
+{
+    static uint16_t finished = 0;
+    if (currentTrack + 1 >= numTracksInFolder &&
+        (myFolder->mode != PLAYLIST_MODE || currentEntry + 1 >= myFolder->special))
+    {
+        currentTrack = 1;
+        currentEntry = 0;
+    }
+    Mp3Notify::OnPlayFinished(DfMp3_PlaySources_Sd, ++finished);
+}
+
+static void stepBack(void)
+{
+    if (currentTrack == firstTrack && currentEntry == 0)
+        currentTrack = numTracksInFolder;
+    previousButton();
+}
+
+static void readCard(void)
+{
+    simCard.setState(SimCard::State::Idle);
+    NfcTagObject tag;
+    // with -D ASYNC_CARD_READ the read takes many calls
+    uint64_t start = simBoard.micros();
+    while (!cardManager.readCard(tag))
+        if (simBoard.micros() - start > 1000000)
+            fail("card not read");
+    if (tag.cookie != cardCookie)
+        fail("card not read");
+}
+
+/**
+  One look for a card with none on the reader, what every loop() pays.
+*/
+static void pollCard(void)
+{
+    NfcTagObject tag;
+    if (cardManager.readCard(tag))
+        fail("card read without card");
+}
+
+static void loadSettings(void)
+{
+    loadSettingsFromFlash(cardCookie, myFolder);
+}
+
+static void loadOldSettings(void)
+{
+    EEPROM.data()[EEPROM_SETTINGS_ADDRESS + offsetof(AdminSettings, version)] = 1;
+    loadSettingsFromFlash(cardCookie, myFolder);
+}
+
+static const std::vector<Benchmark> benchmarks = {
+    {"shuffle_queue_12", 100000, [] { startFolder(3, 12); }, shuffleQueue},
+    {"shuffle_queue_255", 5000, [] { startFolder(3, 255); }, shuffleQueue},
+    {"next_track_album", 20000, [] { startFolder(2, 255); }, finishTrack},
+    {"next_track_party", 20000, [] { startFolder(3, 255); }, finishTrack},
+    {"next_track_audiobook", 20000, [] { startFolder(5, 255); }, finishTrack},
+    {"next_track_playlist", 20000, [] { startFolder(PLAYLIST_MODE, 12); }, finishTrack},
+    {"previous_track_album", 20000, [] { startFolder(2, 255); }, stepBack},
+    {"previous_track_party", 20000, [] { startFolder(3, 255); }, stepBack},
+    {"previous_track_playlist", 20000, [] { startFolder(PLAYLIST_MODE, 12); }, stepBack},
+    {"read_card_classic", 20000, [] { placeCard({0x04, 0x91, 0x2a, 0x7c}, 1, 2, 0); }, readCard},
+    {"read_card_ultralight", 20000, [] { placeCard({0x04, 0x91, 0x2a, 0x7c, 0x11, 0x22, 0x33}, 1, 2, 0); },
+     readCard},
+    {"read_card_playlist", 20000, [] { placeCard({0x04, 0x91, 0x2a, 0x7c}, 1, PLAYLIST_MODE, 10); }, readCard},
+    {"poll_no_card", 20000, [] { simCard.remove(); }, pollCard},
+    {"load_settings", 20000, [] {}, loadSettings},
+    {"migrate_settings", 20000, [] {}, loadOldSettings},
+};
+
+/**
+  Reads the limits, one benchmark per line: name, host ns and simulated µs
+  per operation. `-` skips a limit.
+*/
+static std::map<std::string, Limits> loadThresholds(const std::string &file)
+{
+    std::map<std::string, Limits> thresholds;
+    std::ifstream in(file);
+    if (!in)
+        fail("can't read " + file);
+    std::string text;
+    while (std::getline(in, text))
+    {
+        std::istringstream fields(text);
+        std::string name, hostNs, simUs;
+        if (!(fields >> name) || name[0] == '#')
+            continue;
+        if (!(fields >> hostNs >> simUs))
+            fail("invalid line in " + file + ": " + text);
+        thresholds[name] = Limits{hostNs == "-" ? -1 : atof(hostNs.c_str()), simUs == "-" ? -1 : atof(simUs.c_str())};
+    }
+    return thresholds;
+}
+
+static std::string limit(double value)
+{
+    return value < 0 ? "-" : std::to_string((long)value);
+}
+
+int main(int argc, char **argv)
+{
+    std::string filter;
+    std::string thresholdsFile;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if (arg == "--thresholds" && i + 1 < argc)
+            thresholdsFile = argv[++i];
+        else if (arg == "-h" || arg == "--help")
+        {
+            std::cout << "Usage: " << argv[0] << " [--filter NAME] [--thresholds FILE]\n\n"
+                      << "Runs the benchmarks of the firmware on the PC and prints the time per operation.\n\n"
+                      << "  --filter NAME      Only run benchmarks whose name contains NAME\n"
+                      << "  --thresholds FILE  Compare against the limits in FILE, exit code 1 if exceeded\n";
+            return 0;
+        }
+        else
+            fail("unknown argument " + arg + ", see --help");
+    }
+    std::map<std::string, Limits> thresholds;
+    if (!thresholdsFile.empty())
+        thresholds = loadThresholds(thresholdsFile);
+
+    simBoard.setPin(busyPin, true);
+    try
+    {
+        setup();
+    }
+    catch (const SimStop &stop)
+    {
+        fail("setup() stopped: " + stop.reason);
+    }
+
+    bool failed = false;
+    printf("# %-26s %12s %12s %12s %12s  %s\n", "name", "host_ns", "sim_us", "limit_ns", "limit_us", "result");
+    for (const Benchmark &benchmark : benchmarks)
+    {
+        if (std::string(benchmark.name).find(filter) == std::string::npos)
+            continue;
+
+        double hostNs = 0;
+        double simUs = 0;
+        for (int run = 0; run < BENCH_RUNS; run++)
+        {
+            // every run starts from the same state, so sim_us doesn't depend
+            // on the number of runs
+            simBoard.setRandomSeed(1);
+            benchmark.prepare();
+            uint64_t simStart = simBoard.micros();
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned i = 0; i < benchmark.iterations; i++)
+                benchmark.run();
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+            ns /= benchmark.iterations;
+            if (run == 0 || ns < hostNs)
+                hostNs = ns;
+            simUs = (double)(simBoard.micros() - simStart) / benchmark.iterations;
+        }
+
+        std::string result = "-";
+        Limits limits = {-1, -1};
+        auto threshold = thresholds.find(benchmark.name);
+        if (threshold != thresholds.end())
+        {
+            limits = threshold->second;
+            bool exceeded = (limits.hostNs >= 0 && hostNs > limits.hostNs) || (limits.simUs >= 0 && simUs > limits.simUs);
+            result = exceeded ? "FAIL" : "ok";
+            failed |= exceeded;
+        }
+        printf("  %-26s %12.1f %12.1f %12s %12s  %s\n", benchmark.name, hostNs, simUs, limit(limits.hostNs).c_str(),
+               limit(limits.simUs).c_str(), result.c_str());
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+// Arduino API of the simulated board, see SimBoard.hpp
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <type_traits>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+
+#define DEC 10
+#define HEX 16
+
+// functions instead of the macros of the Arduino core, which would break the
+// standard library used by the simulation
+template <typename A, typename B> typename std::common_type<A, B>::type min(A a, B b) { return a < b ? a : b; }
+template <typename A, typename B> typename std::common_type<A, B>::type max(A a, B b) { return a > b ? a : b; }
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+
+class __FlashStringHelper;
+#define F(string) (reinterpret_cast<const __FlashStringHelper *>(string))
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+int analogRead(uint8_t pin);
+
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+
+class Print
+{
+    public:
+        virtual ~Print() {}
+        virtual size_t write(uint8_t value) = 0;
+        size_t write(const char *string);
+
+        size_t print(const __FlashStringHelper *string) { return write(reinterpret_cast<const char *>(string)); }
+        size_t print(const char *string) { return write(string); }
+        size_t print(char value) { return write((uint8_t)value); }
+        size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+        size_t print(int value, int base = DEC) { return print((long)value, base); }
+        size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+        size_t print(long value, int base = DEC);
+        size_t print(unsigned long value, int base = DEC);
+        size_t print(double value, int digits = 2);
+
+        size_t println(void) { return write("\r\n"); }
+        template <typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+        template <typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+class Stream : public Print
+{
+    public:
+        virtual int available(void) = 0;
+        virtual int read(void) = 0;
+        virtual int peek(void) = 0;
+        long parseInt(void);
+        void setTimeout(unsigned long timeout) { _timeout = timeout; }
+
+    private:
+        unsigned long _timeout = 1000;
+};
+
+class HardwareSerial : public Stream
+{
+    public:
+        void begin(unsigned long baud) {}
+        size_t write(uint8_t value) override;
+        using Print::write;
+        int available(void) override;
+        int read(void) override;
+        int peek(void) override;
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,88 @@
+#pragma once
+
+// DFMiniMp3 1.0.7 API on top of the simulated DFPlayer, see SimPlayer.hpp
+
+#include <Arduino.h>
+
+#include "SimPlayer.hpp"
+
+enum DfMp3_Error
+{
+    DfMp3_Error_Busy = 1,
+    DfMp3_Error_Sleeping,
+    DfMp3_Error_SerialWrongStack,
+    DfMp3_Error_CheckSumNotMatch,
+    DfMp3_Error_FileIndexOut,
+    DfMp3_Error_FileMismatch,
+    DfMp3_Error_Advertise,
+    DfMp3_Error_RxTimeout = 0x81,
+    DfMp3_Error_PacketSize,
+    DfMp3_Error_PacketHeader,
+    DfMp3_Error_PacketChecksum,
+    DfMp3_Error_General = 0xff
+};
+
+enum DfMp3_PlaySources
+{
+    DfMp3_PlaySources_Usb = 0x01,
+    DfMp3_PlaySources_Sd = 0x02,
+    DfMp3_PlaySources_Pc = 0x04,
+    DfMp3_PlaySources_Flash = 0x08
+};
+
+enum DfMp3_Eq
+{
+    DfMp3_Eq_Normal,
+    DfMp3_Eq_Pop,
+    DfMp3_Eq_Rock,
+    DfMp3_Eq_Jazz,
+    DfMp3_Eq_Classic,
+    DfMp3_Eq_Bass
+};
+
+template <class T_SERIAL_METHOD, class T_NOTIFICATION_METHOD> class DFMiniMp3
+{
+    public:
+        typedef SimPlayer::Command Command;
+
+        DFMiniMp3(T_SERIAL_METHOD &serial) {}
+
+        void begin(void) { simPlayer.command(Command::Begin); }
+
+        void loop(void)
+        {
+            SimPlayer::Notification notification;
+            uint16_t value;
+            while (simPlayer.nextNotification(notification, value))
+            {
+                if (notification == SimPlayer::Notification::PlayFinished)
+                    T_NOTIFICATION_METHOD::OnPlayFinished(DfMp3_PlaySources_Sd, value);
+                else
+                    T_NOTIFICATION_METHOD::OnError(value);
+            }
+        }
+
+        void playGlobalTrack(uint16_t track = 0) { simPlayer.command(Command::PlayMp3FolderTrack, track); }
+        void playMp3FolderTrack(uint16_t track) { simPlayer.command(Command::PlayMp3FolderTrack, track); }
+        void playFolderTrack(uint8_t folder, uint8_t track) { simPlayer.command(Command::PlayFolderTrack, folder, track); }
+        void playFolderTrack16(uint8_t folder, uint16_t track) { simPlayer.command(Command::PlayFolderTrack, folder, track); }
+        void playAdvertisement(uint16_t track) { simPlayer.command(Command::PlayAdvertisement, track); }
+        void stopAdvertisement(void) { simPlayer.command(Command::StopAdvertisement); }
+        void nextTrack(void) { simPlayer.command(Command::NextTrack); }
+        void prevTrack(void) { simPlayer.command(Command::PrevTrack); }
+        void start(void) { simPlayer.command(Command::Start); }
+        void pause(void) { simPlayer.command(Command::Pause); }
+        void stop(void) { simPlayer.command(Command::Stop); }
+        void sleep(void) { simPlayer.command(Command::Sleep); }
+        void reset(void) { simPlayer.command(Command::Reset); }
+
+        void setVolume(uint8_t volume) { simPlayer.command(Command::SetVolume, volume); }
+        uint8_t getVolume(void) { return simPlayer.volume(); }
+        void increaseVolume(void) { simPlayer.command(Command::IncreaseVolume); }
+        void decreaseVolume(void) { simPlayer.command(Command::DecreaseVolume); }
+        void setEq(DfMp3_Eq eq) { simPlayer.command(Command::SetEq, eq); }
+
+        uint16_t getStatus(void) { return simPlayer.query(Command::GetStatus); }
+        uint16_t getFolderTrackCount(uint16_t folder) { return simPlayer.query(Command::GetFolderTrackCount, folder); }
+        uint16_t getTotalTrackCount(void) { return simPlayer.query(Command::GetTotalTrackCount); }
+};
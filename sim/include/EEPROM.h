@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// EEPROM of the simulated board, erased (0xFF) at the start. Writes take as
+// long as on the ATmega328.
+class EEPROMClass
+{
+    public:
+        EEPROMClass() { memset(_data, 0xFF, sizeof(_data)); }
+
+        uint8_t read(int address);
+        void write(int address, uint8_t value);
+        void update(int address, uint8_t value);
+        uint16_t length(void) { return sizeof(_data); }
+
+        template <typename T> T &get(int address, T &value)
+        {
+            uint8_t *bytes = (uint8_t *)&value;
+            for (unsigned i = 0; i < sizeof(T); i++)
+                bytes[i] = read(address + i);
+            return value;
+        }
+
+        template <typename T> const T &put(int address, const T &value)
+        {
+            const uint8_t *bytes = (const uint8_t *)&value;
+            for (unsigned i = 0; i < sizeof(T); i++)
+                update(address + i, bytes[i]);
+            return value;
+        }
+
+        uint8_t *data(void) { return _data; }
+
+    private:
+        uint8_t _data[1024];
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Same behaviour as JC_Button 2.1.2: a change is taken over on the first
+// read after the debounce time, then the state is held for the debounce time.
+class Button
+{
+    public:
+        Button(uint8_t pin, uint32_t dbTime = 25, uint8_t puEnable = true, uint8_t invert = true)
+            : _pin(pin), _dbTime(dbTime), _puEnable(puEnable), _invert(invert)
+            {}
+
+        void begin(void);
+        bool read(void);
+        bool isPressed(void) { return _state; }
+        bool isReleased(void) { return !_state; }
+        bool wasPressed(void) { return _state && _changed; }
+        bool wasReleased(void) { return !_state && _changed; }
+        bool pressedFor(uint32_t ms) { return _state && _time - _lastChange >= ms; }
+        bool releasedFor(uint32_t ms) { return !_state && _time - _lastChange >= ms; }
+        uint32_t lastChange(void) { return _lastChange; }
+
+    private:
+        uint8_t _pin;
+        uint32_t _dbTime;
+        bool _puEnable;
+        bool _invert;
+        bool _state = false;
+        bool _lastState = false;
+        bool _changed = false;
+        uint32_t _time = 0;
+        uint32_t _lastChange = 0;
+};
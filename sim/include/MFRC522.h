@@ -0,0 +1,144 @@
+#pragma once
+
+// MFRC522 1.4.10 API on top of the simulated card, see SimCard.hpp
+//
+// The library calls answer right away (taking their modeled time). The
+// registers used to talk to the tag without waiting are emulated as well:
+// the FIFO, Transceive / MFAuthent / Idle commands and the interrupt bits,
+// which are set once the modeled time of the frame has passed.
+
+#include <Arduino.h>
+
+class MFRC522
+{
+    public:
+        enum PCD_Register : byte
+        {
+            CommandReg = 0x01 << 1,
+            ComIrqReg = 0x04 << 1,
+            ErrorReg = 0x06 << 1,
+            Status2Reg = 0x08 << 1,
+            FIFODataReg = 0x09 << 1,
+            FIFOLevelReg = 0x0A << 1,
+            ControlReg = 0x0C << 1,
+            BitFramingReg = 0x0D << 1,
+            CollReg = 0x0E << 1,
+            TxModeReg = 0x12 << 1,
+            RxModeReg = 0x13 << 1,
+            ModWidthReg = 0x24 << 1
+        };
+
+        enum PCD_Command : byte
+        {
+            PCD_Idle = 0x00,
+            PCD_Transceive = 0x0C,
+            PCD_MFAuthent = 0x0E
+        };
+
+        enum StatusCode : byte
+        {
+            STATUS_OK,
+            STATUS_ERROR,
+            STATUS_COLLISION,
+            STATUS_TIMEOUT,
+            STATUS_NO_ROOM,
+            STATUS_INTERNAL_ERROR,
+            STATUS_INVALID,
+            STATUS_CRC_WRONG,
+            STATUS_MIFARE_NACK = 0xff
+        };
+
+        enum PICC_Command : byte
+        {
+            PICC_CMD_REQA = 0x26,
+            PICC_CMD_WUPA = 0x52,
+            PICC_CMD_CT = 0x88,
+            PICC_CMD_SEL_CL1 = 0x93,
+            PICC_CMD_SEL_CL2 = 0x95,
+            PICC_CMD_SEL_CL3 = 0x97,
+            PICC_CMD_HLTA = 0x50,
+            PICC_CMD_MF_AUTH_KEY_A = 0x60,
+            PICC_CMD_MF_AUTH_KEY_B = 0x61,
+            PICC_CMD_MF_READ = 0x30,
+            PICC_CMD_MF_WRITE = 0xA0,
+            PICC_CMD_UL_WRITE = 0xA2
+        };
+
+        enum PICC_Type : byte
+        {
+            PICC_TYPE_UNKNOWN,
+            PICC_TYPE_ISO_14443_4,
+            PICC_TYPE_ISO_18092,
+            PICC_TYPE_MIFARE_MINI,
+            PICC_TYPE_MIFARE_1K,
+            PICC_TYPE_MIFARE_4K,
+            PICC_TYPE_MIFARE_UL,
+            PICC_TYPE_MIFARE_PLUS,
+            PICC_TYPE_MIFARE_DESFIRE,
+            PICC_TYPE_TNP3XXX,
+            PICC_TYPE_NOT_COMPLETE = 0xff
+        };
+
+        typedef struct {
+            byte size;
+            byte uidByte[10];
+            byte sak;
+        } Uid;
+
+        typedef struct {
+            byte keyByte[6];
+        } MIFARE_Key;
+
+        Uid uid;
+
+        MFRC522(byte chipSelectPin, byte resetPowerDownPin) {}
+
+        void PCD_Init(void) {}
+        void PCD_DumpVersionToSerial(void);
+        void PCD_AntennaOn(void) {}
+        void PCD_AntennaOff(void) {}
+        void PCD_SoftPowerDown(void) {}
+        void PCD_SoftPowerUp(void) {}
+
+        void PCD_WriteRegister(PCD_Register reg, byte value);
+        void PCD_WriteRegister(PCD_Register reg, byte count, byte *values);
+        byte PCD_ReadRegister(PCD_Register reg);
+        void PCD_ReadRegister(PCD_Register reg, byte count, byte *values, byte rxAlign = 0);
+        void PCD_SetRegisterBitMask(PCD_Register reg, byte mask);
+        void PCD_ClearRegisterBitMask(PCD_Register reg, byte mask);
+
+        bool PICC_IsNewCardPresent(void);
+        bool PICC_ReadCardSerial(void);
+        StatusCode PICC_WakeupA(byte *bufferATQA, byte *bufferSize);
+        StatusCode PICC_Select(Uid *uid, byte validBits = 0);
+        StatusCode PICC_HaltA(void);
+
+        StatusCode PCD_Authenticate(byte command, byte blockAddr, MIFARE_Key *key, Uid *uid);
+        StatusCode PCD_NTAG216_AUTH(byte *passWord, byte pACK[]);
+        void PCD_StopCrypto1(void) { _registers[Status2Reg >> 1] &= ~0x08; }
+
+        StatusCode MIFARE_Read(byte blockAddr, byte *buffer, byte *bufferSize);
+        StatusCode MIFARE_Write(byte blockAddr, byte *buffer, byte bufferSize);
+        StatusCode MIFARE_Ultralight_Write(byte page, byte *buffer, byte bufferSize);
+
+        static PICC_Type PICC_GetType(byte sak);
+        static const __FlashStringHelper *PICC_GetTypeName(PICC_Type type);
+        static const __FlashStringHelper *GetStatusCodeName(StatusCode code);
+
+    private:
+        void transceive(void);
+        void authenticate(void);
+        void update(void);
+
+        byte _registers[0x40] = {};
+        byte _fifo[64];
+        byte _fifoLength = 0;
+        byte _fifoRead = 0;
+        byte _response[18];
+        int8_t _responseLength = -1;    // -1 = no answer
+        byte _responseBits = 0;
+        byte _irq = 0;                  // set at _doneAt
+        uint64_t _sentAt = 0;
+        uint64_t _doneAt = 0;
+        bool _busy = false;
+};
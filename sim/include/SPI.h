@@ -0,0 +1,9 @@
+#pragma once
+
+class SPIClass
+{
+    public:
+        void begin(void) {}
+};
+
+extern SPIClass SPI;
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <string>
+
+// Time it takes the real hardware to do something, the simulated board
+// advances its clock by these amounts (in microseconds).
+#define SIM_CALL_US 1               // millis(), micros()
+#define SIM_PIN_READ_US 4           // digitalRead()
+#define SIM_ANALOG_READ_US 112      // analogRead(), also one conversion of the ADC
+#define SIM_SERIAL_CHAR_US 87       // one character at 115200 baud
+#define SIM_SERIAL_BUFFER 64        // the firmware only blocks when the TX buffer is full
+#define SIM_EEPROM_WRITE_US 3300    // one byte, write() blocks until it is written
+
+// Thrown out of the firmware to end the simulation.
+struct SimStop
+{
+    std::string reason;
+};
+
+// The simulated Arduino Nano: a virtual clock, the pins and the serial port.
+//
+// Nothing takes real time: the clock only advances by the modeled cost of
+// each hardware access and by delay(), so a simulation runs much faster than
+// real time and gives the same result every time. Inputs are scheduled as
+// actions which run as soon as the clock passes their time - also while the
+// firmware waits in one of its menus.
+class SimBoard
+{
+    public:
+        uint64_t micros(void) const { return _micros; }
+        unsigned long millis(void) const { return _micros / 1000; }
+        void advance(uint64_t us);
+
+        void at(uint64_t us, std::function<void()> action);
+        void stopAt(uint64_t us) { _stopAt = us; }
+        void stop(const std::string &reason);
+
+        void setPin(uint8_t pin, bool high) { _pins[pin] = high; }
+        bool pin(uint8_t pin) const { return _pins[pin]; }
+        void setPinMode(uint8_t pin, uint8_t mode);
+
+        void setInterrupts(bool enabled) { _interrupts = enabled; }
+        bool interrupts(void) const { return _interrupts; }
+
+        void setSupply(uint16_t millivolts) { _supply = millivolts; }
+        uint16_t supply(void) const { return _supply; }
+
+        void serialWrite(uint8_t value);
+        void setSerialEcho(bool echo) { _serialEcho = echo; }
+        std::string &serialInput(void) { return _serialInput; }
+
+        uint32_t random(void);
+        void setRandomSeed(uint32_t seed) { _random = seed; }
+        void forceRandomSeed(uint32_t seed) { _forcedSeed = seed; _seedForced = true; }
+        bool seedForced(void) const { return _seedForced; }
+        uint32_t forcedSeed(void) const { return _forcedSeed; }
+
+    private:
+        uint64_t _micros = 0;
+        uint64_t _stopAt = 0;
+        std::multimap<uint64_t, std::function<void()>> _actions;
+        bool _pins[32] = {};
+        bool _interrupts = true;
+        uint16_t _supply = 5000;    // mV
+        bool _serialEcho = false;
+        uint64_t _serialBusyUntil = 0;
+        std::string _serialInput;
+        uint32_t _random = 1;
+        uint32_t _forcedSeed = 0;
+        bool _seedForced = false;
+};
+
+extern SimBoard simBoard;
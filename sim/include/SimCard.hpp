@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+// Time the card reader takes (in microseconds). Without a card, the REQA of
+// PICC_IsNewCardPresent() only returns when the MFRC522 timer runs out after
+// 25 ms.
+#define SIM_CARD_POLL_US 25000
+#define SIM_CARD_REQUEST_US 1000
+#define SIM_CARD_SELECT_US 3000
+#define SIM_CARD_AUTH_US 5000
+#define SIM_CARD_READ_US 3000
+#define SIM_CARD_WRITE_US 6000
+#define SIM_CARD_REGISTER_US 5      // one register access over SPI
+#define SIM_CARD_FRAME_US 500       // sending a frame
+
+// The card on the simulated reader. 4 byte UIDs are MIFARE Classic 1K cards
+// (16 byte blocks), 7 byte UIDs MIFARE Ultralight / NTAG tags (4 byte pages).
+//
+// A placed card answers one request, like a real card which is halted after
+// reading and stays on the reader.
+//
+// Over the emulated registers the card answers the frames of ISO 14443-3
+// (REQA, WUPA, anticollision and select per cascade level, HLTA) and the
+// MIFARE READ and NTAG PWD_AUTH commands, checking their CRC_A.
+//
+// Faulty writes can be injected: failed writes are NAKed and the card goes
+// back to idle (like a card pulled away), torn writes are acknowledged but
+// leave the old data.
+class SimCard
+{
+    public:
+        enum class State : uint8_t
+        {
+            None,
+            Idle,
+            Ready,
+            Active,
+            Halted
+        };
+
+        void place(const uint8_t *uid, uint8_t uidSize);
+        void remove(void) { _state = State::None; }
+        void writeChunk(uint8_t chunk, const uint8_t *data, uint8_t length);
+        void failWrites(uint8_t count) { _failWrites = count; }
+        void tearWrites(uint8_t count) { _tearWrites = count; }
+        bool write(uint16_t address, const uint8_t *data, uint8_t length);
+        int8_t answer(const uint8_t *frame, uint8_t length, uint8_t lastBits, uint8_t *response, uint32_t &us);
+
+        State state(void) const { return _state; }
+        void setState(State state) { _state = state; }
+        const uint8_t *uid(void) const { return _uid; }
+        uint8_t uidSize(void) const { return _uidSize; }
+        bool ultralight(void) const { return _uidSize == 7; }
+        uint8_t *memory(void) { return _memory; }
+
+    private:
+        bool cascade(uint8_t level, uint8_t *bytes) const;
+
+        State _state = State::None;
+        uint8_t _uid[10];
+        uint8_t _uidSize = 0;
+        uint8_t _memory[1024];
+        uint8_t _failWrites = 0;
+        uint8_t _tearWrites = 0;
+};
+
+extern SimCard simCard;
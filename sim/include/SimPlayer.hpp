@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+
+// Time the DFPlayer commands take (in microseconds): SoftwareSerial blocks
+// while sending the 10 bytes of a command at 9600 baud, queries also wait
+// for the answer.
+#define SIM_PLAYER_COMMAND_US 10420
+#define SIM_PLAYER_QUERY_US 40000
+
+// Timing of the DFPlayer model (see SimPlayer::setModel()): opening a file
+// until the audio starts and the busy pin goes low, sending the
+// notification after the end of a file, the length of a voice prompt or
+// advertisement.
+#define SIM_PLAYER_START_US 100000
+#define SIM_PLAYER_NOTIFY_US 10420
+#define SIM_PLAYER_PROMPT_US 1500000
+
+// The simulated DFPlayer Mini behind DFMiniMp3.h. Commands are passed to a
+// listener, notifications and answers to queries are queued by the
+// simulation and handed to the firmware by DFMiniMp3::loop() and the query
+// functions. The busy pin is driven by the simulation as well.
+//
+// With setModel() the player behaves on its own instead: it plays the files
+// of the folders added with addFolder(), drives the busy pin, sends the
+// notification at the end of each file and answers the track count queries.
+class SimPlayer
+{
+    public:
+        enum class Command : uint8_t
+        {
+            Begin,
+            PlayFolderTrack,
+            PlayMp3FolderTrack,
+            PlayAdvertisement,
+            StopAdvertisement,
+            Start,
+            Pause,
+            Stop,
+            NextTrack,
+            PrevTrack,
+            SetVolume,
+            IncreaseVolume,
+            DecreaseVolume,
+            SetEq,
+            Sleep,
+            Reset,
+            GetFolderTrackCount,
+            GetTotalTrackCount,
+            GetStatus
+        };
+
+        enum class Notification : uint8_t
+        {
+            PlayFinished,
+            Error
+        };
+
+        typedef std::function<void(Command command, uint16_t arg1, uint16_t arg2)> Listener;
+
+        // called when the audio of a file starts or ends, folder is 0 for
+        // the mp3 folder and 0xFF for advertisements
+        typedef std::function<void(bool started, uint8_t folder, uint16_t track)> AudioListener;
+
+        void command(Command command, uint16_t arg1 = 0, uint16_t arg2 = 0);
+        uint16_t query(Command command, uint16_t arg = 0);
+
+        void notify(Notification notification, uint16_t value);
+        bool nextNotification(Notification &notification, uint16_t &value);
+        void answer(uint16_t value) { _answers.push_back(value); }
+
+        void setListener(Listener listener) { _listener = listener; }
+        void setAudioListener(AudioListener listener) { _audioListener = listener; }
+
+        void setModel(uint8_t busyPin);
+        void addFolder(uint8_t folder, uint16_t tracks, uint32_t trackUs);
+        uint8_t volume(void) const { return _volume; }
+        bool playing(uint8_t folder) const { return _file.playing && _file.folder == folder; }
+        uint32_t missingAnswers(void) const { return _missingAnswers; }
+
+        static const char *commandName(Command command);
+
+    private:
+        struct PendingNotification
+        {
+            Notification notification;
+            uint16_t value;
+        };
+
+        // the file being played by the model, an advertisement interrupts it
+        struct File
+        {
+            uint8_t folder = 0;
+            uint16_t track = 0;
+            uint64_t remaining = 0;     // µs of audio left
+            uint64_t startedAt = 0;
+            bool playing = false;
+        };
+
+        struct Folder
+        {
+            uint16_t tracks;
+            uint32_t trackUs;
+        };
+
+        void model(Command command, uint16_t arg1, uint16_t arg2);
+        void play(uint8_t folder, uint16_t track, uint64_t length);
+        void start(void);
+        void pause(void);
+        void finished(void);
+
+        Listener _listener;
+        AudioListener _audioListener;
+        std::deque<PendingNotification> _notifications;
+        std::deque<uint16_t> _answers;
+        uint8_t _volume = 0;
+        uint32_t _missingAnswers = 0;
+
+        bool _model = false;
+        uint8_t _busyPin = 0;
+        std::map<uint8_t, Folder> _folders;
+        File _file;
+        File _interrupted;              // the file paused by an advertisement
+        uint32_t _generation = 0;       // invalidates the scheduled start and end of a file
+};
+
+extern SimPlayer simPlayer;
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <Arduino.h>
+
+// only passed to DFMiniMp3, the simulated DFPlayer doesn't use it
+class SoftwareSerial
+{
+    public:
+        SoftwareSerial(uint8_t rxPin, uint8_t txPin) {}
+        void begin(long baud) {}
+        bool listen(void) { return true; }
+};
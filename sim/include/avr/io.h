@@ -0,0 +1,42 @@
+#pragma once
+
+// registers used by the firmware, the simulated board doesn't emulate them
+// except for the ADC measuring the bandgap against the supply (see
+// SimBoard::setSupply())
+
+#include <stdint.h>
+
+extern volatile uint8_t MCUSR;
+
+// starting a conversion (ADSC) converts right away
+struct SimAdcsra
+{
+    SimAdcsra &operator|=(uint8_t bits);
+    SimAdcsra &operator&=(uint8_t bits) { value &= bits; return *this; }
+    operator uint8_t() const { return value; }
+    uint8_t value = 0;
+};
+
+extern volatile uint8_t ADMUX;
+extern SimAdcsra ADCSRA;
+extern volatile uint16_t ADC;
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define REFS0 6
+#define REFS1 7
+#define ADSC 6
+#define ADEN 7
+
+#define E2END 1023
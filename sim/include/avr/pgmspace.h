@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(string) (string)
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
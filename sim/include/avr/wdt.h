@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#define WDTO_15MS 0
+#define WDTO_250MS 4
+#define WDTO_500MS 5
+#define WDTO_1S 6
+#define WDTO_2S 7
+
+void wdt_enable(uint8_t timeout);
+void wdt_disable(void);
+void wdt_reset(void);
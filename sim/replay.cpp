@@ -0,0 +1,327 @@
+/*
+  Replays a trace recorded by the box (see Trace.hpp, `t` over Serial) with
+  the firmware running on the PC and reports how long the firmware took to
+  react to each input.
+
+    make && build/replay [-v] [--tail SECONDS] trace.txt
+
+  The trace may be the complete serial log, only lines starting with `T ` are
+  used. Button edges, cards and DFPlayer notifications are fed into the
+  simulated board at their recorded time, the DFPlayer answers and the busy
+  pin follow the recording as well. The reaction to an input is the first
+  DFPlayer command sent after it (before the next input); its latency is
+  measured on the simulated clock, which models the time the hardware takes
+  (see SimBoard.hpp, SimPlayer.hpp and SimCard.hpp).
+*/
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "EepromLayout.hpp"
+#include "SimBoard.hpp"
+#include "SimCard.hpp"
+#include "SimPlayer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+void setup();
+void loop();
+
+// pins of the box, see main.cpp
+static const uint8_t buttonPins[] = {A0, A1, A2, A3, A4};
+static const char *const buttonNames[] = {"pause", "up", "down", "four", "five"};
+static const uint8_t busyPin = 4;
+
+struct Input
+{
+    uint64_t time;              // µs
+    std::string description;
+    std::string reaction;
+    int64_t latency = -1;       // µs, -1 = no reaction
+};
+
+static std::vector<Input> inputs;
+static int currentInput = -1;
+
+static void fail(const std::string &message)
+{
+    std::cerr << "ERROR: " << message << std::endl;
+    exit(1);
+}
+
+static std::vector<uint8_t> parseHex(const std::string &hex)
+{
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2)
+        bytes.push_back(strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+    return bytes;
+}
+
+static void scheduleInput(uint64_t time, const std::string &description, std::function<void()> action)
+{
+    size_t index = inputs.size();
+    inputs.push_back(Input());
+    inputs.back().time = time;
+    inputs.back().description = description;
+    simBoard.at(time, [index, action]() {
+        currentInput = index;
+        action();
+    });
+}
+
+static void scheduleCard(uint64_t time, const std::vector<uint8_t> &uid, const std::vector<uint8_t> &data,
+                         const std::vector<uint8_t> &playlist)
+{
+    std::ostringstream description;
+    description << "card";
+    for (uint8_t byte : uid)
+        description << ' ' << std::hex << (byte >> 4) << (byte & 0xF) << std::dec;
+    if (data.size() >= 9)
+        description << " (folder " << (int)data[5] << ", mode " << (int)data[6] << ")";
+
+    scheduleInput(time, description.str(), [uid, data, playlist]() {
+        simCard.place(uid.data(), uid.size());
+        simCard.writeChunk(0, data.data(), std::min<size_t>(data.size(), 16));
+        std::vector<uint8_t> entries(playlist);
+        entries.resize(32);
+        simCard.writeChunk(1, entries.data(), 16);
+        simCard.writeChunk(2, entries.data() + 16, 16);
+    });
+}
+
+/**
+  Reads the `T` lines of the trace and schedules them. Returns the time of
+  the last input.
+*/
+static uint64_t loadTrace(std::istream &in)
+{
+    struct Line
+    {
+        uint64_t ms;
+        char type;
+        std::vector<std::string> values;
+    };
+    std::vector<Line> lines;
+    bool boot = false;
+    std::string text;
+    while (std::getline(in, text))
+    {
+        std::istringstream fields(text);
+        std::string prefix, first;
+        if (!(fields >> prefix >> first) || prefix != "T")
+            continue;
+
+        if (first == "X")
+        {
+            std::string hex;
+            fields >> hex;
+            std::vector<uint8_t> settings = parseHex(hex);
+            std::copy(settings.begin(), settings.end(), EEPROM.data() + EEPROM_SETTINGS_ADDRESS);
+            continue;
+        }
+        if (first == "D")
+        {
+            std::cerr << "Warning: the box dropped the first " << fields.rdbuf() << " records of the trace" << std::endl;
+            continue;
+        }
+
+        Line line;
+        line.ms = strtoull(first.c_str(), nullptr, 10);
+        std::string type;
+        fields >> type;
+        line.type = type.empty() ? '?' : type[0];
+        for (std::string value; fields >> value;)
+            line.values.push_back(value);
+        boot |= line.type == 'S';
+        lines.push_back(line);
+    }
+    if (lines.empty())
+        fail("no trace records found");
+
+    // without the boot record, the trace starts somewhere in the middle:
+    // the first input gets replayed 5 s after the start
+    uint64_t offset = 0;
+    if (!boot && lines[0].ms > 5000)
+    {
+        offset = lines[0].ms - 5000;
+        std::cerr << "Warning: no boot record, inputs are shifted by " << offset << " ms" << std::endl;
+    }
+
+    uint64_t last = 0;
+    uint8_t blankCards = 0;
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        const Line &line = lines[i];
+        uint64_t time = (line.ms - std::min(line.ms, offset)) * 1000;
+        auto value = [&line](size_t index) -> unsigned long {
+            return index < line.values.size() ? strtoul(line.values[index].c_str(), nullptr, 10) : 0;
+        };
+
+        switch (line.type)
+        {
+        case 'S':
+            simBoard.forceRandomSeed(value(0));
+            break;
+        case 'B':
+        {
+            uint8_t button = std::min<unsigned long>(value(0), 4);
+            bool pressed = value(1) != 0;
+            scheduleInput(time, std::string("button ") + buttonNames[button] + (pressed ? " pressed" : " released"),
+                          [button, pressed]() { simBoard.setPin(buttonPins[button], !pressed); });
+            break;
+        }
+        case 'C':
+        {
+            std::vector<uint8_t> uid, data, playlist;
+            if (line.values.size() >= 2)
+            {
+                uid = parseHex(line.values[0]);
+                data = parseHex(line.values[1]);
+            }
+            else
+            {
+                // placed while waiting for a card to write, a blank card
+                uid = {0xF0, 0x00, 0x00, ++blankCards};
+            }
+            if (i + 1 < lines.size() && lines[i + 1].type == 'L' && !lines[i + 1].values.empty())
+                playlist = parseHex(lines[i + 1].values[0]);
+            scheduleCard(time, uid, data, playlist);
+            break;
+        }
+        case 'F':
+        {
+            uint16_t track = value(0);
+            scheduleInput(time, "DFPlayer finished track " + std::to_string(track),
+                          [track]() { simPlayer.notify(SimPlayer::Notification::PlayFinished, track); });
+            break;
+        }
+        case 'E':
+        {
+            uint16_t code = value(0);
+            scheduleInput(time, "DFPlayer error " + std::to_string(code),
+                          [code]() { simPlayer.notify(SimPlayer::Notification::Error, code); });
+            break;
+        }
+        case 'P':
+        {
+            bool playing = value(0) != 0;
+            simBoard.at(time, [playing]() { simBoard.setPin(busyPin, !playing); });
+            break;
+        }
+        case 'Q':
+            simPlayer.answer(value(0));
+            break;
+        default:
+            continue;
+        }
+        last = std::max(last, time);
+    }
+    return last;
+}
+
+static void onPlayerCommand(SimPlayer::Command command, uint16_t arg1, uint16_t arg2)
+{
+    if (currentInput < 0 || inputs[currentInput].latency >= 0)
+        return;
+    if (command == SimPlayer::Command::GetFolderTrackCount || command == SimPlayer::Command::GetTotalTrackCount ||
+        command == SimPlayer::Command::GetStatus)
+        return;
+
+    Input &input = inputs[currentInput];
+    input.latency = simBoard.micros() - input.time;
+    input.reaction = std::string(SimPlayer::commandName(command)) + "(";
+    if (command == SimPlayer::Command::PlayFolderTrack)
+        input.reaction += std::to_string(arg1) + ", " + std::to_string(arg2);
+    else if (command == SimPlayer::Command::PlayMp3FolderTrack || command == SimPlayer::Command::PlayAdvertisement ||
+             command == SimPlayer::Command::SetVolume || command == SimPlayer::Command::SetEq)
+        input.reaction += std::to_string(arg1);
+    input.reaction += ")";
+}
+
+static double percentile(std::vector<int64_t> values, double fraction)
+{
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))] / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+    std::string traceFile;
+    double tail = 5;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-v" || arg == "--verbose")
+            simBoard.setSerialEcho(true);
+        else if (arg == "--tail" && i + 1 < argc)
+            tail = atof(argv[++i]);
+        else if (arg == "-h" || arg == "--help")
+        {
+            std::cout << "Usage: " << argv[0] << " [-v] [--tail SECONDS] trace.txt\n\n"
+                      << "Replays a trace recorded by the box (`t` over Serial, -D EVENT_TRACE) with the\n"
+                      << "firmware running on the PC and reports the latency of the reaction to each input.\n\n"
+                      << "  -v, --verbose     Print the serial output of the firmware\n"
+                      << "  --tail SECONDS    Keep running after the last input (default: 5)\n";
+            return 0;
+        }
+        else
+            traceFile = arg;
+    }
+    if (traceFile.empty())
+        fail("no trace file given, see --help");
+
+    std::ifstream in(traceFile);
+    if (!in)
+        fail("can't read " + traceFile);
+    uint64_t last = loadTrace(in);
+
+    simBoard.setPin(busyPin, true);
+    simBoard.stopAt(last + (uint64_t)(tail * 1e6));
+    simPlayer.setListener(onPlayerCommand);
+
+    std::string reason;
+    auto startTime = std::chrono::steady_clock::now();
+    try
+    {
+        setup();
+        while (true)
+            loop();
+    }
+    catch (const SimStop &stop)
+    {
+        reason = stop.reason;
+    }
+    double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::vector<int64_t> latencies;
+    printf("\n    time  input                                        reaction                     latency\n");
+    for (const Input &input : inputs)
+    {
+        if (input.time > simBoard.micros())
+            break;
+        printf("%8.3f  %-44s %-28s", input.time / 1e6, input.description.c_str(),
+               input.latency >= 0 ? input.reaction.c_str() : "-");
+        if (input.latency >= 0)
+        {
+            printf(" %8.1f ms", input.latency / 1000.0);
+            latencies.push_back(input.latency);
+        }
+        printf("\n");
+    }
+
+    double simulated = simBoard.micros() / 1e6;
+    printf("\nReplayed %zu inputs, %.1f s in %.2f s (%.0fx real time), stopped: %s\n", inputs.size(), simulated,
+           wallTime, wallTime > 0 ? simulated / wallTime : 0, reason.c_str());
+    if (!latencies.empty())
+        printf("Reactions to %zu inputs: median %.1f ms, 95%% %.1f ms, max %.1f ms\n", latencies.size(),
+               percentile(latencies, 0.5), percentile(latencies, 0.95), percentile(latencies, 1.0));
+    if (simPlayer.missingAnswers() != 0)
+        printf("Warning: %u DFPlayer queries weren't answered by the trace\n", simPlayer.missingAnswers());
+    return 0;
+}
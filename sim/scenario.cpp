@@ -0,0 +1,352 @@
+/*
+  Runs a scripted scenario with the firmware on the PC and reports the
+  latencies the user notices, per kind of interaction.
+
+    make && build/scenario [-v] scenarios/cards.txt
+
+  Unlike replay.cpp, which follows a recording, the DFPlayer runs as a model
+  here (see SimPlayer::setModel()): files play for their length, the busy
+  pin follows the audio and the notification comes at the end of each file.
+  The card reader and the DFPlayer commands take their modeled time (see
+  SimCard.hpp and SimPlayer.hpp).
+
+  The script has one command per line, `#` starts a comment:
+
+    folder <n> <tracks> <seconds>   tracks on the SD card and their length
+    seed <n>                        seed of the jitter below
+    card <uid> <data> [<playlist>]  taps a card (hex, like the trace)
+    press <button> [<ms>]           presses pause, up, down, four or five
+                                    for 100 ms (or <ms>)
+    wait <ms> [<jitter>]            waits, plus a random 0 - <jitter> ms
+    supply <mV>                     sets the supply voltage (default 5000),
+                                    see -D BATTERY_MONITOR
+    playing <folder>                fails unless a track of the folder is
+                                    playing at this point
+    repeat <n> ... end              repeats the lines in between
+
+  The interactions and what ends them:
+
+    card       the first audio after the tap
+    button     the first DFPlayer command after the press (short presses
+               only act on the release)
+    track end  the audio of the next file after the end of a track
+*/
+
+#include <Arduino.h>
+
+#include "SimBoard.hpp"
+#include "SimCard.hpp"
+#include "SimPlayer.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+void setup();
+void loop();
+
+// pins of the box, see main.cpp
+static const uint8_t buttonPins[] = {A0, A1, A2, A3, A4};
+static const char *const buttonNames[] = {"pause", "up", "down", "four", "five"};
+static const uint8_t busyPin = 4;
+
+enum class Reaction : uint8_t
+{
+    Audio,
+    Command
+};
+
+struct Interaction
+{
+    uint64_t time;              // µs
+    std::string name;
+    Reaction reaction;
+    std::string result;         // what ended it
+    int64_t latency = -1;       // µs, -1 = no reaction
+    bool open = true;
+};
+
+static std::vector<Interaction> interactions;
+
+static void fail(const std::string &message)
+{
+    std::cerr << "ERROR: " << message << std::endl;
+    exit(1);
+}
+
+static std::vector<uint8_t> parseHex(const std::string &hex)
+{
+    std::vector<uint8_t> bytes;
+    for (size_t i = 0; i + 1 < hex.size(); i += 2)
+        bytes.push_back(strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+    return bytes;
+}
+
+/**
+  A track end still waiting for the next track when the user does something
+  had no reaction: the next audio belongs to the new interaction.
+*/
+static void startInteraction(const std::string &name, Reaction reaction)
+{
+    for (Interaction &interaction : interactions)
+        if (interaction.name == "track end")
+            interaction.open = false;
+    interactions.push_back(Interaction());
+    interactions.back().time = simBoard.micros();
+    interactions.back().name = name;
+    interactions.back().reaction = reaction;
+}
+
+/**
+  Ends all interactions waiting for this kind of reaction.
+*/
+static void react(Reaction reaction, const std::string &result)
+{
+    for (Interaction &interaction : interactions)
+    {
+        if (!interaction.open || interaction.reaction != reaction)
+            continue;
+        interaction.open = false;
+        interaction.latency = simBoard.micros() - interaction.time;
+        interaction.result = result;
+    }
+}
+
+static void onPlayerCommand(SimPlayer::Command command, uint16_t arg1, uint16_t arg2)
+{
+    if (command == SimPlayer::Command::GetFolderTrackCount || command == SimPlayer::Command::GetTotalTrackCount ||
+        command == SimPlayer::Command::GetStatus)
+        return;
+    react(Reaction::Command, SimPlayer::commandName(command));
+}
+
+static void onAudio(bool started, uint8_t folder, uint16_t track)
+{
+    if (started)
+        react(Reaction::Audio, "audio");
+    // only the tracks of the folders, not voice prompts or advertisements
+    else if (folder >= 1 && folder <= 99)
+        startInteraction("track end", Reaction::Audio);
+}
+
+class Script
+{
+    public:
+        explicit Script(std::istream &in);
+        uint64_t schedule(void);
+
+    private:
+        uint64_t run(size_t begin, size_t end, uint64_t time);
+        size_t blockEnd(size_t repeat);
+
+        std::vector<std::vector<std::string>> _lines;
+        std::vector<size_t> _numbers;
+        std::mt19937 _random;
+};
+
+Script::Script(std::istream &in)
+{
+    std::string text;
+    for (size_t number = 1; std::getline(in, text); number++)
+    {
+        text = text.substr(0, text.find('#'));
+        std::istringstream fields(text);
+        std::vector<std::string> line;
+        for (std::string field; fields >> field;)
+            line.push_back(field);
+        if (line.empty())
+            continue;
+        _lines.push_back(line);
+        _numbers.push_back(number);
+    }
+}
+
+/**
+  Schedules the inputs of the script, starting now. Returns the time of the
+  end of the script.
+*/
+uint64_t Script::schedule(void)
+{
+    return run(0, _lines.size(), simBoard.micros());
+}
+
+size_t Script::blockEnd(size_t repeat)
+{
+    int depth = 0;
+    for (size_t i = repeat; i < _lines.size(); i++)
+    {
+        if (_lines[i][0] == "repeat")
+            depth++;
+        else if (_lines[i][0] == "end" && --depth == 0)
+            return i;
+    }
+    fail("line " + std::to_string(_numbers[repeat]) + ": repeat without end");
+    return 0;
+}
+
+uint64_t Script::run(size_t begin, size_t end, uint64_t time)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        const std::vector<std::string> &line = _lines[i];
+        auto value = [&line](size_t index, unsigned long fallback) -> unsigned long {
+            return index < line.size() ? strtoul(line[index].c_str(), nullptr, 10) : fallback;
+        };
+        const std::string &command = line[0];
+
+        if (command == "folder" && line.size() == 4)
+            simPlayer.addFolder(value(1, 0), value(2, 0), (uint32_t)(atof(line[3].c_str()) * 1e6));
+        else if (command == "seed")
+            _random.seed(value(1, 0));
+        else if (command == "card" && line.size() >= 3)
+        {
+            std::vector<uint8_t> uid = parseHex(line[1]);
+            std::vector<uint8_t> data = parseHex(line[2]);
+            std::vector<uint8_t> entries = line.size() > 3 ? parseHex(line[3]) : std::vector<uint8_t>();
+            data.resize(16);
+            entries.resize(32);
+            simBoard.at(time, [uid, data, entries]() {
+                startInteraction("card", Reaction::Audio);
+                simCard.place(uid.data(), uid.size());
+                simCard.writeChunk(0, data.data(), 16);
+                simCard.writeChunk(1, entries.data(), 16);
+                simCard.writeChunk(2, entries.data() + 16, 16);
+            });
+        }
+        else if (command == "press" && line.size() >= 2)
+        {
+            auto name = std::find(std::begin(buttonNames), std::end(buttonNames), line[1]);
+            if (name == std::end(buttonNames))
+                fail("line " + std::to_string(_numbers[i]) + ": unknown button " + line[1]);
+            uint8_t button = name - std::begin(buttonNames);
+            simBoard.at(time, [button]() {
+                startInteraction(std::string("button ") + buttonNames[button], Reaction::Command);
+                simBoard.setPin(buttonPins[button], false);
+            });
+            time += value(2, 100) * 1000;
+            simBoard.at(time, [button]() { simBoard.setPin(buttonPins[button], true); });
+        }
+        else if (command == "wait" && line.size() >= 2)
+        {
+            unsigned long jitter = value(2, 0);
+            time += (value(1, 0) + (jitter != 0 ? _random() % (jitter + 1) : 0)) * 1000;
+        }
+        else if (command == "supply" && line.size() == 2)
+        {
+            uint16_t millivolts = value(1, 5000);
+            simBoard.at(time, [millivolts]() { simBoard.setSupply(millivolts); });
+        }
+        else if (command == "playing" && line.size() == 2)
+        {
+            uint8_t folder = value(1, 0);
+            size_t number = _numbers[i];
+            simBoard.at(time, [folder, number]() {
+                if (!simPlayer.playing(folder))
+                    fail("line " + std::to_string(number) + ": no track of folder " + std::to_string(folder) +
+                         " playing");
+            });
+        }
+        else if (command == "repeat" && line.size() == 2)
+        {
+            size_t blockEnd = this->blockEnd(i);
+            for (unsigned long n = value(1, 0); n > 0; n--)
+                time = run(i + 1, blockEnd, time);
+            i = blockEnd;
+        }
+        else
+            fail("line " + std::to_string(_numbers[i]) + ": can't parse " + command);
+    }
+    return time;
+}
+
+static double percentile(std::vector<int64_t> values, double fraction)
+{
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))] / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+    std::string scriptFile;
+    double tail = 10;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-v" || arg == "--verbose")
+            simBoard.setSerialEcho(true);
+        else if (arg == "--tail" && i + 1 < argc)
+            tail = atof(argv[++i]);
+        else if (arg == "-h" || arg == "--help")
+        {
+            std::cout << "Usage: " << argv[0] << " [-v] [--tail SECONDS] scenario.txt\n\n"
+                      << "Runs a scripted scenario with the firmware on the PC and a model of the DFPlayer\n"
+                      << "and reports the latencies per kind of interaction.\n\n"
+                      << "  -v, --verbose     Print the serial output of the firmware\n"
+                      << "  --tail SECONDS    Keep running after the end of the script (default: 10)\n";
+            return 0;
+        }
+        else
+            scriptFile = arg;
+    }
+    if (scriptFile.empty())
+        fail("no scenario given, see --help");
+
+    std::ifstream in(scriptFile);
+    if (!in)
+        fail("can't read " + scriptFile);
+    Script script(in);
+
+    simPlayer.setModel(busyPin);
+    simPlayer.setListener(onPlayerCommand);
+    simPlayer.setAudioListener(onAudio);
+
+    std::string reason;
+    try
+    {
+        setup();
+        // the inputs start once the box is up
+        interactions.clear();
+        simBoard.stopAt(script.schedule() + (uint64_t)(tail * 1e6));
+        while (true)
+            loop();
+    }
+    catch (const SimStop &stop)
+    {
+        reason = stop.reason;
+    }
+
+    // grouped by interaction and what ended it, in order of appearance
+    std::vector<std::string> order;
+    std::map<std::string, std::vector<int64_t>> latencies;
+    std::map<std::string, unsigned> missing;
+    for (const Interaction &interaction : interactions)
+    {
+        if (interaction.latency < 0)
+        {
+            missing[interaction.name]++;
+            continue;
+        }
+        std::string key = interaction.name + " -> " + interaction.result;
+        if (latencies.find(key) == latencies.end())
+            order.push_back(key);
+        latencies[key].push_back(interaction.latency);
+    }
+
+    printf("\n%-32s %7s %10s %10s %10s\n", "interaction", "count", "p50 ms", "p99 ms", "max ms");
+    for (const std::string &key : order)
+    {
+        const std::vector<int64_t> &values = latencies[key];
+        printf("%-32s %7zu %10.1f %10.1f %10.1f\n", key.c_str(), values.size(), percentile(values, 0.5),
+               percentile(values, 0.99), percentile(values, 1.0));
+    }
+    for (const auto &entry : missing)
+        printf("%-32s %7u %10s %10s %10s\n", (entry.first + " -> none").c_str(), entry.second, "-", "-", "-");
+
+    printf("\nSimulated %.1f s, stopped: %s\n", simBoard.micros() / 1e6, reason.c_str());
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <SPI.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+#include "SimBoard.hpp"
+
+#include <stdio.h>
+
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+SPIClass SPI;
+volatile uint8_t MCUSR;
+volatile uint8_t ADMUX;
+SimAdcsra ADCSRA;
+volatile uint16_t ADC;
+
+/**
+  Converts the bandgap (1.1 V) against AVcc, the only input the firmware
+  uses. ADSC is cleared when it's done.
+*/
+SimAdcsra &SimAdcsra::operator|=(uint8_t bits)
+{
+    value |= bits;
+    if (value & _BV(ADSC))
+    {
+        simBoard.advance(SIM_ANALOG_READ_US);
+        ADC = (uint16_t)(1100UL * 1024 / simBoard.supply());
+        value &= ~_BV(ADSC);
+    }
+    return *this;
+}
+
+unsigned long millis(void)
+{
+    simBoard.advance(SIM_CALL_US);
+    return simBoard.millis();
+}
+
+unsigned long micros(void)
+{
+    simBoard.advance(SIM_CALL_US);
+    return simBoard.micros();
+}
+
+void delay(unsigned long ms)
+{
+    simBoard.advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    simBoard.advance(us);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    simBoard.setPinMode(pin, mode);
+}
+
+int digitalRead(uint8_t pin)
+{
+    simBoard.advance(SIM_PIN_READ_US);
+    return simBoard.pin(pin) ? HIGH : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    simBoard.setPin(pin, value != LOW);
+}
+
+int analogRead(uint8_t pin)
+{
+    simBoard.advance(SIM_ANALOG_READ_US);
+    return simBoard.random() & 0x3FF;
+}
+
+long random(long howBig)
+{
+    if (howBig == 0)
+        return 0;
+    return simBoard.random() % howBig;
+}
+
+long random(long howSmall, long howBig)
+{
+    if (howSmall >= howBig)
+        return howSmall;
+    return random(howBig - howSmall) + howSmall;
+}
+
+/**
+  A simulation replaying a trace uses the seed recorded on the box instead.
+*/
+void randomSeed(unsigned long seed)
+{
+    if (simBoard.seedForced())
+        seed = simBoard.forcedSeed();
+    if (seed != 0)
+        simBoard.setRandomSeed(seed);
+}
+
+void cli(void)
+{
+    simBoard.setInterrupts(false);
+}
+
+void sei(void)
+{
+    simBoard.setInterrupts(true);
+}
+
+void set_sleep_mode(uint8_t mode) {}
+void sleep_enable(void) {}
+void sleep_disable(void) {}
+
+/**
+  Idle sleep ends with the next timer 0 tick.
+*/
+void sleep_cpu(void)
+{
+    simBoard.advance(1000 - simBoard.micros() % 1000);
+}
+
+/**
+  Sleeping with disabled interrupts is the power down of the standby timer.
+*/
+void sleep_mode(void)
+{
+    if (!simBoard.interrupts())
+        simBoard.stop("power off");
+    sleep_cpu();
+}
+
+void wdt_enable(uint8_t timeout) {}
+void wdt_disable(void) {}
+void wdt_reset(void) {}
+
+size_t Print::write(const char *string)
+{
+    size_t n = 0;
+    while (*string)
+        n += write((uint8_t)*string++);
+    return n;
+}
+
+size_t Print::print(long value, int base)
+{
+    if (value < 0 && base == DEC)
+        return write((uint8_t)'-') + print((unsigned long)-value, base);
+    return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base)
+{
+    char buffer[sizeof(unsigned long) * 8 + 1];
+    char *p = buffer + sizeof(buffer) - 1;
+    *p = 0;
+    do
+    {
+        uint8_t digit = value % base;
+        *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+        value /= base;
+    } while (value != 0);
+    return write(p);
+}
+
+size_t Print::print(double value, int digits)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+    return write(buffer);
+}
+
+/**
+  Like Arduino's parseInt(): skips everything up to the first digit, returns 0
+  after waiting for the timeout if there is none.
+*/
+long Stream::parseInt(void)
+{
+    while (available() && peek() != '-' && (peek() < '0' || peek() > '9'))
+        read();
+    if (!available())
+    {
+        delay(_timeout);
+        return 0;
+    }
+
+    bool negative = peek() == '-';
+    if (negative)
+        read();
+    long value = 0;
+    while (available() && peek() >= '0' && peek() <= '9')
+        value = value * 10 + read() - '0';
+    return negative ? -value : value;
+}
+
+size_t HardwareSerial::write(uint8_t value)
+{
+    simBoard.serialWrite(value);
+    return 1;
+}
+
+int HardwareSerial::available(void)
+{
+    return simBoard.serialInput().size();
+}
+
+int HardwareSerial::read(void)
+{
+    if (simBoard.serialInput().empty())
+        return -1;
+    int value = (uint8_t)simBoard.serialInput()[0];
+    simBoard.serialInput().erase(0, 1);
+    return value;
+}
+
+int HardwareSerial::peek(void)
+{
+    return simBoard.serialInput().empty() ? -1 : (uint8_t)simBoard.serialInput()[0];
+}
+
+uint8_t EEPROMClass::read(int address)
+{
+    return _data[address % sizeof(_data)];
+}
+
+void EEPROMClass::write(int address, uint8_t value)
+{
+    simBoard.advance(SIM_EEPROM_WRITE_US);
+    _data[address % sizeof(_data)] = value;
+}
+
+void EEPROMClass::update(int address, uint8_t value)
+{
+    if (read(address) != value)
+        write(address, value);
+}
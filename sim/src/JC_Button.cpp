@@ -0,0 +1,36 @@
+#include <JC_Button.h>
+
+void Button::begin(void)
+{
+    pinMode(_pin, _puEnable ? INPUT_PULLUP : INPUT);
+    _state = digitalRead(_pin);
+    if (_invert)
+        _state = !_state;
+    _time = millis();
+    _lastState = _state;
+    _changed = false;
+    _lastChange = _time;
+}
+
+bool Button::read(void)
+{
+    uint32_t ms = millis();
+    bool pinValue = digitalRead(_pin);
+    if (_invert)
+        pinValue = !pinValue;
+
+    if (ms - _lastChange < _dbTime)
+    {
+        _changed = false;
+    }
+    else
+    {
+        _lastState = _state;
+        _state = pinValue;
+        _changed = (_state != _lastState);
+        if (_changed)
+            _lastChange = ms;
+    }
+    _time = ms;
+    return _state;
+}
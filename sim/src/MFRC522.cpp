@@ -0,0 +1,458 @@
+#include <MFRC522.h>
+
+#include "SimBoard.hpp"
+#include "SimCard.hpp"
+
+SimCard simCard;
+
+/**
+  Places a card with empty memory, it answers the next request.
+*/
+void SimCard::place(const uint8_t *uid, uint8_t uidSize)
+{
+    memcpy(_uid, uid, uidSize);
+    _uidSize = uidSize;
+    memset(_memory, 0, sizeof(_memory));
+    _state = State::Idle;
+}
+
+/**
+  Writes a 16 byte chunk of the TonUINO card data, see CardManager::readChunk().
+*/
+void SimCard::writeChunk(uint8_t chunk, const uint8_t *data, uint8_t length)
+{
+    uint16_t address = ultralight() ? (8 + chunk * 4) * 4 : (4 + chunk) * 16;
+    memcpy(_memory + address, data, length);
+}
+
+/**
+  Writes to the memory of an active card, unless a faulty write was
+  injected. Returns false if the write isn't acknowledged.
+*/
+bool SimCard::write(uint16_t address, const uint8_t *data, uint8_t length)
+{
+    if (_state != State::Active)
+        return false;
+    if (_failWrites != 0)
+    {
+        _failWrites--;
+        _state = State::Idle;
+        return false;
+    }
+    if (_tearWrites != 0)
+        _tearWrites--;
+    else
+        memcpy(_memory + address % sizeof(_memory), data, length);
+    return true;
+}
+
+/**
+  CRC_A of ISO 14443-3, low byte first.
+*/
+static uint16_t crcA(const uint8_t *data, uint8_t length)
+{
+    uint16_t crc = 0x6363;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        uint8_t b = data[i] ^ (uint8_t)crc;
+        b ^= b << 4;
+        crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ (b >> 4);
+    }
+    return crc;
+}
+
+static bool crcValid(const uint8_t *frame, uint8_t length)
+{
+    if (length < 3)
+        return false;
+    uint16_t crc = crcA(frame, length - 2);
+    return frame[length - 2] == (uint8_t)crc && frame[length - 1] == (uint8_t)(crc >> 8);
+}
+
+static uint8_t appendCrc(uint8_t *data, uint8_t length)
+{
+    uint16_t crc = crcA(data, length);
+    data[length] = crc;
+    data[length + 1] = crc >> 8;
+    return length + 2;
+}
+
+/**
+  The 4 UID bytes of a cascade level, with the cascade tag 0x88 in front of
+  3 UID bytes if another level follows. False if the UID has no such level.
+*/
+bool SimCard::cascade(uint8_t level, uint8_t *bytes) const
+{
+    uint8_t levels = _uidSize == 4 ? 1 : (_uidSize == 7 ? 2 : 3);
+    if (level >= levels)
+        return false;
+    if (level + 1 < levels)
+    {
+        bytes[0] = 0x88;
+        memcpy(bytes + 1, _uid + level * 3, 3);
+    }
+    else
+        memcpy(bytes, _uid + level * 3, 4);
+    return true;
+}
+
+/**
+  Answers a frame sent by the reader. Returns the length of the answer, -1
+  for none. us is the time until the answer is there.
+*/
+int8_t SimCard::answer(const uint8_t *frame, uint8_t length, uint8_t lastBits, uint8_t *response, uint32_t &us)
+{
+    us = SIM_CARD_FRAME_US;
+    if (_state == State::None || length == 0)
+        return -1;
+
+    // REQA / WUPA
+    if (lastBits == 7 && length == 1)
+    {
+        if (!(frame[0] == 0x26 && _state == State::Idle) &&
+            !(frame[0] == 0x52 && (_state == State::Idle || _state == State::Halted)))
+            return -1;
+        _state = State::Ready;
+        us = SIM_CARD_REQUEST_US;
+        response[0] = ultralight() ? 0x44 : 0x04;
+        response[1] = 0x00;
+        return 2;
+    }
+
+    // anticollision and select of a cascade level
+    if (frame[0] == 0x93 || frame[0] == 0x95 || frame[0] == 0x97)
+    {
+        uint8_t level = (frame[0] - 0x93) / 2;
+        uint8_t bytes[4];
+        if (_state != State::Ready || !cascade(level, bytes))
+            return -1;
+        us = SIM_CARD_SELECT_US / 2;
+        if (length == 2 && frame[1] == 0x20)
+        {
+            memcpy(response, bytes, 4);
+            response[4] = bytes[0] ^ bytes[1] ^ bytes[2] ^ bytes[3];
+            return 5;
+        }
+        if (length != 9 || frame[1] != 0x70 || !crcValid(frame, 9) || memcmp(frame + 2, bytes, 4) != 0)
+            return -1;
+        uint8_t dummy[4];
+        if (cascade(level + 1, dummy))
+            response[0] = 0x04;
+        else
+        {
+            response[0] = ultralight() ? 0x00 : 0x08;
+            _state = State::Active;
+        }
+        return appendCrc(response, 1);
+    }
+
+    if (_state != State::Active || !crcValid(frame, length))
+        return -1;
+
+    switch (frame[0])
+    {
+    case 0x50:      // HLTA
+        _state = State::Halted;
+        return -1;
+    case 0x30:      // READ
+    {
+        us = SIM_CARD_READ_US;
+        uint16_t address = ultralight() ? frame[1] * 4 : frame[1] * 16;
+        memcpy(response, _memory + address % sizeof(_memory), 16);
+        return appendCrc(response, 16);
+    }
+    case 0x1B:      // PWD_AUTH
+        us = SIM_CARD_AUTH_US;
+        response[0] = response[1] = 0;
+        return appendCrc(response, 2);
+    default:
+        return -1;
+    }
+}
+
+void MFRC522::PCD_DumpVersionToSerial(void)
+{
+    Serial.println(F("Firmware Version: 0x92 = v2.0 (simulated)"));
+}
+
+void MFRC522::PCD_WriteRegister(PCD_Register reg, byte value)
+{
+    simBoard.advance(SIM_CARD_REGISTER_US);
+    update();
+    switch (reg)
+    {
+    case CommandReg:
+        _registers[reg >> 1] = value;
+        _busy = false;
+        if (value == PCD_MFAuthent)
+            authenticate();
+        break;
+    case ComIrqReg:
+        // bit 7 tells whether the marked bits are set or cleared
+        if (value & 0x80)
+            _registers[reg >> 1] |= value & 0x7F;
+        else
+            _registers[reg >> 1] &= ~value;
+        break;
+    case FIFODataReg:
+        if (_fifoLength < sizeof(_fifo))
+            _fifo[_fifoLength++] = value;
+        break;
+    case FIFOLevelReg:
+        if (value & 0x80)
+            _fifoLength = _fifoRead = 0;
+        break;
+    case BitFramingReg:
+        _registers[reg >> 1] = value & 0x7F;
+        if ((value & 0x80) && _registers[CommandReg >> 1] == PCD_Transceive)
+            transceive();
+        break;
+    default:
+        _registers[reg >> 1] = value;
+        break;
+    }
+}
+
+void MFRC522::PCD_WriteRegister(PCD_Register reg, byte count, byte *values)
+{
+    for (byte i = 0; i < count; i++)
+        PCD_WriteRegister(reg, values[i]);
+}
+
+byte MFRC522::PCD_ReadRegister(PCD_Register reg)
+{
+    simBoard.advance(SIM_CARD_REGISTER_US);
+    update();
+    switch (reg)
+    {
+    case FIFODataReg:
+        return _fifoRead < _fifoLength ? _fifo[_fifoRead++] : 0;
+    case FIFOLevelReg:
+        return _fifoLength - _fifoRead;
+    default:
+        return _registers[reg >> 1];
+    }
+}
+
+void MFRC522::PCD_ReadRegister(PCD_Register reg, byte count, byte *values, byte rxAlign)
+{
+    for (byte i = 0; i < count; i++)
+        values[i] = PCD_ReadRegister(reg);
+}
+
+void MFRC522::PCD_SetRegisterBitMask(PCD_Register reg, byte mask)
+{
+    PCD_WriteRegister(reg, PCD_ReadRegister(reg) | mask);
+}
+
+void MFRC522::PCD_ClearRegisterBitMask(PCD_Register reg, byte mask)
+{
+    PCD_WriteRegister(reg, PCD_ReadRegister(reg) & ~mask);
+}
+
+/**
+  Sends the FIFO to the card. Its answer arrives in the FIFO after the
+  modeled time, without answer the timer runs out after 25 ms.
+*/
+void MFRC522::transceive(void)
+{
+    uint32_t us;
+    _responseLength = simCard.answer(_fifo + _fifoRead, _fifoLength - _fifoRead,
+                                     _registers[BitFramingReg >> 1] & 0x07, _response, us);
+    _responseBits = 0;
+    _fifoLength = _fifoRead = 0;
+    _sentAt = simBoard.micros() + SIM_CARD_FRAME_US;
+    if (_responseLength < 0)
+    {
+        _doneAt = simBoard.micros() + SIM_CARD_POLL_US;
+        _irq = 0x01;
+    }
+    else
+    {
+        _doneAt = simBoard.micros() + us;
+        _irq = 0x30;
+    }
+    _busy = true;
+}
+
+/**
+  MFAuthent with command, block, key and UID in the FIFO, sets MFCrypto1On
+  if the card is selected.
+*/
+void MFRC522::authenticate(void)
+{
+    bool ok = simCard.state() == SimCard::State::Active && _fifoLength - _fifoRead == 12;
+    _fifoLength = _fifoRead = 0;
+    _responseLength = 0;
+    _sentAt = simBoard.micros();
+    _doneAt = simBoard.micros() + (ok ? SIM_CARD_AUTH_US : SIM_CARD_POLL_US);
+    _irq = ok ? 0x10 : 0x01;
+    if (ok)
+        _registers[Status2Reg >> 1] |= 0x08;
+    _busy = true;
+}
+
+/**
+  Sets the interrupt bits of the running command and fills in the answer
+  once their time has passed.
+*/
+void MFRC522::update(void)
+{
+    if (!_busy)
+        return;
+    if (simBoard.micros() >= _sentAt)
+        _registers[ComIrqReg >> 1] |= 0x40;
+    if (simBoard.micros() < _doneAt)
+        return;
+    _registers[ComIrqReg >> 1] |= _irq;
+    _registers[ErrorReg >> 1] = 0;
+    if (_responseLength > 0)
+    {
+        memcpy(_fifo, _response, _responseLength);
+        _fifoLength = _responseLength;
+        _fifoRead = 0;
+    }
+    _registers[ControlReg >> 1] = _responseBits;
+    _busy = false;
+}
+
+bool MFRC522::PICC_IsNewCardPresent(void)
+{
+    if (simCard.state() != SimCard::State::Idle)
+    {
+        simBoard.advance(SIM_CARD_POLL_US);
+        return false;
+    }
+    simBoard.advance(SIM_CARD_REQUEST_US);
+    simCard.setState(SimCard::State::Ready);
+    return true;
+}
+
+bool MFRC522::PICC_ReadCardSerial(void)
+{
+    simBoard.advance(SIM_CARD_SELECT_US);
+    if (simCard.state() != SimCard::State::Ready)
+        return false;
+
+    uid.size = simCard.uidSize();
+    memcpy(uid.uidByte, simCard.uid(), uid.size);
+    uid.sak = simCard.ultralight() ? 0x00 : 0x08;
+    simCard.setState(SimCard::State::Active);
+    return true;
+}
+
+MFRC522::StatusCode MFRC522::PICC_WakeupA(byte *bufferATQA, byte *bufferSize)
+{
+    simBoard.advance(SIM_CARD_REQUEST_US);
+    if (simCard.state() != SimCard::State::Idle && simCard.state() != SimCard::State::Halted)
+        return STATUS_TIMEOUT;
+    simCard.setState(SimCard::State::Ready);
+    return STATUS_OK;
+}
+
+/**
+  Selects the card if it is ready and its UID starts with the known bits.
+*/
+MFRC522::StatusCode MFRC522::PICC_Select(Uid *uid, byte validBits)
+{
+    simBoard.advance(SIM_CARD_SELECT_US);
+    if (simCard.state() != SimCard::State::Ready || validBits > simCard.uidSize() * 8 ||
+        memcmp(uid->uidByte, simCard.uid(), validBits / 8) != 0)
+        return STATUS_TIMEOUT;
+
+    uid->size = simCard.uidSize();
+    memcpy(uid->uidByte, simCard.uid(), uid->size);
+    uid->sak = simCard.ultralight() ? 0x00 : 0x08;
+    simCard.setState(SimCard::State::Active);
+    return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PICC_HaltA(void)
+{
+    simBoard.advance(SIM_CARD_REQUEST_US);
+    if (simCard.state() != SimCard::State::None)
+        simCard.setState(SimCard::State::Halted);
+    return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::PCD_Authenticate(byte command, byte blockAddr, MIFARE_Key *key, Uid *uid)
+{
+    simBoard.advance(SIM_CARD_AUTH_US);
+    return simCard.state() == SimCard::State::Active ? STATUS_OK : STATUS_TIMEOUT;
+}
+
+MFRC522::StatusCode MFRC522::PCD_NTAG216_AUTH(byte *passWord, byte pACK[])
+{
+    simBoard.advance(SIM_CARD_AUTH_US);
+    return simCard.state() == SimCard::State::Active ? STATUS_OK : STATUS_TIMEOUT;
+}
+
+/**
+  Reads 16 bytes: a block of a Classic card or four pages of an Ultralight.
+*/
+MFRC522::StatusCode MFRC522::MIFARE_Read(byte blockAddr, byte *buffer, byte *bufferSize)
+{
+    simBoard.advance(SIM_CARD_READ_US);
+    if (buffer == nullptr || *bufferSize < 18)
+        return STATUS_NO_ROOM;
+    if (simCard.state() != SimCard::State::Active)
+        return STATUS_TIMEOUT;
+
+    uint16_t address = simCard.ultralight() ? blockAddr * 4 : blockAddr * 16;
+    memcpy(buffer, simCard.memory() + address % 1024, 16);
+    buffer[16] = buffer[17] = 0;
+    *bufferSize = 18;
+    return STATUS_OK;
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Write(byte blockAddr, byte *buffer, byte bufferSize)
+{
+    simBoard.advance(SIM_CARD_WRITE_US);
+    if (buffer == nullptr || bufferSize < 16)
+        return STATUS_INVALID;
+    return simCard.write(blockAddr * 16, buffer, 16) ? STATUS_OK : STATUS_TIMEOUT;
+}
+
+MFRC522::StatusCode MFRC522::MIFARE_Ultralight_Write(byte page, byte *buffer, byte bufferSize)
+{
+    simBoard.advance(SIM_CARD_WRITE_US);
+    if (buffer == nullptr || bufferSize < 4)
+        return STATUS_INVALID;
+    return simCard.write(page * 4, buffer, 4) ? STATUS_OK : STATUS_TIMEOUT;
+}
+
+MFRC522::PICC_Type MFRC522::PICC_GetType(byte sak)
+{
+    switch (sak & 0x7F)
+    {
+    case 0x00: return PICC_TYPE_MIFARE_UL;
+    case 0x08: return PICC_TYPE_MIFARE_1K;
+    case 0x09: return PICC_TYPE_MIFARE_MINI;
+    case 0x18: return PICC_TYPE_MIFARE_4K;
+    default: return PICC_TYPE_UNKNOWN;
+    }
+}
+
+const __FlashStringHelper *MFRC522::PICC_GetTypeName(PICC_Type type)
+{
+    switch (type)
+    {
+    case PICC_TYPE_MIFARE_UL: return F("MIFARE Ultralight or Ultralight C");
+    case PICC_TYPE_MIFARE_1K: return F("MIFARE 1KB");
+    case PICC_TYPE_MIFARE_MINI: return F("MIFARE Mini, 320 bytes");
+    case PICC_TYPE_MIFARE_4K: return F("MIFARE 4KB");
+    default: return F("Unknown type");
+    }
+}
+
+const __FlashStringHelper *MFRC522::GetStatusCodeName(StatusCode code)
+{
+    switch (code)
+    {
+    case STATUS_OK: return F("Success.");
+    case STATUS_TIMEOUT: return F("Timeout in communication.");
+    case STATUS_NO_ROOM: return F("A buffer is not big enough.");
+    case STATUS_INVALID: return F("Invalid argument.");
+    default: return F("Error in communication.");
+    }
+}
@@ -0,0 +1,79 @@
+#include "SimBoard.hpp"
+
+#include <stdio.h>
+
+SimBoard simBoard;
+
+/**
+  Advances the clock, running all scheduled actions it passes on the way.
+  Throws SimStop when the end of the simulation is reached.
+*/
+void SimBoard::advance(uint64_t us)
+{
+    uint64_t target = _micros + us;
+    while (!_actions.empty() && _actions.begin()->first <= target)
+    {
+        auto action = _actions.begin();
+        if (action->first > _micros)
+            _micros = action->first;
+        std::function<void()> run = action->second;
+        _actions.erase(action);
+        run();
+    }
+    _micros = target;
+
+    if (_stopAt != 0 && _micros >= _stopAt)
+        stop("end of simulation");
+}
+
+void SimBoard::at(uint64_t us, std::function<void()> action)
+{
+    _actions.insert(std::make_pair(us, action));
+}
+
+void SimBoard::stop(const std::string &reason)
+{
+    _stopAt = 0;
+    throw SimStop{reason};
+}
+
+void SimBoard::setPinMode(uint8_t pin, uint8_t mode)
+{
+    // inputs with pull up read HIGH as long as nothing pulls them down
+    if (mode == 2)
+        _pins[pin] = true;
+}
+
+/**
+  Characters go into the 64 byte TX buffer, Serial.print() only blocks once
+  it is full.
+*/
+void SimBoard::serialWrite(uint8_t value)
+{
+    if (_serialBusyUntil < _micros)
+        _serialBusyUntil = _micros;
+    _serialBusyUntil += SIM_SERIAL_CHAR_US;
+    if (_serialBusyUntil - _micros > SIM_SERIAL_BUFFER * SIM_SERIAL_CHAR_US)
+        advance(_serialBusyUntil - _micros - SIM_SERIAL_BUFFER * SIM_SERIAL_CHAR_US);
+
+    if (_serialEcho)
+        putchar(value);
+}
+
+/**
+  The random number generator of avr-libc, so a seed gives the same numbers
+  as on the box.
+*/
+uint32_t SimBoard::random(void)
+{
+    int32_t x = _random;
+    if (x == 0)
+        x = 123459876L;
+    int32_t hi = x / 127773L;
+    int32_t lo = x % 127773L;
+    x = 16807L * lo - 2836L * hi;
+    if (x < 0)
+        x += 0x7fffffffL;
+    _random = x;
+    return x % 0x80000000UL;
+}
@@ -0,0 +1,222 @@
+#include "SimPlayer.hpp"
+#include "SimBoard.hpp"
+
+#include <algorithm>
+
+SimPlayer simPlayer;
+
+void SimPlayer::command(Command command, uint16_t arg1, uint16_t arg2)
+{
+    simBoard.advance(SIM_PLAYER_COMMAND_US);
+
+    switch (command)
+    {
+    case Command::SetVolume:
+        _volume = arg1;
+        break;
+    case Command::IncreaseVolume:
+        if (_volume < 30)
+            _volume++;
+        break;
+    case Command::DecreaseVolume:
+        if (_volume > 0)
+            _volume--;
+        break;
+    default:
+        break;
+    }
+    if (_model)
+        model(command, arg1, arg2);
+
+    if (_listener)
+        _listener(command, arg1, arg2);
+}
+
+/**
+  Returns the next queued answer - or 0, like the library does if the
+  DFPlayer doesn't answer.
+*/
+uint16_t SimPlayer::query(Command command, uint16_t arg)
+{
+    simBoard.advance(SIM_PLAYER_QUERY_US);
+    if (_listener)
+        _listener(command, arg, 0);
+
+    if (_answers.empty() && _model)
+    {
+        uint16_t tracks = 0;
+        for (const auto &folder : _folders)
+            if (command == Command::GetTotalTrackCount || folder.first == arg)
+                tracks += folder.second.tracks;
+        return command == Command::GetStatus ? (_file.playing ? 0x0201 : 0x0200) : tracks;
+    }
+    if (_answers.empty())
+    {
+        _missingAnswers++;
+        return 0;
+    }
+    uint16_t value = _answers.front();
+    _answers.pop_front();
+    return value;
+}
+
+void SimPlayer::notify(Notification notification, uint16_t value)
+{
+    _notifications.push_back(PendingNotification{notification, value});
+}
+
+bool SimPlayer::nextNotification(Notification &notification, uint16_t &value)
+{
+    if (_notifications.empty())
+        return false;
+    notification = _notifications.front().notification;
+    value = _notifications.front().value;
+    _notifications.pop_front();
+    return true;
+}
+
+/**
+  Lets the player play files on its own, see SimPlayer.hpp.
+*/
+void SimPlayer::setModel(uint8_t busyPin)
+{
+    _model = true;
+    _busyPin = busyPin;
+    simBoard.setPin(_busyPin, true);
+}
+
+void SimPlayer::addFolder(uint8_t folder, uint16_t tracks, uint32_t trackUs)
+{
+    _folders[folder] = Folder{tracks, trackUs};
+}
+
+void SimPlayer::model(Command command, uint16_t arg1, uint16_t arg2)
+{
+    switch (command)
+    {
+    case Command::PlayFolderTrack:
+    {
+        auto folder = _folders.find(arg1);
+        play(arg1, arg2, folder != _folders.end() ? folder->second.trackUs : SIM_PLAYER_PROMPT_US);
+        break;
+    }
+    case Command::PlayMp3FolderTrack:
+        play(0, arg1, SIM_PLAYER_PROMPT_US);
+        break;
+    case Command::PlayAdvertisement:
+        // only interrupts a file being played
+        if (!_file.playing || _file.folder == 0xFF)
+            break;
+        pause();
+        _interrupted = _file;
+        play(0xFF, arg1, SIM_PLAYER_PROMPT_US);
+        break;
+    case Command::StopAdvertisement:
+        if (_file.folder == 0xFF)
+            finished();
+        break;
+    case Command::Start:
+        start();
+        break;
+    case Command::Pause:
+        pause();
+        break;
+    case Command::Begin:
+    case Command::Stop:
+    case Command::Sleep:
+    case Command::Reset:
+        pause();
+        _file = File();
+        _interrupted = File();
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+  Stops the current file and opens the new one, the audio starts
+  SIM_PLAYER_START_US later.
+*/
+void SimPlayer::play(uint8_t folder, uint16_t track, uint64_t length)
+{
+    pause();
+    if (folder != 0xFF)
+        _interrupted = File();
+    _file = File();
+    _file.folder = folder;
+    _file.track = track;
+    _file.remaining = length;
+    start();
+}
+
+void SimPlayer::start(void)
+{
+    if (_file.playing || _file.remaining == 0)
+        return;
+
+    uint32_t generation = ++_generation;
+    simBoard.at(simBoard.micros() + SIM_PLAYER_START_US, [this, generation]() {
+        if (generation != _generation)
+            return;
+        _file.playing = true;
+        _file.startedAt = simBoard.micros();
+        simBoard.setPin(_busyPin, false);
+        if (_audioListener)
+            _audioListener(true, _file.folder, _file.track);
+        simBoard.at(simBoard.micros() + _file.remaining, [this, generation]() {
+            if (generation == _generation)
+                finished();
+        });
+    });
+}
+
+/**
+  Keeps the rest of the file for start(), also cancels a file which hasn't
+  started yet.
+*/
+void SimPlayer::pause(void)
+{
+    _generation++;
+    if (!_file.playing)
+        return;
+    _file.remaining -= std::min(_file.remaining, simBoard.micros() - _file.startedAt);
+    _file.playing = false;
+    simBoard.setPin(_busyPin, true);
+}
+
+/**
+  The end of a file: the busy pin goes high and the notification follows.
+  After an advertisement the interrupted file continues instead.
+*/
+void SimPlayer::finished(void)
+{
+    File file = _file;
+    _generation++;
+    _file.playing = false;
+    _file.remaining = 0;
+    simBoard.setPin(_busyPin, true);
+    if (_audioListener)
+        _audioListener(false, file.folder, file.track);
+
+    if (file.folder == 0xFF)
+    {
+        _file = _interrupted;
+        _interrupted = File();
+        start();
+        return;
+    }
+    uint16_t track = file.track;
+    simBoard.at(simBoard.micros() + SIM_PLAYER_NOTIFY_US,
+                [this, track]() { notify(Notification::PlayFinished, track); });
+}
+
+const char *SimPlayer::commandName(Command command)
+{
+    static const char *const names[] = {
+        "begin", "playFolderTrack", "playMp3FolderTrack", "playAdvertisement", "stopAdvertisement",
+        "start", "pause", "stop", "nextTrack", "prevTrack", "setVolume", "increaseVolume",
+        "decreaseVolume", "setEq", "sleep", "reset", "getFolderTrackCount", "getTotalTrackCount",
+        "getStatus"};
+    return names[(uint8_t)command];
+}
@@ -0,0 +1,178 @@
+#include "BatteryMonitor.hpp"
+
+#include <avr/io.h>
+
+BatteryMonitor batteryMonitor;
+
+#ifdef BATTERY_MONITOR
+// AVcc as reference, the bandgap as input
+#define BATTERY_ADMUX (_BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1))
+
+// the bandgap needs about 1 ms after being selected
+#define BATTERY_SETTLE_TIME 2
+
+static const uint16_t thresholds[] = {BATTERY_WARNING_MV, BATTERY_LOW_MV, BATTERY_CRITICAL_MV};
+#endif
+
+/**
+  Takes the first measurement, waiting for it.
+*/
+void BatteryMonitor::begin(void)
+{
+#ifdef BATTERY_MONITOR
+    startMeasurement();
+    delay(BATTERY_SETTLE_TIME);
+    ADCSRA |= _BV(ADSC);
+    while (bit_is_set(ADCSRA, ADSC))
+        ;
+    _minimum = millivolts();
+    _average = _minimum * 8;
+    _phase = Phase::Idle;
+    _phaseStart = millis();
+#endif
+}
+
+/**
+  Continues the measurement. Returns true when the level dropped.
+*/
+bool BatteryMonitor::loop(void)
+{
+#ifdef BATTERY_MONITOR
+    switch (_phase)
+    {
+    case Phase::Idle:
+        if (millis() - _phaseStart >= BATTERY_INTERVAL)
+            startMeasurement();
+        return false;
+    case Phase::Settling:
+        if (millis() - _phaseStart >= BATTERY_SETTLE_TIME)
+        {
+            ADCSRA |= _BV(ADSC);
+            _phase = Phase::Converting;
+        }
+        return false;
+    case Phase::Converting:
+        if (!measurementDone())
+            return false;
+        break;
+    }
+
+    // exponential moving average over 8 measurements
+    uint16_t sample = millivolts();
+    _average = _average - _average / 8 + sample;
+    if (_average / 8 < _minimum)
+        _minimum = _average / 8;
+    _phase = Phase::Idle;
+    _phaseStart = millis();
+
+    BatteryLevel level = levelFor(_average / 8);
+    if (level == _level)
+        return false;
+    bool dropped = level > _level;
+    _level = level;
+    Serial.print(F("Versorgung: "));
+    Serial.print(_average / 8);
+    Serial.print(F(" mV, Stufe "));
+    Serial.println((uint8_t)_level);
+    return dropped;
+#else
+    return false;
+#endif
+}
+
+BatteryLevel BatteryMonitor::level(void)
+{
+#ifdef BATTERY_MONITOR
+    return _level;
+#else
+    return BatteryLevel::Normal;
+#endif
+}
+
+/**
+  Caps a volume while the supply is sagging, loud passages draw the most
+  current.
+*/
+uint8_t BatteryMonitor::limitVolume(uint8_t volume)
+{
+    if (level() >= BatteryLevel::Warning && volume > BATTERY_MAX_VOLUME)
+        return BATTERY_MAX_VOLUME;
+    return volume;
+}
+
+/**
+  Whether the card reader should be polled in this loop iteration.
+*/
+bool BatteryMonitor::cardPollDue(void)
+{
+#ifdef BATTERY_MONITOR
+    if (_level < BatteryLevel::Low)
+        return true;
+    if (millis() - _lastCardPoll < BATTERY_CARD_POLL_INTERVAL)
+        return false;
+    _lastCardPoll = millis();
+#endif
+    return true;
+}
+
+void BatteryMonitor::print(void)
+{
+#ifdef BATTERY_MONITOR
+    Serial.println(F("=== Versorgung"));
+    Serial.print(F("Spannung: "));
+    Serial.print(_average / 8);
+    Serial.println(F(" mV"));
+    Serial.print(F("Minimum: "));
+    Serial.print(_minimum);
+    Serial.println(F(" mV"));
+    Serial.print(F("Stufe: "));
+    Serial.println((uint8_t)_level);
+#else
+    Serial.println(F("Spannungsüberwachung nicht aktiviert (-D BATTERY_MONITOR)"));
+#endif
+}
+
+#ifdef BATTERY_MONITOR
+void BatteryMonitor::startMeasurement(void)
+{
+    ADMUX = BATTERY_ADMUX;
+    _phase = Phase::Settling;
+    _phaseStart = millis();
+}
+
+bool BatteryMonitor::measurementDone(void)
+{
+    return bit_is_clear(ADCSRA, ADSC);
+}
+
+/**
+  Converts the reading to mV, at most BATTERY_MAX_MV - a reading of 0 or
+  close to it would overflow the average.
+*/
+uint16_t BatteryMonitor::millivolts(void)
+{
+    uint16_t adc = ADC;
+    if (adc <= BATTERY_BANDGAP_MV * 1024 / BATTERY_MAX_MV)
+        return BATTERY_MAX_MV;
+    return BATTERY_BANDGAP_MV * 1024 / adc;
+}
+
+/**
+  The level for the average, with hysteresis: a better level than the
+  current one needs BATTERY_HYSTERESIS_MV more.
+*/
+BatteryLevel BatteryMonitor::levelFor(uint16_t millivolts)
+{
+    uint8_t level = 0;
+    while (level < 3)
+    {
+        uint16_t threshold = thresholds[level];
+        if (level < (uint8_t)_level)
+            threshold += BATTERY_HYSTERESIS_MV;
+        if (millivolts >= threshold)
+            break;
+        level++;
+    }
+    return (BatteryLevel)level;
+}
+#endif
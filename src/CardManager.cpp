@@ -20,6 +20,9 @@ void CardManager::begin(void)
 
 bool CardManager::readCard(NfcTagObject &nfcTag)
 {
+#ifdef ASYNC_CARD_READ
+    return readStep(nfcTag);
+#else
     if (!_mfrc522.PICC_IsNewCardPresent())
         return false;
 
@@ -30,42 +33,35 @@ bool CardManager::readCard(NfcTagObject &nfcTag)
     Serial.print(F("Card UID:"));
     dump_byte_array(_mfrc522.uid.uidByte, _mfrc522.uid.size);
     Serial.println();
-    Serial.print(F("PICC type: "));
-    MFRC522::PICC_Type piccType = _mfrc522.PICC_GetType(_mfrc522.uid.sak);
-    Serial.println(_mfrc522.PICC_GetTypeName(piccType));
-
-    byte trailerBlock = 7;
-    byte blockAddr = 4;
-    MFRC522::MIFARE_Key key = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
-    MFRC522::StatusCode status;
 
-    // Authenticate using key A
-    if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI) ||
-        (piccType == MFRC522::PICC_TYPE_MIFARE_1K) ||
-        (piccType == MFRC522::PICC_TYPE_MIFARE_4K))
+#ifdef UID_CARD_TABLE
+    // known UIDs are resolved without authenticating or reading the tag
+    memset(nfcTag.playlist, 0, sizeof(nfcTag.playlist));
+    if (_uidTable.lookup(_mfrc522.uid, nfcTag.nfcFolderSettings))
     {
-        Serial.println(F("Authenticating Classic using key A..."));
-        status = _mfrc522.PCD_Authenticate(
-            MFRC522::PICC_CMD_MF_AUTH_KEY_A, trailerBlock, &key, &(_mfrc522.uid));
+        Serial.println(F("Card found in UID table"));
+        _mfrc522.PICC_HaltA();
+        nfcTag.cookie = NFC_TAG_COOKIE;
+        nfcTag.version = 2;
+        return true;
     }
-    else if (piccType == MFRC522::PICC_TYPE_MIFARE_UL)
-    {
-        byte pACK[] = {0, 0}; // 16 bit PassWord ACK returned by the tempCard
+#endif
 
-        // Authenticate using key A
-        Serial.println(F("Authenticating MIFARE UL..."));
-        status = _mfrc522.PCD_NTAG216_AUTH(key.keyByte, pACK);
-    }
-    else
+    Serial.print(F("PICC type: "));
+    MFRC522::PICC_Type piccType = _mfrc522.PICC_GetType(_mfrc522.uid.sak);
+    Serial.println(_mfrc522.PICC_GetTypeName(piccType));
+
+    if (!handledType(piccType))
     {
-        Serial.print(F("Unhandled type"));
-        return false;
+        Serial.println(F("Unhandled type"));
+        return unreadableCard(nfcTag);
     }
 
-    if (status != MFRC522::STATUS_OK)
+    // a failed authentication may just be a bad read of a configured card:
+    // the tag isn't halted, so it is read again
+    if (!authenticate(piccType))
     {
-        Serial.print(F("PCD_Authenticate() failed: "));
-        Serial.println(_mfrc522.GetStatusCodeName(status));
+        _mfrc522.PCD_StopCrypto1();
         return false;
     }
 
@@ -75,68 +71,49 @@ bool CardManager::readCard(NfcTagObject &nfcTag)
     // Serial.println();
 
     byte buffer[18];
-    byte size = sizeof(buffer);
+    byte entries[2 * 16 + 2];
 
     // Read data from the block
-    if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI) ||
-        (piccType == MFRC522::PICC_TYPE_MIFARE_1K) ||
-        (piccType == MFRC522::PICC_TYPE_MIFARE_4K))
+    Serial.println(F("Reading data from block 4 ..."));
+    if (!readChunk(piccType, 0, buffer))
+        return false;
+
+    // playlist cards carry their entries in the following two chunks,
+    // still covered by the authentication above
+    if (buffer[6] == PLAYLIST_MODE)
     {
-        Serial.print(F("Reading data from block "));
-        Serial.print(blockAddr);
-        Serial.println(F(" ..."));
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Read(blockAddr, buffer, &size);
-        if (status != MFRC522::STATUS_OK)
-        {
-            Serial.print(F("MIFARE_Read() failed: "));
-            Serial.println(_mfrc522.GetStatusCodeName(status));
+        if (!readChunk(piccType, 1, entries) || !readChunk(piccType, 2, entries + 16))
             return false;
-        }
     }
-    else if (piccType == MFRC522::PICC_TYPE_MIFARE_UL)
-    {
-        byte buffer2[18];
-        byte size2 = sizeof(buffer2);
 
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Read(8, buffer2, &size2);
-        if (status != MFRC522::STATUS_OK)
-        {
-            Serial.print(F("MIFARE_Read_1() failed: "));
-            Serial.println(_mfrc522.GetStatusCodeName(status));
-            return false;
-        }
-        memcpy(buffer, buffer2, 4);
-
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Read(9, buffer2, &size2);
-        if (status != MFRC522::STATUS_OK)
-        {
-            Serial.print(F("MIFARE_Read_2() failed: "));
-            Serial.println(_mfrc522.GetStatusCodeName(status));
-            return false;
-        }
-        memcpy(buffer + 4, buffer2, 4);
+    _mfrc522.PICC_HaltA();
+    _mfrc522.PCD_StopCrypto1();
 
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Read(10, buffer2, &size2);
-        if (status != MFRC522::STATUS_OK)
-        {
-            Serial.print(F("MIFARE_Read_3() failed: "));
-            Serial.println(_mfrc522.GetStatusCodeName(status));
-            return false;
-        }
-        memcpy(buffer + 8, buffer2, 4);
+    decodeCard(buffer, entries, nfcTag);
+    return true;
+#endif
+}
 
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Read(11, buffer2, &size2);
-        if (status != MFRC522::STATUS_OK)
-        {
-            Serial.print(F("MIFARE_Read_4() failed: "));
-            Serial.println(_mfrc522.GetStatusCodeName(status));
-            return false;
-        }
-        memcpy(buffer + 12, buffer2, 4);
-    }
+/**
+  Whether a tag answered and is being read, see readStep().
+*/
+bool CardManager::reading(void)
+{
+#ifdef ASYNC_CARD_READ
+    return _step > ReadStep::Request;
+#else
+    return false;
+#endif
+}
 
-    _mfrc522.PICC_HaltA();
-    _mfrc522.PCD_StopCrypto1();
+/**
+  Fills the tag from chunk 0 and for playlist cards the entries of chunks
+  1 and 2.
+*/
+void CardManager::decodeCard(byte *buffer, const byte *entries, NfcTagObject &nfcTag)
+{
+    if (buffer[6] == PLAYLIST_MODE && buffer[7] > PLAYLIST_MAX_ENTRIES)
+        buffer[7] = PLAYLIST_MAX_ENTRIES;
 
     Serial.print(F("Data on Card "));
     Serial.println(F(":"));
@@ -157,94 +134,667 @@ bool CardManager::readCard(NfcTagObject &nfcTag)
     nfcTag.nfcFolderSettings.special = buffer[7];
     nfcTag.nfcFolderSettings.special2 = buffer[8];
 
+    memset(nfcTag.playlist, 0, sizeof(nfcTag.playlist));
+    if (buffer[6] == PLAYLIST_MODE)
+    {
+        for (byte i = 0; i < buffer[7]; i++)
+        {
+            nfcTag.playlist[i].folder = entries[i * 3];
+            nfcTag.playlist[i].firstTrack = entries[i * 3 + 1];
+            nfcTag.playlist[i].lastTrack = entries[i * 3 + 2];
+        }
+    }
+}
+
+/**
+  Tags of other types (bank cards, toy figures) can't carry our data. With
+  the UID card table they are reported as new cards, so they can be
+  configured anyway.
+*/
+bool CardManager::handledType(MFRC522::PICC_Type piccType)
+{
+    return piccType == MFRC522::PICC_TYPE_MIFARE_MINI || piccType == MFRC522::PICC_TYPE_MIFARE_1K ||
+           piccType == MFRC522::PICC_TYPE_MIFARE_4K || piccType == MFRC522::PICC_TYPE_MIFARE_UL;
+}
+
+bool CardManager::unreadableCard(NfcTagObject &nfcTag)
+{
+#ifdef UID_CARD_TABLE
+    _mfrc522.PICC_HaltA();
+    _mfrc522.PCD_StopCrypto1();
+    memset(&nfcTag, 0, sizeof(nfcTag));
     return true;
+#else
+    return false;
+#endif
 }
 
 CardManagerError CardManager::writeCard(const NfcTagObject &nfcTag)
 {
-    byte buffer[16] = {0x13, 0x37, 0xb3, 0x47,           // 0x1337 0xb347 magic cookie to
-                                                         // identify our nfc tags
-                       0x02,                             // version 2
-                       nfcTag.nfcFolderSettings.folder,  // the folder picked by the user
-                       nfcTag.nfcFolderSettings.mode,    // the playback mode picked by the user
-                       nfcTag.nfcFolderSettings.special, // track or function for admin cards
-                       nfcTag.nfcFolderSettings.special2,
-                       0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+#ifdef UID_CARD_TABLE
+    // the tag itself stays untouched, only its UID gets mapped
+    // (playlist entries don't fit into the table)
+    if (nfcTag.nfcFolderSettings.mode == PLAYLIST_MODE)
+        return CardManagerError::CardManagerTagTooSmall;
+    Serial.println(F("Storing card in UID table"));
+    if (!_uidTable.store(_mfrc522.uid, nfcTag.nfcFolderSettings))
+        return CardManagerError::CardManagerWriteFailed;
+    return CardManagerError::CardManagerSuccess;
+#endif
+
+    // the data of all chunks, see readChunk()
+    byte image[3 * 16];
+    byte chunks = 1;
+
+    memset(image, 0, sizeof(image));
+    image[0] = 0x13;                                // 0x1337 0xb347 magic cookie to
+    image[1] = 0x37;                                // identify our nfc tags
+    image[2] = 0xb3;
+    image[3] = 0x47;
+    image[4] = 0x02;                                // version 2
+    image[5] = nfcTag.nfcFolderSettings.folder;     // the folder picked by the user
+    image[6] = nfcTag.nfcFolderSettings.mode;       // the playback mode picked by the user
+    image[7] = nfcTag.nfcFolderSettings.special;    // track or function for admin cards
+    image[8] = nfcTag.nfcFolderSettings.special2;
+
+    if (nfcTag.nfcFolderSettings.mode == PLAYLIST_MODE)
+    {
+        byte *entries = image + 16;
+        for (byte i = 0; i < nfcTag.nfcFolderSettings.special && i < PLAYLIST_MAX_ENTRIES; i++)
+        {
+            entries[i * 3] = nfcTag.playlist[i].folder;
+            entries[i * 3 + 1] = nfcTag.playlist[i].firstTrack;
+            entries[i * 3 + 2] = nfcTag.playlist[i].lastTrack;
+        }
+        chunks = 3;
+    }
+
+    MFRC522::PICC_Type piccType = _mfrc522.PICC_GetType(_mfrc522.uid.sak);
+    if (!authenticate(piccType))
+        return CardManagerError::CardManagerAuthenticationFailed;
 
-    MFRC522::PICC_Type mifareType = _mfrc522.PICC_GetType(_mfrc522.uid.sak);
+    if (chunks > 1 && !holdsPlaylist(piccType))
+    {
+        Serial.println(F("Tag too small for a playlist"));
+        return CardManagerError::CardManagerTagTooSmall;
+    }
 
-    MFRC522::StatusCode status;
-    byte trailerBlock = 7;
-    byte blockAddr = 4;
+    Serial.println(F("Writing data into block 4 ..."));
+    dump_byte_array(image, chunks * 16);
+    Serial.println();
+
+    // Pages (Ultralight) or blocks (Classic) are written one by one, then the
+    // chunks are read back. Only units which failed are written again, after
+    // selecting the tag again: it doesn't answer after an error.
+    byte units = (piccType == MFRC522::PICC_TYPE_MIFARE_UL) ? chunks * 4 : chunks;
+    uint16_t pending = (1U << units) - 1;
+    CardManagerError result = CardManagerError::CardManagerWriteFailed;
+
+    for (byte attempt = 1; attempt <= CARD_WRITE_ATTEMPTS && pending != 0; attempt++)
+    {
+        if (attempt > 1)
+        {
+            Serial.print(F("Retrying units 0x"));
+            Serial.println(pending, HEX);
+            if (!reselect(piccType))
+            {
+                result = CardManagerError::CardManagerAuthenticationFailed;
+                continue;
+            }
+            // some of them may have been written before the error
+            pending = verifyUnits(piccType, image, pending);
+            if (pending == 0)
+                break;
+        }
+
+        if (!writeUnits(piccType, image, pending))
+        {
+            result = CardManagerError::CardManagerWriteFailed;
+            continue;
+        }
+
+        pending = verifyUnits(piccType, image, pending);
+        result = CardManagerError::CardManagerVerifyFailed;
+    }
+
+    if (pending != 0)
+    {
+        Serial.print(F("Writing card failed, wrong units: 0x"));
+        Serial.println(pending, HEX);
+        return result;
+    }
+
+    Serial.println(F("Card written and verified"));
+    return CardManagerError::CardManagerSuccess;
+}
+
+/**
+  Authenticates with the default key, which covers the sector / pages of
+  all chunks.
+*/
+bool CardManager::authenticate(MFRC522::PICC_Type piccType)
+{
     MFRC522::MIFARE_Key key = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    MFRC522::StatusCode status;
 
-    // Authenticate using key B
-    // authentificate with the card and set card specific parameters
-    if ((mifareType == MFRC522::PICC_TYPE_MIFARE_MINI) ||
-        (mifareType == MFRC522::PICC_TYPE_MIFARE_1K) ||
-        (mifareType == MFRC522::PICC_TYPE_MIFARE_4K))
+    if ((piccType == MFRC522::PICC_TYPE_MIFARE_MINI) ||
+        (piccType == MFRC522::PICC_TYPE_MIFARE_1K) ||
+        (piccType == MFRC522::PICC_TYPE_MIFARE_4K))
     {
-        Serial.println(F("Authenticating again using key A..."));
+        byte trailerBlock = 7;
+
+        Serial.println(F("Authenticating Classic using key A..."));
         status = _mfrc522.PCD_Authenticate(
             MFRC522::PICC_CMD_MF_AUTH_KEY_A, trailerBlock, &key, &(_mfrc522.uid));
     }
-    else if (mifareType == MFRC522::PICC_TYPE_MIFARE_UL)
+    else if (piccType == MFRC522::PICC_TYPE_MIFARE_UL)
     {
-        byte pACK[] = {0, 0}; // 16 bit PassWord ACK returned by the NFCtag
+        byte pACK[] = {0, 0}; // 16 bit PassWord ACK returned by the tag
 
-        // Authenticate using key A
-        Serial.println(F("Authenticating UL..."));
+        Serial.println(F("Authenticating MIFARE UL..."));
         status = _mfrc522.PCD_NTAG216_AUTH(key.keyByte, pACK);
     }
+    else
+    {
+        Serial.println(F("Unhandled type"));
+        return false;
+    }
 
     if (status != MFRC522::STATUS_OK)
     {
         Serial.print(F("PCD_Authenticate() failed: "));
         Serial.println(_mfrc522.GetStatusCodeName(status));
-        return CardManagerError::CardManagerAuthenticationFailed;
+        return false;
     }
 
-    // Write data to the block
-    Serial.print(F("Writing data into block "));
-    Serial.print(blockAddr);
-    Serial.println(F(" ..."));
-    dump_byte_array(buffer, 16);
-    Serial.println();
+    return true;
+}
 
-    if ((mifareType == MFRC522::PICC_TYPE_MIFARE_MINI) ||
-        (mifareType == MFRC522::PICC_TYPE_MIFARE_1K) ||
-        (mifareType == MFRC522::PICC_TYPE_MIFARE_4K))
+/**
+  Whether the tag has room for the playlist chunks. Sector 1 of a Classic
+  always has, but a plain MIFARE Ultralight ends with page 15 and NAKs the
+  read of pages 16-19. The tag needs selecting again after a NAK, a second
+  failed read counts as too small.
+*/
+bool CardManager::holdsPlaylist(MFRC522::PICC_Type piccType)
+{
+    if (piccType != MFRC522::PICC_TYPE_MIFARE_UL)
+        return true;
+
+    byte buffer[18];
+    for (byte attempt = 0; attempt < 2; attempt++)
     {
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Write(blockAddr, buffer, 16);
+        if (readChunk(piccType, 2, buffer))
+            return true;
+        if (!reselect(piccType))
+            return false;
     }
-    else if (mifareType == MFRC522::PICC_TYPE_MIFARE_UL)
+    return false;
+}
+
+/**
+  Selects the tag on the reader again after an error. Only works if it is
+  still (or again) the tag we started with.
+*/
+bool CardManager::reselect(MFRC522::PICC_Type piccType)
+{
+    byte atqa[2];
+    byte atqaSize = sizeof(atqa);
+    MFRC522::Uid uid = _mfrc522.uid;
+
+    _mfrc522.PICC_HaltA();
+    _mfrc522.PCD_StopCrypto1();
+    _mfrc522.PICC_WakeupA(atqa, &atqaSize);
+    if (_mfrc522.PICC_Select(&uid, uid.size * 8) != MFRC522::STATUS_OK ||
+        memcmp(uid.uidByte, _mfrc522.uid.uidByte, uid.size) != 0)
     {
-        byte buffer2[16];
-        byte size2 = sizeof(buffer2);
+        Serial.println(F("Card removed"));
+        return false;
+    }
+
+    return authenticate(piccType);
+}
+
+/**
+  Writes the pending units (pages on Ultralight, blocks on Classic) of the
+  image. Stops at the first error, the tag has to be selected again then.
+*/
+bool CardManager::writeUnits(MFRC522::PICC_Type piccType, byte *image, uint16_t pending)
+{
+    bool ultralight = (piccType == MFRC522::PICC_TYPE_MIFARE_UL);
+    byte unitSize = ultralight ? 4 : 16;
+
+    for (byte unit = 0; (pending >> unit) != 0; unit++)
+    {
+        if (!(pending & (1U << unit)))
+            continue;
+
+        MFRC522::StatusCode status;
+        if (ultralight)
+            status = (MFRC522::StatusCode)_mfrc522.MIFARE_Ultralight_Write(8 + unit, image + unit * unitSize, unitSize);
+        else
+            status = (MFRC522::StatusCode)_mfrc522.MIFARE_Write(4 + unit, image + unit * unitSize, unitSize);
+
+        if (status != MFRC522::STATUS_OK)
+        {
+            Serial.print(F("MIFARE_Write() failed: "));
+            Serial.println(_mfrc522.GetStatusCodeName(status));
+            return false;
+        }
+    }
+
+    return true;
+}
 
-        memset(buffer2, 0, size2);
-        memcpy(buffer2, buffer, 4);
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Write(8, buffer2, 16);
+/**
+  Reads back the chunks holding pending units and returns the units which
+  don't match the image. All units of a chunk which can't be read count as
+  wrong.
+*/
+uint16_t CardManager::verifyUnits(MFRC522::PICC_Type piccType, byte *image, uint16_t pending)
+{
+    byte unitsPerChunk = (piccType == MFRC522::PICC_TYPE_MIFARE_UL) ? 4 : 1;
+    byte unitSize = 16 / unitsPerChunk;
+    uint16_t wrong = 0;
 
-        memset(buffer2, 0, size2);
-        memcpy(buffer2, buffer + 4, 4);
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Write(9, buffer2, 16);
+    for (byte chunk = 0; chunk < 3; chunk++)
+    {
+        uint16_t chunkUnits = ((1U << unitsPerChunk) - 1) << (chunk * unitsPerChunk);
+        if (!(pending & chunkUnits))
+            continue;
 
-        memset(buffer2, 0, size2);
-        memcpy(buffer2, buffer + 8, 4);
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Write(10, buffer2, 16);
+        byte buffer[18];
+        if (!readChunk(piccType, chunk, buffer))
+            return wrong | (pending & ~((1U << (chunk * unitsPerChunk)) - 1));
 
-        memset(buffer2, 0, size2);
-        memcpy(buffer2, buffer + 12, 4);
-        status = (MFRC522::StatusCode)_mfrc522.MIFARE_Write(11, buffer2, 16);
+        for (byte i = 0; i < unitsPerChunk; i++)
+        {
+            byte unit = chunk * unitsPerChunk + i;
+            if ((pending & (1U << unit)) &&
+                memcmp(buffer + i * unitSize, image + unit * unitSize, unitSize) != 0)
+                wrong |= 1U << unit;
+        }
     }
 
+    return wrong;
+}
+
+/**
+  The card data is organized in chunks of 16 bytes: chunk 0 holds cookie,
+  version and folder settings, chunks 1 and 2 the entries of playlist cards.
+  On MIFARE Classic these are the blocks 4-6 of sector 1, on MIFARE
+  Ultralight / NTAG the pages 8-19 (a single read returns four pages).
+  The buffer has to hold 18 bytes for reading (data + CRC).
+*/
+bool CardManager::readChunk(MFRC522::PICC_Type piccType, byte chunk, byte *buffer)
+{
+    byte size = 18;
+    byte address;
+
+    if (piccType == MFRC522::PICC_TYPE_MIFARE_UL)
+        address = 8 + chunk * 4;
+    else
+        address = 4 + chunk;
+
+    MFRC522::StatusCode status = (MFRC522::StatusCode)_mfrc522.MIFARE_Read(address, buffer, &size);
     if (status != MFRC522::STATUS_OK)
     {
-        Serial.print(F("MIFARE_Write() failed: "));
+        Serial.print(F("MIFARE_Read() failed: "));
         Serial.println(_mfrc522.GetStatusCodeName(status));
-        return CardManagerError::CardManagerWriteFailed;
+        return false;
     }
 
-    return CardManagerError::CardManagerSuccess;
-}
\ No newline at end of file
+    return true;
+}
+
+#ifdef ASYNC_CARD_READ
+// bits of the MFRC522 registers
+#define CARD_IRQ_TX 0x40            // ComIrqReg: frame sent
+#define CARD_IRQ_RX 0x20            // ComIrqReg: frame received
+#define CARD_IRQ_IDLE 0x10          // ComIrqReg: command done
+#define CARD_IRQ_TIMER 0x01         // ComIrqReg: no answer in time
+#define CARD_ERRORS 0x13            // ErrorReg: buffer overflow, parity, protocol
+#define CARD_COLLISION 0x08         // ErrorReg
+#define CARD_CRYPTO1_ON 0x08        // Status2Reg: authenticated
+#define CARD_START_SEND 0x80        // BitFramingReg
+
+#define PICC_CMD_PWD_AUTH 0x1B      // NTAG21x
+
+/**
+  The CRC_A of ISO 14443-3, computed here instead of waiting for the CRC
+  coprocessor of the MFRC522.
+*/
+static uint16_t crcA(const byte *data, byte length)
+{
+    uint16_t crc = 0x6363;
+    for (byte i = 0; i < length; i++)
+    {
+        byte b = data[i] ^ (byte)crc;
+        b ^= b << 4;
+        crc = (crc >> 8) ^ ((uint16_t)b << 8) ^ ((uint16_t)b << 3) ^ (b >> 4);
+    }
+    return crc;
+}
+
+static void appendCrc(byte *data, byte length)
+{
+    uint16_t crc = crcA(data, length);
+    data[length] = crc;
+    data[length + 1] = crc >> 8;
+}
+
+static bool crcValid(const byte *data, byte length)
+{
+    uint16_t crc = crcA(data, length - 2);
+    return data[length - 2] == (byte)crc && data[length - 1] == (byte)(crc >> 8);
+}
+
+/**
+  Reads a card without waiting for it: every call starts a command for the
+  tag or checks whether its answer is there and returns. Without a tag the
+  REQA only runs out after 25 ms, which the loop now spends elsewhere.
+  Returns true once all of the card is read (and the tag is halted).
+
+  The commands are the ones of the library (PICC_RequestA(), PICC_Select(),
+  PCD_Authenticate(), MIFARE_Read(), PICC_HaltA()), but two tags in the
+  field aren't told apart: a collision starts over.
+*/
+bool CardManager::readStep(NfcTagObject &nfcTag)
+{
+    if (_step == ReadStep::Idle)
+    {
+        startRequest();
+        return false;
+    }
+    if (!commandFinished())
+        return false;
+
+    byte buffer[18];
+    byte length = sizeof(buffer);
+    MFRC522::StatusCode status = response(buffer, &length);
+
+    switch (_step)
+    {
+    case ReadStep::Idle:
+        break;
+
+    case ReadStep::Request:
+        // ATQA
+        if (status == MFRC522::STATUS_OK && length == 2)
+        {
+            _cascadeLevel = 0;
+            _mfrc522.uid.size = 0;
+            startAnticollision();
+        }
+        else
+            startRequest();
+        break;
+
+    case ReadStep::Anticollision:
+        // 4 bytes of the UID (or the cascade tag and 3 bytes) and their BCC
+        if (status != MFRC522::STATUS_OK || length != 5 ||
+            (buffer[0] ^ buffer[1] ^ buffer[2] ^ buffer[3]) != buffer[4])
+        {
+            _step = ReadStep::Idle;
+            break;
+        }
+        {
+            byte select[9] = {(byte)(MFRC522::PICC_CMD_SEL_CL1 + 2 * _cascadeLevel), 0x70};
+            memcpy(select + 2, buffer, 5);
+            memcpy(_data, buffer, 4);
+            appendCrc(select, 7);
+            startCommand(MFRC522::PCD_Transceive, select, sizeof(select), 0, CARD_IRQ_RX | CARD_IRQ_IDLE);
+            _step = ReadStep::Select;
+        }
+        break;
+
+    case ReadStep::Select:
+        // SAK, the UID goes on in the next cascade level if bit 2 is set
+        if (status != MFRC522::STATUS_OK || length != 3 || !crcValid(buffer, 3))
+        {
+            _step = ReadStep::Idle;
+            break;
+        }
+        if (buffer[0] & 0x04)
+        {
+            memcpy(_mfrc522.uid.uidByte + _mfrc522.uid.size, _data + 1, 3);
+            _mfrc522.uid.size += 3;
+            if (++_cascadeLevel < 3)
+                startAnticollision();
+            else
+                _step = ReadStep::Idle;
+            break;
+        }
+        memcpy(_mfrc522.uid.uidByte + _mfrc522.uid.size, _data, 4);
+        _mfrc522.uid.size += 4;
+        _mfrc522.uid.sak = buffer[0];
+        if (!selected())
+            startAuthentication();
+        break;
+
+    case ReadStep::Authenticate:
+        if (status != MFRC522::STATUS_OK ||
+            (_piccType != MFRC522::PICC_TYPE_MIFARE_UL &&
+             !(_mfrc522.PCD_ReadRegister(MFRC522::Status2Reg) & CARD_CRYPTO1_ON)))
+        {
+            Serial.print(F("PCD_Authenticate() failed: "));
+            Serial.println(_mfrc522.GetStatusCodeName(status));
+            // not halted, the tag is read again (see readCard())
+            _mfrc522.PCD_StopCrypto1();
+            _step = ReadStep::Idle;
+            break;
+        }
+        Serial.println(F("Reading data from block 4 ..."));
+        startRead(0);
+        break;
+
+    case ReadStep::Read:
+        if (status != MFRC522::STATUS_OK || length != 18 || !crcValid(buffer, 18))
+        {
+            Serial.print(F("MIFARE_Read() failed: "));
+            Serial.println(_mfrc522.GetStatusCodeName(status == MFRC522::STATUS_OK ? MFRC522::STATUS_CRC_WRONG : status));
+            startHalt(false);
+            break;
+        }
+        memcpy(_data + _chunk * 16, buffer, 16);
+        // playlist cards carry their entries in the following two chunks
+        if (_chunk < 2 && _data[6] == PLAYLIST_MODE)
+            startRead(_chunk + 1);
+        else
+            startHalt(true);
+        break;
+
+    case ReadStep::Halt:
+        // HLTA isn't answered, it only has to be sent
+        _mfrc522.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+        _mfrc522.PCD_StopCrypto1();
+        _step = ReadStep::Idle;
+        if (_cardRead)
+            decodeCard(_data, _data + 16, nfcTag);
+        return _cardRead;
+    }
+
+    return false;
+}
+
+/**
+  The UID is complete. Returns true if there's nothing to read from the tag
+  (already halting).
+*/
+bool CardManager::selected(void)
+{
+    // Show some details of the PICC (that is: the tag/card)
+    Serial.print(F("Card UID:"));
+    dump_byte_array(_mfrc522.uid.uidByte, _mfrc522.uid.size);
+    Serial.println();
+
+#ifdef UID_CARD_TABLE
+    // known UIDs are resolved without authenticating or reading the tag,
+    // the chunk is made up from the table
+    FolderSettings folderSettings;
+    if (_uidTable.lookup(_mfrc522.uid, folderSettings))
+    {
+        Serial.println(F("Card found in UID table"));
+        memset(_data, 0, sizeof(_data));
+        _data[0] = (byte)(NFC_TAG_COOKIE >> 24);
+        _data[1] = (byte)(NFC_TAG_COOKIE >> 16);
+        _data[2] = (byte)(NFC_TAG_COOKIE >> 8);
+        _data[3] = (byte)NFC_TAG_COOKIE;
+        _data[4] = 2;
+        _data[5] = folderSettings.folder;
+        _data[6] = folderSettings.mode;
+        _data[7] = folderSettings.special;
+        _data[8] = folderSettings.special2;
+        startHalt(true);
+        return true;
+    }
+#endif
+
+    Serial.print(F("PICC type: "));
+    _piccType = _mfrc522.PICC_GetType(_mfrc522.uid.sak);
+    Serial.println(_mfrc522.PICC_GetTypeName(_piccType));
+
+    if (!handledType(_piccType))
+    {
+        Serial.println(F("Unhandled type"));
+#ifdef UID_CARD_TABLE
+        // reported as new card, see unreadableCard()
+        memset(_data, 0, sizeof(_data));
+        startHalt(true);
+#else
+        startHalt(false);
+#endif
+        return true;
+    }
+    return false;
+}
+
+/**
+  REQA, a short frame of 7 bits. Resets what the library may have changed,
+  like PICC_IsNewCardPresent().
+*/
+void CardManager::startRequest(void)
+{
+    byte command = MFRC522::PICC_CMD_REQA;
+
+    _mfrc522.PCD_WriteRegister(MFRC522::TxModeReg, 0x00);
+    _mfrc522.PCD_WriteRegister(MFRC522::RxModeReg, 0x00);
+    _mfrc522.PCD_WriteRegister(MFRC522::ModWidthReg, 0x26);
+    _mfrc522.PCD_ClearRegisterBitMask(MFRC522::CollReg, 0x80);
+    startCommand(MFRC522::PCD_Transceive, &command, 1, 7, CARD_IRQ_RX | CARD_IRQ_IDLE);
+    _step = ReadStep::Request;
+}
+
+void CardManager::startAnticollision(void)
+{
+    byte command[2] = {(byte)(MFRC522::PICC_CMD_SEL_CL1 + 2 * _cascadeLevel), 0x20};
+    startCommand(MFRC522::PCD_Transceive, command, sizeof(command), 0, CARD_IRQ_RX | CARD_IRQ_IDLE);
+    _step = ReadStep::Anticollision;
+}
+
+/**
+  Authenticates with the default key, see authenticate().
+*/
+void CardManager::startAuthentication(void)
+{
+    if (_piccType == MFRC522::PICC_TYPE_MIFARE_UL)
+    {
+        Serial.println(F("Authenticating MIFARE UL..."));
+        byte command[7] = {PICC_CMD_PWD_AUTH, 0xFF, 0xFF, 0xFF, 0xFF};
+        appendCrc(command, 5);
+        startCommand(MFRC522::PCD_Transceive, command, sizeof(command), 0, CARD_IRQ_RX | CARD_IRQ_IDLE);
+    }
+    else
+    {
+        Serial.println(F("Authenticating Classic using key A..."));
+        // command, trailer block, key and the last 4 bytes of the UID
+        byte command[12] = {MFRC522::PICC_CMD_MF_AUTH_KEY_A, 7, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        memcpy(command + 8, _mfrc522.uid.uidByte + _mfrc522.uid.size - 4, 4);
+        startCommand(MFRC522::PCD_MFAuthent, command, sizeof(command), 0, CARD_IRQ_IDLE);
+    }
+    _step = ReadStep::Authenticate;
+}
+
+void CardManager::startRead(byte chunk)
+{
+    byte command[4] = {MFRC522::PICC_CMD_MF_READ,
+                       (byte)(_piccType == MFRC522::PICC_TYPE_MIFARE_UL ? 8 + chunk * 4 : 4 + chunk)};
+    appendCrc(command, 2);
+    startCommand(MFRC522::PCD_Transceive, command, sizeof(command), 0, CARD_IRQ_RX | CARD_IRQ_IDLE);
+    _chunk = chunk;
+    _step = ReadStep::Read;
+}
+
+/**
+  HLTA, so the tag doesn't answer again while it stays on the reader.
+  cardRead tells whether the card is handed out afterwards.
+*/
+void CardManager::startHalt(bool cardRead)
+{
+    byte command[4] = {MFRC522::PICC_CMD_HLTA, 0};
+    appendCrc(command, 2);
+    startCommand(MFRC522::PCD_Transceive, command, sizeof(command), 0, CARD_IRQ_TX);
+    _cardRead = cardRead;
+    _step = ReadStep::Halt;
+}
+
+/**
+  Starts a command of the MFRC522 like PCD_CommunicateWithPICC() does, but
+  returns right away.
+*/
+void CardManager::startCommand(byte command, byte *data, byte length, byte lastBits, byte waitIrq)
+{
+    _mfrc522.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    _mfrc522.PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    _mfrc522.PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80);
+    _mfrc522.PCD_WriteRegister(MFRC522::FIFODataReg, length, data);
+    _mfrc522.PCD_WriteRegister(MFRC522::BitFramingReg, lastBits);
+    _mfrc522.PCD_WriteRegister(MFRC522::CommandReg, command);
+    if (command == MFRC522::PCD_Transceive)
+        _mfrc522.PCD_SetRegisterBitMask(MFRC522::BitFramingReg, CARD_START_SEND);
+    _waitIrq = waitIrq;
+    _commandStart = millis();
+}
+
+/**
+  Whether the command started last is done or has run out of time, costs
+  a single register read while it isn't.
+*/
+bool CardManager::commandFinished(void)
+{
+    byte irq = _mfrc522.PCD_ReadRegister(MFRC522::ComIrqReg);
+    if (irq & _waitIrq)
+        return true;
+    if ((irq & CARD_IRQ_TIMER) || millis() - _commandStart > CARD_COMMAND_TIMEOUT)
+    {
+        _waitIrq = 0;
+        return true;
+    }
+    return false;
+}
+
+/**
+  Reads the answer of the tag from the FIFO. Answers of less than a byte
+  (a NAK) count as no answer.
+*/
+MFRC522::StatusCode CardManager::response(byte *buffer, byte *length)
+{
+    if (_waitIrq == 0)
+        return MFRC522::STATUS_TIMEOUT;
+
+    byte errors = _mfrc522.PCD_ReadRegister(MFRC522::ErrorReg);
+    if (errors & CARD_ERRORS)
+        return MFRC522::STATUS_ERROR;
+    if (errors & CARD_COLLISION)
+        return MFRC522::STATUS_COLLISION;
+
+    byte received = _mfrc522.PCD_ReadRegister(MFRC522::FIFOLevelReg);
+    if (received > *length)
+        return MFRC522::STATUS_NO_ROOM;
+    _mfrc522.PCD_ReadRegister(MFRC522::FIFODataReg, received, buffer);
+    *length = received;
+    if (received == 1 && (_mfrc522.PCD_ReadRegister(MFRC522::ControlReg) & 0x07) != 0)
+        return MFRC522::STATUS_MIFARE_NACK;
+    return MFRC522::STATUS_OK;
+}
+#endif
@@ -0,0 +1,328 @@
+#include "EepromCache.hpp"
+#include "Watchdog.hpp"
+
+#include <EEPROM.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+EepromCache eepromCache;
+
+// start and size of the regions, in the order of their tags
+static const uint16_t regions[EEPROM_REGIONS][2] PROGMEM = {
+    {EEPROM_PROGRESS_ADDRESS, EEPROM_PROGRESS_SIZE},
+    {EEPROM_SETTINGS_ADDRESS, EEPROM_SETTINGS_SIZE},
+    {EEPROM_WATCHDOG_ADDRESS, EEPROM_WATCHDOG_SIZE},
+    {EEPROM_STATISTICS_ADDRESS, EEPROM_STATISTICS_SIZE},
+    {EEPROM_UID_TABLE_ADDRESS, EEPROM_UID_TABLE_SIZE}};
+
+static uint16_t regionStart(uint8_t region)
+{
+    return pgm_read_word(&regions[region][0]);
+}
+
+static uint16_t regionEnd(uint8_t region)
+{
+    return pgm_read_word(&regions[region][0]) + pgm_read_word(&regions[region][1]);
+}
+
+// the background writes need the EEPROM registers, on the host the cache
+// writes synchronously
+#if defined(EEPROM_CACHE) && defined(__AVR__)
+#define EEPROM_CACHE_BACKGROUND
+
+// runs as long as EERIE is set and no write is in progress
+ISR(EE_READY_vect)
+{
+    eepromCache.writeNext();
+}
+#endif
+
+#define EEPROM_CACHE_ALL_DIRTY ((uint16_t)((1UL << EEPROM_CACHE_SLOTS) - 1))
+
+#ifdef EEPROM_CACHE
+static_assert(EEPROM_CACHE_SLOTS <= 16, "the dirty bitmap has 16 bits");
+
+/**
+  Keeps the interrupt from writing while the slots are used. The interrupt
+  only clears bits of the dirty bitmap, everything else is changed with the
+  interrupt disabled.
+*/
+static inline void lock(void)
+{
+#ifdef EEPROM_CACHE_BACKGROUND
+    EECR &= ~_BV(EERIE);
+#endif
+}
+
+void EepromCache::startWriting(void)
+{
+#ifdef EEPROM_CACHE_BACKGROUND
+    if (_dirty != 0)
+        EECR |= _BV(EERIE);
+#endif
+}
+
+int8_t EepromCache::findSlot(int address)
+{
+    for (uint8_t slot = 0; slot < EEPROM_CACHE_SLOTS; slot++)
+        if ((_dirty & (1U << slot)) && _address[slot] == address)
+            return slot;
+    return -1;
+}
+#endif
+
+/**
+  Reads the epoch and finds the regions written in an older one. Has to be
+  called before anything else reads from EEPROM.
+*/
+void EepromCache::begin(void)
+{
+    _epoch = readByte(EEPROM_EPOCH_ADDRESS);
+    _staleRegions = 0;
+    for (uint8_t region = 0; region < EEPROM_REGIONS; region++)
+    {
+        _clearedTo[region] = regionStart(region);
+        if (readByte(EEPROM_REGION_TAGS_ADDRESS + region) != _epoch)
+            _staleRegions |= 1 << region;
+    }
+}
+
+/**
+  Clears the stale regions while the box is idle, writing at most one byte
+  per call.
+*/
+void EepromCache::loop(void)
+{
+    if (_staleRegions == 0)
+        return;
+
+    uint8_t region = 0;
+    while (!(_staleRegions & (1 << region)))
+        region++;
+
+    uint16_t &address = _clearedTo[region];
+    for (uint8_t i = 0; i < EEPROM_CLEANUP_BYTES; i++)
+    {
+        if (address == regionEnd(region))
+        {
+            tagRegion(region);
+            return;
+        }
+        if (readByte(address) != 0)
+        {
+            writeByte(address++, 0);
+            return;
+        }
+        address++;
+    }
+}
+
+/**
+  Erases all regions by starting a new epoch - a single byte to write.
+*/
+void EepromCache::reset(void)
+{
+    Serial.println(F("=== EepromCache::reset()"));
+    _epoch++;
+    writeByte(EEPROM_EPOCH_ADDRESS, _epoch);
+    flush();
+    _staleRegions = (1 << EEPROM_REGIONS) - 1;
+    for (uint8_t region = 0; region < EEPROM_REGIONS; region++)
+        _clearedTo[region] = regionStart(region);
+}
+
+int8_t EepromCache::staleRegion(int address)
+{
+    if (_staleRegions == 0)
+        return -1;
+    for (uint8_t region = 0; region < EEPROM_REGIONS; region++)
+        if ((_staleRegions & (1 << region)) && address >= regionStart(region) && address < regionEnd(region))
+            return region;
+    return -1;
+}
+
+/**
+  Clears the bytes of a stale region in front of an address about to be
+  written, the cleared part then ends behind it. Bytes which are zero
+  already aren't written, but a write near the end of a region which was in
+  use may still take a while (up to 1.7 s for the UID card table).
+*/
+void EepromCache::clearUpTo(uint8_t region, int address)
+{
+    for (; _clearedTo[region] < address; _clearedTo[region]++)
+    {
+        watchdog.feed(WatchdogActivity::EepromReset);
+        if (readByte(_clearedTo[region]) != 0)
+            writeByte(_clearedTo[region], 0);
+    }
+    _clearedTo[region] = address + 1;
+}
+
+/**
+  Marks a cleared region as part of the current epoch. The zeros have to be
+  in EEPROM before the tag, the slots aren't written in order.
+*/
+void EepromCache::tagRegion(uint8_t region)
+{
+    flush();
+    writeByte(EEPROM_REGION_TAGS_ADDRESS + region, _epoch);
+    _staleRegions &= ~(1 << region);
+}
+
+uint8_t EepromCache::read(int address)
+{
+    int8_t region = staleRegion(address);
+    return (region >= 0 && address >= _clearedTo[region]) ? 0 : readByte(address);
+}
+
+void EepromCache::update(int address, uint8_t value)
+{
+    int8_t region = staleRegion(address);
+    if (region >= 0 && address >= _clearedTo[region])
+        clearUpTo(region, address);
+    writeByte(address, value);
+    if (region >= 0 && _clearedTo[region] == regionEnd(region))
+        tagRegion(region);
+}
+
+/**
+  Returns the pending value if the byte is waiting in a slot. Otherwise it
+  has to wait for a write in progress (at most 3.3 ms) first.
+*/
+uint8_t EepromCache::readByte(int address)
+{
+#ifdef EEPROM_CACHE_BACKGROUND
+    lock();
+    int8_t slot = findSlot(address);
+    uint8_t value = (slot >= 0) ? _value[slot] : EEPROM.read(address);
+    startWriting();
+    return value;
+#else
+    return EEPROM.read(address);
+#endif
+}
+
+/**
+  Puts the byte into a free slot (or the slot already holding the address)
+  and returns. Waits for the interrupt to free a slot if all are taken.
+*/
+void EepromCache::writeByte(int address, uint8_t value)
+{
+#if defined(EEPROM_CACHE_BACKGROUND)
+    for (;;)
+    {
+        lock();
+        int8_t slot = findSlot(address);
+        if (slot < 0)
+        {
+            slot = 0;
+            while (slot < EEPROM_CACHE_SLOTS && (_dirty & (1U << slot)))
+                slot++;
+        }
+        if (slot < EEPROM_CACHE_SLOTS)
+        {
+            _address[slot] = address;
+            _value[slot] = value;
+            _dirty |= 1U << slot;
+            startWriting();
+            return;
+        }
+
+        _waits++;
+        startWriting();
+        while (_dirty == EEPROM_CACHE_ALL_DIRTY)
+            ;
+    }
+#elif defined(EEPROM_CACHE)
+    if (EEPROM.read(address) != value)
+    {
+        EEPROM.write(address, value);
+        _written++;
+    }
+    else
+        _skipped++;
+#else
+    EEPROM.update(address, value);
+#endif
+}
+
+/**
+  Writes the byte of the first dirty slot, skipping bytes which are already
+  in EEPROM. Disables the interrupt when all slots are written.
+*/
+void EepromCache::writeNext(void)
+{
+#ifdef EEPROM_CACHE_BACKGROUND
+    while (_dirty != 0)
+    {
+        uint8_t slot = 0;
+        while (!(_dirty & (1U << slot)))
+            slot++;
+        _dirty &= ~(1U << slot);
+
+        EEAR = _address[slot];
+        EECR |= _BV(EERE);
+        if (EEDR == _value[slot])
+        {
+            _skipped++;
+            continue;
+        }
+        EEDR = _value[slot];
+        // EEPE has to be set within four cycles after EEMPE, no other
+        // interrupt can get in between here
+        EECR |= _BV(EEMPE);
+        EECR |= _BV(EEPE);
+        _written++;
+        return;
+    }
+    EECR &= ~_BV(EERIE);
+#endif
+}
+
+/**
+  Waits until all pending bytes are written, takes up to
+  EEPROM_CACHE_SLOTS * 3.3 ms.
+*/
+void EepromCache::flush(void)
+{
+#ifdef EEPROM_CACHE_BACKGROUND
+    startWriting();
+    while (_dirty != 0)
+        ;
+    while (EECR & _BV(EEPE))
+        ;
+#endif
+}
+
+void EepromCache::print(void)
+{
+    Serial.println(F("=== EEPROM"));
+    Serial.print(F("Epoche: "));
+    Serial.println(_epoch);
+    Serial.print(F("Veraltete Bereiche: 0x"));
+    Serial.println(_staleRegions, HEX);
+
+#ifdef EEPROM_CACHE
+    lock();
+    uint16_t written = _written;
+    uint16_t skipped = _skipped;
+    uint16_t dirty = _dirty;
+    startWriting();
+
+    uint8_t pending = 0;
+    for (uint8_t slot = 0; slot < EEPROM_CACHE_SLOTS; slot++)
+        if (dirty & (1U << slot))
+            pending++;
+
+    Serial.print(F("Geschrieben: "));
+    Serial.println(written);
+    Serial.print(F("Unverändert: "));
+    Serial.println(skipped);
+    Serial.print(F("Ausstehend: "));
+    Serial.println(pending);
+    Serial.print(F("Slots voll: "));
+    Serial.println(_waits);
+#else
+    Serial.println(F("EEPROM Cache nicht aktiviert (-D EEPROM_CACHE)"));
+#endif
+}
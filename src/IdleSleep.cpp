@@ -0,0 +1,65 @@
+#include "IdleSleep.hpp"
+
+#include <avr/sleep.h>
+
+IdleSleep idleSleep;
+
+/**
+  Sleeps until IDLE_LOOP_INTERVAL_US have passed since the start of the
+  previous iteration. Returns right away if the iteration took longer.
+*/
+void IdleSleep::waitForNextLoop(void)
+{
+#ifdef IDLE_SLEEP
+    _loops++;
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    while (micros() - _loopStart < IDLE_LOOP_INTERVAL_US)
+    {
+        unsigned long sleepStart = micros();
+        sleep_enable();
+        sleep_cpu();
+        sleep_disable();
+        _sleepMicros += micros() - sleepStart;
+        _wakeups++;
+    }
+    if (_sleepMicros >= 1000000UL)
+    {
+        _sleepMillis += _sleepMicros / 1000;
+        _sleepMicros %= 1000;
+    }
+    _loopStart = micros();
+#endif
+}
+
+/**
+  Prints loop iterations, wake ups and the share of time spent sleeping
+  since the last call.
+*/
+void IdleSleep::print(void)
+{
+#ifdef IDLE_SLEEP
+    unsigned long elapsed = millis() - _statsStart;
+    uint32_t sleepMillis = _sleepMillis + _sleepMicros / 1000;
+
+    Serial.println(F("=== Idle Sleep"));
+    Serial.print(F("Loops: "));
+    Serial.println(_loops);
+    Serial.print(F("Aufwachen: "));
+    Serial.println(_wakeups);
+    Serial.print(F("Schlaf: "));
+    Serial.print(sleepMillis);
+    Serial.print(F(" von "));
+    Serial.print(elapsed);
+    Serial.print(F(" ms ("));
+    Serial.print(elapsed != 0 ? (uint8_t)(sleepMillis * 100 / elapsed) : 0);
+    Serial.println(F("%)"));
+
+    _statsStart = millis();
+    _loops = 0;
+    _wakeups = 0;
+    _sleepMicros = 0;
+    _sleepMillis = 0;
+#else
+    Serial.println(F("Idle Sleep nicht aktiviert (-D IDLE_SLEEP)"));
+#endif
+}
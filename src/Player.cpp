@@ -1,4 +1,7 @@
 #include "Player.hpp"
+#include "Statistics.hpp"
+#include "Trace.hpp"
+#include "Watchdog.hpp"
 
 void Mp3Notify::OnError(uint16_t errorCode)
 {
@@ -6,6 +9,12 @@ void Mp3Notify::OnError(uint16_t errorCode)
     Serial.println();
     Serial.print("Com Error ");
     Serial.println(errorCode);
+    trace.playerError(errorCode);
+    statistics.countPlayerError(errorCode);
+    if (_onErrorHandler)
+    {
+        _onErrorHandler(errorCode);
+    }
 }
 
 void Mp3Notify::PrintlnSourceAction(DfMp3_PlaySources source, const char *action)
@@ -24,6 +33,11 @@ void Mp3Notify::OnPlayFinished(DfMp3_PlaySources source, uint16_t track)
     //      Serial.print("Track beendet");
     //      Serial.println(track);
     //      delay(100);
+    trace.playFinished(track);
+    // prompts of a sequence don't end tracks
+    if (player.promptFinished())
+        return;
+    player.trackFinished();
     if (_onPlayFinishedHandler)
     {
         _onPlayFinishedHandler(track);
@@ -46,29 +60,389 @@ void Mp3Notify::OnPlaySourceRemoved(DfMp3_PlaySources source)
 }
 
 void (*Mp3Notify::_onPlayFinishedHandler)(uint16_t);
+void (*Mp3Notify::_onErrorHandler)(uint16_t);
+
+void Player::loop(void)
+{
+    _player.loop();
+    // the finish handlers run within _player.loop(), a play command after
+    // that isn't a transition anymore
+    _transitionPending = false;
+
+    if (_retryAt != 0 && (long)(millis() - _retryAt) >= 0)
+    {
+        _retryAt = 0;
+        Serial.print(F("DFPlayer Wiederholung "));
+        Serial.println(_retries);
+        sendLastCommand();
+    }
+
+    if ((_promptState == PromptState::Playing || _promptState == PromptState::Cancelled)
+        && millis() - _promptTime > PLAYER_PROMPT_IDLE_TIME && !isPlaying())
+    {
+        if (_promptState == PromptState::Playing)
+            playNextPrompt();
+        else
+            endPrompts();
+    }
+}
+
+bool Player::isPlaying(void)
+{
+    bool playing = !digitalRead(_busyPin);
+    trace.busy(playing);
+    return playing;
+}
 
 bool Player::waitForTrackToFinish(void)
 {
     unsigned long start = millis();
     do
     {
-        _player.loop();
+        watchdog.feed(WatchdogActivity::WaitForTrack);
+        loop();
         if ((millis() - start) > 1000u)
             return false;
     } while (!isPlaying());
 
-    delay(1000);
+    watchdog.delay(1000);
 
+    start = millis();
     do
     {
-        _player.loop();
+        watchdog.feed(WatchdogActivity::WaitForTrack);
+        loop();
+        if ((millis() - start) > PLAYER_TRACK_TIMEOUT)
+            return false;
     } while (isPlaying());
 
     return true;
 }
 
+/**
+  Plays a prompt and waits until it is finished.
+*/
 void Player::say(uint16_t track)
 {
-    _player.playMp3FolderTrack(track);
-    waitForTrackToFinish();
+    cancelPrompts();
+    queuePrompt(track);
+    waitForPrompts();
+}
+
+/**
+  Adds a prompt (from the mp3 folder) to the sequence. The prompts of a
+  sequence play back to back: the next one starts on the finish
+  notification of the one before, without waiting for the busy pin. loop()
+  has to be called meanwhile.
+*/
+void Player::queuePrompt(uint16_t track)
+{
+    queue(0, track);
+}
+
+/**
+  Adds a track of a folder to the sequence, e.g. a preview after its number.
+*/
+void Player::queueFolderTrack(uint8_t folder, uint8_t track)
+{
+    queue(folder, track);
+}
+
+void Player::queue(uint8_t folder, uint16_t track)
+{
+    if (_promptCount == PLAYER_PROMPT_QUEUE)
+    {
+        Serial.println(F("Ansage verworfen"));
+        return;
+    }
+    uint8_t index = (_firstPrompt + _promptCount) % PLAYER_PROMPT_QUEUE;
+    _promptFolders[index] = folder;
+    _promptTracks[index] = track;
+    _promptCount++;
+    if (_promptState != PromptState::Playing)
+        playNextPrompt();
+}
+
+/**
+  Ends the sequence, the prompt playing right now isn't interrupted. Its
+  finish notification still belongs to the sequence.
+*/
+void Player::cancelPrompts(void)
+{
+    _promptCount = 0;
+    if (_promptState == PromptState::Playing)
+        _promptState = PromptState::Cancelled;
+}
+
+/**
+  Waits until the sequence is finished. Returns false if it didn't finish
+  within PLAYER_TRACK_TIMEOUT.
+*/
+bool Player::waitForPrompts(void)
+{
+    unsigned long start = millis();
+    while (_promptState == PromptState::Playing)
+    {
+        watchdog.feed(WatchdogActivity::WaitForTrack);
+        loop();
+        if (millis() - start > PLAYER_TRACK_TIMEOUT)
+        {
+            cancelPrompts();
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+  Called on finish notifications, starts the next prompt of the sequence.
+  Returns true if the notification belonged to the sequence: also for the
+  end of a cancelled prompt and for duplicates of the last notification.
+*/
+bool Player::promptFinished(void)
+{
+    if (_promptState == PromptState::Idle)
+        return false;
+
+    bool duplicate = millis() - _promptTime < PLAYER_PROMPT_MIN_TIME;
+    if (_promptState == PromptState::Playing)
+    {
+        if (!duplicate)
+            playNextPrompt();
+        return true;
+    }
+    if (_promptState == PromptState::Cancelled)
+    {
+        if (!duplicate)
+            endPrompts();
+        return true;
+    }
+    if (duplicate)
+        return true;
+    _promptState = PromptState::Idle;
+    return false;
+}
+
+void Player::playNextPrompt(void)
+{
+    if (_promptCount == 0)
+    {
+        endPrompts();
+        return;
+    }
+    uint8_t folder = _promptFolders[_firstPrompt];
+    uint16_t track = _promptTracks[_firstPrompt];
+    _firstPrompt = (_firstPrompt + 1) % PLAYER_PROMPT_QUEUE;
+    _promptCount--;
+
+    _promptState = PromptState::Playing;
+    _promptTime = millis();
+    _retries = 0;
+    if (folder == 0)
+        send(Command::PlayMp3FolderTrack, 0, track);
+    else
+        send(Command::PlayFolderTrack, folder, track);
+}
+
+/**
+  The last prompt has finished: its duplicate notification may still follow.
+*/
+void Player::endPrompts(void)
+{
+    _promptState = PromptState::Ended;
+    _promptTime = millis();
+}
+
+/**
+  A file played outside the sequence replaces its prompt. The DFPlayer
+  doesn't report the end of a file it stops for a new one, so the next
+  finish notification belongs to the new file.
+*/
+void Player::replacePrompts(void)
+{
+    _promptCount = 0;
+    if (_promptState == PromptState::Playing || _promptState == PromptState::Cancelled)
+        _promptState = PromptState::Idle;
+}
+
+void Player::playFolderTrack(uint8_t folder, uint8_t track)
+{
+    replacePrompts();
+    _retries = 0;
+    send(Command::PlayFolderTrack, folder, track);
+}
+
+void Player::playMp3FolderTrack(uint16_t track)
+{
+    replacePrompts();
+    _retries = 0;
+    send(Command::PlayMp3FolderTrack, 0, track);
+}
+
+void Player::playAdvertisement(uint16_t track)
+{
+    _retries = 0;
+    send(Command::PlayAdvertisement, 0, track);
+}
+
+/**
+  Remembers the command, so it can be sent again if the DFPlayer reports a
+  link error, and sends it.
+*/
+void Player::send(Command command, uint8_t folder, uint16_t track)
+{
+    _lastCommand = command;
+    _lastFolder = folder;
+    _lastTrack = track;
+    _retryAt = 0;
+    sendLastCommand();
+
+    if (_transitionPending)
+    {
+        _transitionPending = false;
+        _lastTransitionMicros = micros() - _finishedAt;
+        _transitionMicros += _lastTransitionMicros;
+        _maxTransitionMicros = max(_maxTransitionMicros, _lastTransitionMicros);
+        _transitions++;
+    }
+}
+
+/**
+  Asks the DFPlayer for the number of tracks in a folder. Errors from now on
+  belong to the query, not to the play command sent before it.
+*/
+uint16_t Player::getFolderTrackCount(uint8_t folder)
+{
+    _lastCommand = Command::None;
+    _retryAt = 0;
+    return _player.getFolderTrackCount(folder);
+}
+
+void Player::sendLastCommand(void)
+{
+    _lastCommandTime = millis();
+    _errorHistory <<= 1;
+    if (_historyLength < 32)
+        _historyLength++;
+
+    switch (_lastCommand)
+    {
+    case Command::PlayFolderTrack:
+        _player.playFolderTrack(_lastFolder, _lastTrack);
+        break;
+    case Command::PlayMp3FolderTrack:
+        _player.playMp3FolderTrack(_lastTrack);
+        break;
+    case Command::PlayAdvertisement:
+        _player.playAdvertisement(_lastTrack);
+        break;
+    case Command::None:
+        break;
+    }
+}
+
+/**
+  Counts the error and schedules a retry of the last command with
+  exponential backoff, if it failed because of a link error.
+*/
+void Player::handleError(uint16_t errorCode)
+{
+    uint8_t index = errorIndex(errorCode);
+    if (_errorCounts[index] != 0xFFFF)
+        _errorCounts[index]++;
+
+    if (_lastCommand == Command::None || millis() - _lastCommandTime > PLAYER_RETRY_WINDOW)
+        return;
+
+    _errorHistory |= 1;
+    if (isLinkError(errorCode) && _retryAt == 0 && _retries < PLAYER_MAX_RETRIES)
+    {
+        _retryAt = millis() + ((unsigned long)PLAYER_RETRY_BACKOFF << _retries);
+        if (_retryAt == 0)
+            _retryAt = 1;
+        _retries++;
+    }
+}
+
+/**
+  The DFPlayer got a corrupted packet, so the command was lost. Timeouts and
+  corrupted packets from the DFPlayer (0x81 - 0x84) only concern answers to
+  queries, play commands aren't answered - sending them again would restart
+  a track which is already playing.
+*/
+bool Player::isLinkError(uint16_t errorCode)
+{
+    return errorCode == DfMp3_Error_SerialWrongStack
+        || errorCode == DfMp3_Error_CheckSumNotMatch;
+}
+
+/**
+  Maps the DFPlayer error codes (see DfMp3_Error) to 0 - 11: 1 - 7 are
+  reported by the module, 0x81 - 0x84 are communication errors detected by
+  the library, everything else is counted as general error.
+*/
+uint8_t Player::errorIndex(uint16_t errorCode)
+{
+    if (errorCode >= 1 && errorCode <= 7)
+        return errorCode - 1;
+    if (errorCode >= 0x81 && errorCode <= 0x84)
+        return errorCode - 0x81 + 7;
+    return 11;
+}
+
+/**
+  Percentage of the last (up to) 32 commands which failed.
+*/
+uint8_t Player::errorRate(void)
+{
+    if (_historyLength == 0)
+        return 0;
+
+    uint8_t failed = 0;
+    for (uint32_t history = _errorHistory; history != 0; history &= history - 1)
+        failed++;
+    return failed * 100 / _historyLength;
+}
+
+void Player::printErrors(void)
+{
+    Serial.println(F("=== DFPlayer Fehler"));
+    Serial.print(F("Fehler 1-7, 0x81-0x84, sonstige:"));
+    for (uint8_t i = 0; i < PLAYER_ERROR_CODES; i++)
+    {
+        Serial.print(' ');
+        Serial.print(_errorCounts[i]);
+    }
+    Serial.println();
+    Serial.print(F("Fehlerrate: "));
+    Serial.print(errorRate());
+    Serial.print(F("% der letzten "));
+    Serial.print(_historyLength);
+    Serial.println(F(" Befehle"));
+}
+
+/**
+  Called for each finish notification of the DFPlayer: if the handler
+  starts the next track, the time until the command is sent is recorded.
+*/
+void Player::trackFinished(void)
+{
+    _finishedAt = micros();
+    _transitionPending = true;
+}
+
+void Player::printTransitions(void)
+{
+    Serial.println(F("=== Übergänge zwischen Tracks"));
+    Serial.print(F("Anzahl: "));
+    Serial.println(_transitions);
+    if (_transitions == 0)
+        return;
+    Serial.print(F("Letzter: "));
+    Serial.print(_lastTransitionMicros);
+    Serial.print(F(" us, Mittel: "));
+    Serial.print(_transitionMicros / _transitions);
+    Serial.print(F(" us, Maximum: "));
+    Serial.print(_maxTransitionMicros);
+    Serial.println(F(" us"));
 }
@@ -0,0 +1,23 @@
+#include "SdManifest.hpp"
+
+#ifdef SD_MANIFEST
+#include "SdManifestData.hpp"
+#endif
+
+uint16_t sdManifestTrackCount(uint8_t folder)
+{
+#ifdef SD_MANIFEST
+    if (folder >= 1 && folder <= 99)
+        return pgm_read_byte(&sdManifestTrackCounts[folder - 1]);
+#endif
+    return 0;
+}
+
+uint16_t sdManifestTrackDuration(uint8_t folder, uint16_t track)
+{
+#ifdef SD_MANIFEST_DURATIONS
+    if (track >= 1 && track <= sdManifestTrackCount(folder))
+        return pgm_read_word(&sdManifestDurations[pgm_read_word(&sdManifestFirstTrack[folder - 1]) + track - 1]);
+#endif
+    return 0;
+}
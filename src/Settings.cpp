@@ -1,15 +1,18 @@
 #include "Settings.hpp"
+#include "EepromCache.hpp"
+#include "EepromLayout.hpp"
 
 #include <Arduino.h>
 
-#include <EEPROM.h>
-
 AdminSettings mySettings;
 
+static_assert(sizeof(AdminSettings) <= EEPROM_SETTINGS_SIZE,
+              "settings don't fit into their EEPROM region");
+
 void writeSettingsToFlash(FolderSettings * myFolder) {
   Serial.println(F("=== writeSettingsToFlash()"));
-  int address = sizeof(myFolder->folder) * 100;
-  EEPROM.put(address, mySettings);
+  int address = EEPROM_SETTINGS_ADDRESS;
+  eepromCache.put(address, mySettings);
 }
 
 void resetSettings(uint32_t cardCookie, FolderSettings * myFolder) {
@@ -52,8 +55,8 @@ void migrateSettings(int oldVersion, FolderSettings * myFolder) {
 
 void loadSettingsFromFlash(uint32_t cardCookie, FolderSettings * myFolder) {
   Serial.println(F("=== loadSettingsFromFlash()"));
-  int address = sizeof(myFolder->folder) * 100;
-  EEPROM.get(address, mySettings);
+  int address = EEPROM_SETTINGS_ADDRESS;
+  eepromCache.get(address, mySettings);
   if (mySettings.cookie != cardCookie)
     resetSettings(cardCookie, myFolder);
   migrateSettings(mySettings.version, myFolder);
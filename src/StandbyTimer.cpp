@@ -1,26 +1,14 @@
 #include "StandbyTimer.hpp"
+#include "Statistics.hpp"
+#include "EepromCache.hpp"
+#include "Watchdog.hpp"
 
 #include <avr/sleep.h>
 
 void StandbyTimer::loop(void)
 {
     if (_standbyTime && ((millis() - _startTime) > _standbyTime))
-    {
-        Serial.println(F("=== power off!"));
-        // enter sleep state
-        digitalWrite(_shutdownPin, HIGH);
-        delay(500);
-
-        // http://discourse.voss.earth/t/intenso-s10000-powerbank-automatische-abschaltung-software-only/805
-        // powerdown to 27mA (powerbank switches off after 30-60s)
-        _rfid.PCD_AntennaOff();
-        _rfid.PCD_SoftPowerDown();
-        _player.sleep();
-
-        set_sleep_mode(SLEEP_MODE_PWR_DOWN);
-        cli(); // Disable interrupts
-        sleep_mode();
-    }
+        powerOff();
 }
 
 void StandbyTimer::start(unsigned long standbyMillis)
@@ -30,6 +18,9 @@ void StandbyTimer::start(unsigned long standbyMillis)
 
     if (standbyMillis != 0)
     {
+        // the box may be switched off while waiting for standby
+        statistics.flush();
+        eepromCache.flush();
         _startTime = millis();
         _standbyTime = standbyMillis;
     }
@@ -44,3 +35,29 @@ void StandbyTimer::stop(void)
     Serial.println(F("=== disablestandby()"));
     _standbyTime = 0;
 }
+
+/**
+  Saves everything and switches the box off (or lets the powerbank switch
+  off), doesn't return.
+*/
+void StandbyTimer::powerOff(void)
+{
+    Serial.println(F("=== power off!"));
+    statistics.count(STATISTICS_STANDBY);
+    statistics.flush();
+    eepromCache.flush();
+    // enter sleep state
+    digitalWrite(_shutdownPin, HIGH);
+    watchdog.delay(500);
+
+    // http://discourse.voss.earth/t/intenso-s10000-powerbank-automatische-abschaltung-software-only/805
+    // powerdown to 27mA (powerbank switches off after 30-60s)
+    _rfid.PCD_AntennaOff();
+    _rfid.PCD_SoftPowerDown();
+    _player.sleep();
+    watchdog.disable();
+
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    cli(); // Disable interrupts
+    sleep_mode();
+}
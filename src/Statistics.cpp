@@ -0,0 +1,157 @@
+#include "Statistics.hpp"
+#include "Player.hpp"
+#include "EepromCache.hpp"
+#include "Watchdog.hpp"
+
+Statistics statistics;
+
+#ifdef USAGE_STATISTICS
+static_assert(1 + STATISTICS_COUNTERS * sizeof(uint16_t) <= EEPROM_STATISTICS_SIZE,
+              "statistics don't fit into their EEPROM region");
+#endif
+
+/**
+  Starts with empty counters if the region holds no (or outdated) statistics,
+  e.g. after the EEPROM has been erased or cleared by the reset at startup.
+*/
+void Statistics::begin(void)
+{
+#ifdef USAGE_STATISTICS
+    _pendingCount = 0;
+    _lastFlush = millis();
+    if (eepromCache.read(EEPROM_STATISTICS_ADDRESS) != STATISTICS_VERSION)
+        clear();
+    count(STATISTICS_BOOTS);
+#endif
+}
+
+void Statistics::loop(void)
+{
+#ifdef USAGE_STATISTICS
+    if (millis() - _lastFlush > STATISTICS_FLUSH_INTERVAL)
+        flush();
+#endif
+}
+
+void Statistics::count(uint8_t counter)
+{
+#ifdef USAGE_STATISTICS
+    if (counter >= STATISTICS_COUNTERS)
+        return;
+
+    for (uint8_t i = 0; i < _pendingCount; i++)
+    {
+        if (_pending[i].counter == counter)
+        {
+            if (++_pending[i].delta == 0xFF)
+                flush();
+            return;
+        }
+    }
+
+    if (_pendingCount == STATISTICS_PENDING_SLOTS)
+        flush();
+    _pending[_pendingCount].counter = counter;
+    _pending[_pendingCount].delta = 1;
+    _pendingCount++;
+#endif
+}
+
+void Statistics::countFolderPlay(uint8_t folder)
+{
+    if (folder >= 1 && folder <= 99)
+        count(STATISTICS_FOLDER_PLAYS + folder - 1);
+}
+
+void Statistics::countModifier(uint8_t modifier)
+{
+    if (modifier >= 1 && modifier <= 6)
+        count(STATISTICS_MODIFIERS + modifier - 1);
+}
+
+void Statistics::countPlayerError(uint16_t errorCode)
+{
+    count(STATISTICS_PLAYER_ERRORS + Player::errorIndex(errorCode));
+}
+
+uint16_t Statistics::read(uint8_t counter)
+{
+    uint16_t value;
+    eepromCache.get(counterAddress(counter), value);
+    return value;
+}
+
+/**
+  Adds the pending increments to the counters in EEPROM (saturating at
+  0xFFFF).
+*/
+void Statistics::flush(void)
+{
+#ifdef USAGE_STATISTICS
+    for (uint8_t i = 0; i < _pendingCount; i++)
+    {
+        uint16_t value = read(_pending[i].counter);
+        value = (value > 0xFFFF - _pending[i].delta) ? 0xFFFF : value + _pending[i].delta;
+        eepromCache.put(counterAddress(_pending[i].counter), value);
+    }
+    _pendingCount = 0;
+    _lastFlush = millis();
+#endif
+}
+
+void Statistics::print(void)
+{
+#ifdef USAGE_STATISTICS
+    flush();
+    Serial.println(F("=== Statistik"));
+    for (uint8_t folder = 1; folder <= 99; folder++)
+    {
+        uint16_t plays = read(STATISTICS_FOLDER_PLAYS + folder - 1);
+        if (plays == 0)
+            continue;
+        Serial.print(F("Ordner "));
+        Serial.print(folder);
+        Serial.print(F(": "));
+        Serial.println(plays);
+    }
+    Serial.print(F("Karten: "));
+    Serial.println(read(STATISTICS_CARD_TAPS));
+    Serial.print(F("Neue Karten: "));
+    Serial.println(read(STATISTICS_NEW_CARDS));
+    Serial.print(F("Modifier 1-6:"));
+    for (uint8_t i = 0; i < 6; i++)
+    {
+        Serial.print(' ');
+        Serial.print(read(STATISTICS_MODIFIERS + i));
+    }
+    Serial.println();
+    Serial.print(F("DFPlayer Fehler 1-7, 0x81-0x84, sonstige:"));
+    for (uint8_t i = 0; i < PLAYER_ERROR_CODES; i++)
+    {
+        Serial.print(' ');
+        Serial.print(read(STATISTICS_PLAYER_ERRORS + i));
+    }
+    Serial.println();
+    Serial.print(F("Standby: "));
+    Serial.println(read(STATISTICS_STANDBY));
+    Serial.print(F("Starts: "));
+    Serial.println(read(STATISTICS_BOOTS));
+#else
+    Serial.println(F("Statistik nicht aktiviert (-D USAGE_STATISTICS)"));
+#endif
+}
+
+void Statistics::clear(void)
+{
+#ifdef USAGE_STATISTICS
+    Serial.println(F("=== Statistics::clear()"));
+    _pendingCount = 0;
+    // up to 0.8 s of EEPROM writes on a fresh board
+    for (uint8_t counter = 0; counter < STATISTICS_COUNTERS; counter++)
+    {
+        watchdog.feed(WatchdogActivity::EepromReset);
+        eepromCache.put(counterAddress(counter), (uint16_t)0);
+    }
+    eepromCache.update(EEPROM_STATISTICS_ADDRESS, STATISTICS_VERSION);
+#endif
+}
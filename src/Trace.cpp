@@ -0,0 +1,285 @@
+#include "Trace.hpp"
+#include "Settings.hpp"
+
+Trace trace;
+
+#ifdef EVENT_TRACE
+static const char traceLetters[] = "SBCLFEPQ";
+
+static void printHex(uint8_t value)
+{
+    if (value < 0x10)
+        Serial.print('0');
+    Serial.print(value, HEX);
+}
+#endif
+
+void Trace::begin(uint32_t randomSeed)
+{
+#ifdef EVENT_TRACE
+    uint8_t payload[4] = {(uint8_t)(randomSeed >> 24), (uint8_t)(randomSeed >> 16),
+                          (uint8_t)(randomSeed >> 8), (uint8_t)randomSeed};
+    record(TraceType::Boot, payload, sizeof(payload));
+#endif
+}
+
+/**
+  Records an edge for each button whose bit in `pressed` changed since the
+  last call (bit 0 = pause, 1 = up, 2 = down, 3 and 4 = buttons four and
+  five).
+*/
+void Trace::buttons(uint8_t pressed)
+{
+#ifdef EVENT_TRACE
+    uint8_t changed = pressed ^ _buttons;
+    _buttons = pressed;
+    for (uint8_t button = 0; changed != 0; button++, changed >>= 1)
+    {
+        if (changed & 1)
+        {
+            uint8_t payload = button | (bitRead(pressed, button) ? 0x80 : 0);
+            record(TraceType::Button, &payload, 1);
+        }
+    }
+#endif
+}
+
+void Trace::card(const MFRC522::Uid &uid, const NfcTagObject &nfcTag)
+{
+#ifdef EVENT_TRACE
+    uint8_t payload[1 + 10 + 9];
+    uint8_t length = 0;
+    uint8_t uidSize = min(uid.size, (byte)10);
+
+    payload[length++] = uidSize;
+    memcpy(payload + length, uid.uidByte, uidSize);
+    length += uidSize;
+    for (int8_t shift = 24; shift >= 0; shift -= 8)
+        payload[length++] = nfcTag.cookie >> shift;
+    payload[length++] = nfcTag.version;
+    memcpy(payload + length, &nfcTag.nfcFolderSettings, sizeof(nfcTag.nfcFolderSettings));
+    length += sizeof(nfcTag.nfcFolderSettings);
+    record(TraceType::Card, payload, length);
+
+    if (nfcTag.nfcFolderSettings.mode == PLAYLIST_MODE)
+    {
+        uint8_t entries = min(nfcTag.nfcFolderSettings.special, (uint8_t)PLAYLIST_MAX_ENTRIES);
+        record(TraceType::Playlist, (const uint8_t *)nfcTag.playlist, entries * sizeof(PlaylistEntry));
+    }
+#endif
+}
+
+/**
+  A card placed while waiting for a card to write, it hasn't been read.
+*/
+void Trace::cardPlaced(void)
+{
+#ifdef EVENT_TRACE
+    uint8_t uidSize = 0;
+    record(TraceType::Card, &uidSize, 1);
+#endif
+}
+
+void Trace::playFinished(uint16_t track)
+{
+#ifdef EVENT_TRACE
+    recordWord(TraceType::PlayFinished, track);
+#endif
+}
+
+void Trace::playerError(uint16_t errorCode)
+{
+#ifdef EVENT_TRACE
+    recordWord(TraceType::PlayerError, errorCode);
+#endif
+}
+
+/**
+  Records changes of the busy pin, as seen by Player::isPlaying().
+*/
+void Trace::busy(bool playing)
+{
+#ifdef EVENT_TRACE
+    if (playing == _playing)
+        return;
+    _playing = playing;
+    uint8_t payload = playing;
+    record(TraceType::Busy, &payload, 1);
+#endif
+}
+
+void Trace::trackCount(uint16_t count)
+{
+#ifdef EVENT_TRACE
+    recordWord(TraceType::TrackCount, count);
+#endif
+}
+
+/**
+  Dumps the trace, one record per line: `T <millis> <letter> <values>`. The
+  line `T X` holds the current admin settings, `T D` the number of records
+  which didn't fit into the buffer anymore.
+*/
+void Trace::print(void)
+{
+#ifdef EVENT_TRACE
+    Serial.println(F("=== Trace"));
+    Serial.print(F("T X "));
+    for (uint8_t i = 0; i < sizeof(mySettings); i++)
+        printHex(((const uint8_t *)&mySettings)[i]);
+    Serial.println();
+    if (_dropped != 0)
+    {
+        Serial.print(F("T D "));
+        Serial.println(_dropped);
+    }
+
+    unsigned long time = _firstTime;
+    for (uint16_t offset = 0; offset < _used;)
+    {
+        uint16_t recordStart = offset;
+        uint8_t header = at(offset++);
+        uint8_t type = header >> 5;
+        uint8_t length = header & 0x1F;
+        unsigned long delta;
+        readDelta(offset, delta);
+        // the delta of the oldest record refers to an already dropped one
+        if (recordStart != 0)
+            time += delta;
+
+        Serial.print(F("T "));
+        Serial.print(time);
+        Serial.print(' ');
+        Serial.print(traceLetters[type]);
+
+        uint16_t word = length == 2 ? (uint16_t)at(offset) << 8 | at(offset + 1) : 0;
+        switch ((TraceType)type)
+        {
+        case TraceType::Boot:
+            Serial.print(' ');
+            Serial.print((uint32_t)at(offset) << 24 | (uint32_t)at(offset + 1) << 16 |
+                         (uint32_t)at(offset + 2) << 8 | at(offset + 3));
+            break;
+        case TraceType::Button:
+            Serial.print(' ');
+            Serial.print(at(offset) & 0x7F);
+            Serial.print(at(offset) & 0x80 ? F(" 1") : F(" 0"));
+            break;
+        case TraceType::Card:
+            if (at(offset) != 0)
+            {
+                Serial.print(' ');
+                for (uint8_t i = 0; i < at(offset); i++)
+                    printHex(at(offset + 1 + i));
+                Serial.print(' ');
+                for (uint8_t i = 1 + at(offset); i < length; i++)
+                    printHex(at(offset + i));
+            }
+            break;
+        case TraceType::Playlist:
+            Serial.print(' ');
+            for (uint8_t i = 0; i < length; i++)
+                printHex(at(offset + i));
+            break;
+        case TraceType::Busy:
+            Serial.print(at(offset) ? F(" 1") : F(" 0"));
+            break;
+        default:
+            Serial.print(' ');
+            Serial.print(word);
+            break;
+        }
+        Serial.println();
+        offset += length;
+    }
+    Serial.println(F("=== Ende"));
+#else
+    Serial.println(F("Trace nicht aktiviert (-D EVENT_TRACE)"));
+#endif
+}
+
+#ifdef EVENT_TRACE
+void Trace::recordWord(TraceType type, uint16_t value)
+{
+    uint8_t payload[2] = {(uint8_t)(value >> 8), (uint8_t)value};
+    record(type, payload, sizeof(payload));
+}
+
+/**
+  Appends a record, dropping the oldest ones until it fits.
+*/
+void Trace::record(TraceType type, const uint8_t *payload, uint8_t length)
+{
+    unsigned long now = millis();
+    unsigned long delta = now - _lastTime;
+    uint8_t deltaSize = 1;
+    for (unsigned long rest = delta >> 7; rest != 0; rest >>= 7)
+        deltaSize++;
+
+    while (TRACE_BUFFER_SIZE - _used < 1 + deltaSize + length)
+        dropOldest();
+    if (_used == 0)
+        _firstTime = now;
+    _lastTime = now;
+
+    put((uint8_t)type << 5 | length);
+    do
+    {
+        put((delta & 0x7F) | (delta > 0x7F ? 0x80 : 0));
+        delta >>= 7;
+    } while (delta != 0);
+    for (uint8_t i = 0; i < length; i++)
+        put(payload[i]);
+}
+
+void Trace::put(uint8_t value)
+{
+    _buffer[(_start + _used) % TRACE_BUFFER_SIZE] = value;
+    _used++;
+}
+
+/**
+  Reads the time delta (7 bits per byte, least significant first) at
+  `offset` and moves `offset` behind it.
+*/
+void Trace::readDelta(uint16_t &offset, unsigned long &delta)
+{
+    uint8_t shift = 0;
+    uint8_t value;
+    delta = 0;
+    do
+    {
+        value = at(offset++);
+        delta |= (unsigned long)(value & 0x7F) << shift;
+        shift += 7;
+    } while (value & 0x80);
+}
+
+uint16_t Trace::recordSize(uint16_t offset)
+{
+    unsigned long delta;
+    uint8_t length = at(offset) & 0x1F;
+    uint16_t payload = offset + 1;
+    readDelta(payload, delta);
+    return payload + length - offset;
+}
+
+/**
+  The time of the oldest record is kept in _firstTime, so the delta of the
+  new oldest record is added to it.
+*/
+void Trace::dropOldest(void)
+{
+    uint16_t size = recordSize(0);
+    _start = (_start + size) % TRACE_BUFFER_SIZE;
+    _used -= size;
+    _dropped++;
+    if (_used != 0)
+    {
+        unsigned long delta;
+        uint16_t offset = 1;
+        readDelta(offset, delta);
+        _firstTime += delta;
+    }
+}
+#endif
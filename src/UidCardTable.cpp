@@ -0,0 +1,64 @@
+#include "UidCardTable.hpp"
+#include "EepromCache.hpp"
+
+/**
+  FNV-1a over the UID bytes. The values used to mark empty slots are never
+  returned.
+*/
+uint32_t UidCardTable::hash(const MFRC522::Uid &uid)
+{
+    uint32_t h = 2166136261UL;
+    for (byte i = 0; i < uid.size; i++)
+    {
+        h ^= uid.uidByte[i];
+        h *= 16777619UL;
+    }
+    if (isEmpty(h))
+        h = 1;
+    return h;
+}
+
+bool UidCardTable::lookup(const MFRC522::Uid &uid, FolderSettings &folderSettings)
+{
+    uint32_t key = hash(uid);
+    uint8_t slot = key % EEPROM_UID_TABLE_SLOTS;
+
+    for (uint8_t probe = 0; probe < EEPROM_UID_TABLE_SLOTS; probe++)
+    {
+        uint32_t slotKey;
+        eepromCache.get(slotAddress(slot), slotKey);
+        if (isEmpty(slotKey))
+            return false;
+        if (slotKey == key)
+        {
+            eepromCache.get(slotAddress(slot) + sizeof(slotKey), folderSettings);
+            return true;
+        }
+        slot = (slot + 1) % EEPROM_UID_TABLE_SLOTS;
+    }
+    return false;
+}
+
+bool UidCardTable::store(const MFRC522::Uid &uid, const FolderSettings &folderSettings)
+{
+    uint32_t key = hash(uid);
+    uint8_t slot = key % EEPROM_UID_TABLE_SLOTS;
+
+    for (uint8_t probe = 0; probe < EEPROM_UID_TABLE_SLOTS; probe++)
+    {
+        uint32_t slotKey;
+        eepromCache.get(slotAddress(slot), slotKey);
+        if (isEmpty(slotKey) || slotKey == key)
+        {
+            UidCardTableEntry entry;
+            entry.key = key;
+            entry.folderSettings = folderSettings;
+            eepromCache.put(slotAddress(slot), entry);
+            return true;
+        }
+        slot = (slot + 1) % EEPROM_UID_TABLE_SLOTS;
+    }
+
+    Serial.println(F("UID table full"));
+    return false;
+}
@@ -0,0 +1,110 @@
+#include "Watchdog.hpp"
+#include "EepromCache.hpp"
+
+#include <avr/wdt.h>
+
+Watchdog watchdog;
+
+#ifdef WATCHDOG
+// both survive the reset, as the .noinit section isn't cleared at startup
+static uint8_t resetFlags __attribute__((section(".noinit")));
+static uint8_t lastActivity __attribute__((section(".noinit")));
+
+/**
+  Runs before main(): saves the reset cause and disables the watchdog, which
+  stays enabled (with the shortest timeout) after a watchdog reset. Optiboot
+  clears MCUSR itself, but passes its value in r2.
+*/
+void watchdogEarlyInit(void) __attribute__((naked, used, section(".init3")));
+void watchdogEarlyInit(void)
+{
+#ifdef __AVR__
+    __asm__ __volatile__("sts %0, r2" : "=m"(resetFlags));
+#endif
+    if (MCUSR != 0)
+        resetFlags = MCUSR;
+    MCUSR = 0;
+    wdt_disable();
+}
+#endif
+
+/**
+  Records the reset cause (and the last activity after a watchdog reset) in
+  EEPROM and enables the watchdog.
+*/
+void Watchdog::begin(void)
+{
+#ifdef WATCHDOG
+    WatchdogRecord record;
+    eepromCache.get(EEPROM_WATCHDOG_ADDRESS, record);
+    if (record.watchdogResets == 0xFFFF && record.lastResetCause == 0xFF)
+        record.watchdogResets = 0;  // erased EEPROM
+
+    record.lastResetCause = resetFlags;
+    if (resetFlags & _BV(WDRF))
+    {
+        Serial.print(F("=== Watchdog-Reset! Letzte Aktivität: "));
+        Serial.println(lastActivity);
+        if (record.watchdogResets != 0xFFFF)
+            record.watchdogResets++;
+        record.lastActivity = lastActivity;
+    }
+    eepromCache.put(EEPROM_WATCHDOG_ADDRESS, record);
+
+    lastActivity = (uint8_t)WatchdogActivity::Boot;
+    wdt_enable(WDTO_1S);
+#endif
+}
+
+void Watchdog::feed(WatchdogActivity activity)
+{
+#ifdef WATCHDOG
+    lastActivity = (uint8_t)activity;
+    wdt_reset();
+#endif
+}
+
+/**
+  delay() which keeps the watchdog fed.
+*/
+void Watchdog::delay(unsigned long ms)
+{
+#ifdef WATCHDOG
+    while (ms > 250)
+    {
+        feed(WatchdogActivity::Delay);
+        ::delay(250);
+        ms -= 250;
+    }
+    feed(WatchdogActivity::Delay);
+#endif
+    ::delay(ms);
+}
+
+/**
+  Needed before powering down, the watchdog would wake up (and reset) the
+  box otherwise.
+*/
+void Watchdog::disable(void)
+{
+#ifdef WATCHDOG
+    wdt_disable();
+#endif
+}
+
+void Watchdog::print(void)
+{
+#ifdef WATCHDOG
+    WatchdogRecord record;
+    eepromCache.get(EEPROM_WATCHDOG_ADDRESS, record);
+    Serial.println(F("=== Watchdog"));
+    Serial.print(F("Resets: "));
+    Serial.println(record.watchdogResets);
+    Serial.print(F("Letzte Aktivität: "));
+    Serial.println(record.lastActivity);
+    Serial.print(F("Startgrund (MCUSR): 0x"));
+    Serial.println(record.lastResetCause, HEX);
+#else
+    Serial.println(F("Watchdog nicht aktiviert (-D WATCHDOG)"));
+#endif
+}
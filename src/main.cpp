@@ -2,12 +2,19 @@
 
 #include "Types.hpp"
 #include "Settings.hpp"
+#include "ButtonLayout.hpp"
 #include "Player.hpp"
 #include "StandbyTimer.hpp"
 #include "CardManager.hpp"
+#include "SdManifest.hpp"
+#include "Statistics.hpp"
+#include "Watchdog.hpp"
+#include "EepromCache.hpp"
+#include "IdleSleep.hpp"
+#include "Trace.hpp"
+#include "BatteryMonitor.hpp"
 #include "Tracks.hpp"
 
-#include <EEPROM.h>
 #include <JC_Button.h>
 #include <MFRC522.h>
 #include <SPI.h>
@@ -25,9 +32,6 @@
     Information and contribution at https://tonuino.de.
 */
 
-// uncomment the below line to enable five button support
-//#define FIVEBUTTONS
-
 static const uint32_t cardCookie = 322417479;
 #define busyPin 4
 
@@ -39,6 +43,7 @@ Mp3Player& mp3 = player.GetMp3Player();
 uint16_t numTracksInFolder;
 uint16_t currentTrack;
 uint16_t firstTrack;
+uint8_t currentEntry;
 uint8_t queue[255];
 uint8_t volume;
 
@@ -48,6 +53,19 @@ NfcTagObject myCard;
 FolderSettings *myFolder;
 static uint16_t _lastTrackFinished;
 
+// Der Track nach dem aktuellen wird schon beim Start eines Tracks bestimmt,
+// damit nextTrack() ihn ohne Verzögerung starten kann
+struct UpcomingTrack {
+  bool valid;
+  uint16_t fromTrack;     // gilt nur, solange currentTrack und currentEntry
+  uint8_t fromEntry;      // noch diese Werte haben
+  uint16_t track;         // neuer currentTrack, 0: kein weiterer Track
+  uint8_t entry;
+  uint16_t firstTrack;
+  uint16_t numTracks;
+};
+static UpcomingTrack upcoming;
+
 // MFRC522
 #define RST_PIN 9                 // Configurable, see typical pin layout above
 #define SS_PIN 10                 // Configurable, see typical pin layout above
@@ -56,34 +74,30 @@ CardManager cardManager(SS_PIN, RST_PIN);
 
 bool successRead;
 
-#define buttonPause A0
-#define buttonUp A1
-#define buttonDown A2
-
 #define shutdownPin 7
 #define openAnalogPin A7
 
-#ifdef FIVEBUTTONS
-#define buttonFourPin A3
-#define buttonFivePin A4
-#endif
-
 #define LONG_PRESS 1000
 
-Button pauseButton(buttonPause);
-Button upButton(buttonUp);
-Button downButton(buttonDown);
-#ifdef FIVEBUTTONS
-Button buttonFour(buttonFourPin);
-Button buttonFive(buttonFivePin);
-#endif
-bool ignorePauseButton = false;
-bool ignoreUpButton = false;
-bool ignoreDownButton = false;
-#ifdef FIVEBUTTONS
-bool ignoreButtonFour = false;
-bool ignoreButtonFive = false;
-#endif
+// Wartezeiten ohne Eingabe, danach wird abgebrochen
+#define PLACE_CARD_TIMEOUT 30000
+#define MENU_TIMEOUT 120000
+
+// eine Taste aus buttonLayout, wird nur für die Tasten des Layouts erzeugt
+template <uint8_t index> struct ButtonSlot {
+  static Button button;
+  static bool ignoreRelease;  // Loslassen nach einem langen Druck ignorieren
+};
+template <uint8_t index> Button ButtonSlot<index>::button(buttonLayout[index].pin);
+template <uint8_t index> bool ButtonSlot<index>::ignoreRelease = false;
+
+// die ersten drei Tasten jedes Layouts, für die Menüs
+Button &pauseButton = ButtonSlot<0>::button;
+Button &upButton = ButtonSlot<1>::button;
+Button &downButton = ButtonSlot<2>::button;
+bool &ignorePauseButton = ButtonSlot<0>::ignoreRelease;
+bool &ignoreUpButton = ButtonSlot<1>::ignoreRelease;
+bool &ignoreDownButton = ButtonSlot<2>::ignoreRelease;
 
 StandbyTimer standby(cardManager.GetReader(), mp3, shutdownPin);
 
@@ -97,9 +111,14 @@ void dump_byte_array(byte * buffer, byte bufferSize);
 void adminMenu(bool fromCard = false);
 void playFolder();
 void playShortCut(uint8_t shortCut);
+void nextButton();
+void previousButton();
+void volumeUpButton();
+void volumeDownButton();
 bool handleReadCard(NfcTagObject &nfcTag);
 void setupCard();
 bool askCode(uint8_t *code);
+bool waitForNewCard();
 void resetCard();
 bool setupFolder(FolderSettings * theFolder);
 bool knownCard = false;
@@ -126,6 +145,42 @@ void shuffleQueue() {
   */
 }
 
+// Anzahl der Tracks eines Ordners - aus dem SD-Manifest, sonst vom DFPlayer
+uint16_t folderTrackCount(uint8_t folder) {
+  uint16_t count = sdManifestTrackCount(folder);
+  if (count == 0) {
+    watchdog.feed(WatchdogActivity::WaitForPlayer);
+    count = player.getFolderTrackCount(folder);
+    trace.trackCount(count);
+  }
+  return count;
+}
+
+// Playlist-Karten: Bereich des aktuellen Eintrags nach firstTrack und
+// numTracksInFolder übernehmen
+static void selectPlaylistEntry() {
+  PlaylistEntry &entry = myCard.playlist[currentEntry];
+  firstTrack = entry.firstTrack != 0 ? entry.firstTrack : 1;
+  numTracksInFolder = entry.lastTrack;
+  if (numTracksInFolder == 0)
+    numTracksInFolder = folderTrackCount(entry.folder);
+  Serial.print(F("Playlist Eintrag "));
+  Serial.print(currentEntry + 1);
+  Serial.print(F(": Ordner "));
+  Serial.print(entry.folder);
+  Serial.print(F(", "));
+  Serial.print(firstTrack);
+  Serial.print(F(" bis "));
+  Serial.println(numTracksInFolder);
+}
+
+// Ordner des aktuellen Tracks, bei Playlist-Karten der des aktiven Eintrags
+static uint8_t currentFolder() {
+  if (myFolder->mode == PLAYLIST_MODE)
+    return myCard.playlist[currentEntry].folder;
+  return myFolder->folder;
+}
+
 class Modifier {
   public:
     virtual void loop() {}
@@ -183,7 +238,7 @@ class SleepTimer: public Modifier {
       Serial.println(minutes);
       this->sleepAtMillis = millis() + minutes * 60000;
       //      if (isPlaying())
-      //        mp3.playAdvertisement(302);
+      //        player.playAdvertisement(302);
       //      delay(500);
     }
     uint8_t getActive() {
@@ -210,8 +265,8 @@ class FreezeDance: public Modifier {
       if (this->nextStopAtMillis != 0 && millis() > this->nextStopAtMillis) {
         Serial.println(F("== FreezeDance::loop() -> FREEZE!"));
         if (player.isPlaying()) {
-          mp3.playAdvertisement(301);
-          delay(500);
+          player.playAdvertisement(301);
+          watchdog.delay(500);
         }
         setNextStopAtMillis();
       }
@@ -219,9 +274,9 @@ class FreezeDance: public Modifier {
     FreezeDance(void) {
       Serial.println(F("=== FreezeDance()"));
       if (player.isPlaying()) {
-        delay(1000);
-        mp3.playAdvertisement(300);
-        delay(500);
+        watchdog.delay(1000);
+        player.playAdvertisement(300);
+        watchdog.delay(500);
       }
       setNextStopAtMillis();
     }
@@ -260,7 +315,7 @@ class Locked: public Modifier {
     Locked(void) {
       Serial.println(F("=== Locked()"));
       //      if (isPlaying())
-      //        mp3.playAdvertisement(303);
+      //        player.playAdvertisement(303);
     }
     uint8_t getActive() {
       return 3;
@@ -292,7 +347,7 @@ class ToddlerMode: public Modifier {
     ToddlerMode(void) {
       Serial.println(F("=== ToddlerMode()"));
       //      if (isPlaying())
-      //        mp3.playAdvertisement(304);
+      //        player.playAdvertisement(304);
     }
     uint8_t getActive() {
       Serial.println(F("== ToddlerMode::getActive()"));
@@ -300,20 +355,39 @@ class ToddlerMode: public Modifier {
     }
 };
 
+// Anzahl der Karten, die im KiTa-Modus in der Warteschlange stehen können.
+// Jeder Platz hält eine ganze Karte samt Playlist (39 Byte RAM).
+#define KINDERGARDEN_QUEUE_SIZE 4
+
 class KindergardenMode: public Modifier {
   private:
-    NfcTagObject nextCard;
-    bool cardQueued = false;
+    // Ringpuffer: Karten werden in der Reihenfolge des Auflegens gespielt
+    NfcTagObject queuedCards[KINDERGARDEN_QUEUE_SIZE];
+    uint8_t firstQueued = 0;
+    uint8_t queuedCount = 0;
+
+    static bool sameCard(const NfcTagObject &a, const NfcTagObject &b) {
+      return memcmp(&a.nfcFolderSettings, &b.nfcFolderSettings, sizeof(a.nfcFolderSettings)) == 0
+             && memcmp(a.playlist, b.playlist, sizeof(a.playlist)) == 0;
+    }
+
+    // Position (1 bis KINDERGARDEN_QUEUE_SIZE) der Karte in der Warteschlange, 0 = nicht enthalten
+    uint8_t queuedPosition(const NfcTagObject &card) {
+      for (uint8_t i = 0; i < this->queuedCount; i++) {
+        if (sameCard(this->queuedCards[(this->firstQueued + i) % KINDERGARDEN_QUEUE_SIZE], card))
+          return i + 1;
+      }
+      return 0;
+    }
 
   public:
     virtual bool handleNext() {
       Serial.println(F("== KindergardenMode::handleNext() -> NEXT"));
-      //if (this->nextCard.cookie == cardCookie && this->nextCard.nfcFolderSettings.folder != 0 && this->nextCard.nfcFolderSettings.mode != 0) {
-      //myFolder = &this->nextCard.nfcFolderSettings;
-      if (this->cardQueued == true) {
-        this->cardQueued = false;
+      if (this->queuedCount != 0) {
+        myCard = this->queuedCards[this->firstQueued];
+        this->firstQueued = (this->firstQueued + 1) % KINDERGARDEN_QUEUE_SIZE;
+        this->queuedCount--;
 
-        myCard = nextCard;
         myFolder = &myCard.nfcFolderSettings;
         Serial.println(myFolder->folder);
         Serial.println(myFolder->mode);
@@ -334,19 +408,38 @@ class KindergardenMode: public Modifier {
       Serial.println(F("== KindergardenMode::handlePreviousButton() -> LOCKED!"));
       return true;
     }
-    virtual bool handleRFID(NfcTagObject * newCard) { // lot of work to do!
-      Serial.println(F("== KindergardenMode::handleRFID() -> queued!"));
-      this->nextCard = *newCard;
-      this->cardQueued = true;
+    virtual bool handleRFID(NfcTagObject * newCard) {
+      Serial.println(F("== KindergardenMode::handleRFID()"));
+      // dieselbe Karte nicht mehrfach einreihen, myCard ist die gerade laufende Karte
+      if (player.isPlaying() && sameCard(*newCard, myCard)) {
+        Serial.println(F("läuft bereits"));
+        return true;
+      }
+      uint8_t position = queuedPosition(*newCard);
+      if (position == 0) {
+        if (this->queuedCount == KINDERGARDEN_QUEUE_SIZE) {
+          Serial.println(F("Warteschlange voll!"));
+          return true;
+        }
+        this->queuedCards[(this->firstQueued + this->queuedCount) % KINDERGARDEN_QUEUE_SIZE] = *newCard;
+        position = ++this->queuedCount;
+        Serial.print(F("-> eingereiht als "));
+        Serial.println(position);
+      }
+
       if (!player.isPlaying()) {
         handleNext();
       }
+      else {
+        // Position in der Warteschlange ansagen
+        player.playAdvertisement(position);
+      }
       return true;
     }
     KindergardenMode() {
       Serial.println(F("=== KindergardenMode()"));
       //      if (isPlaying())
-      //        mp3.playAdvertisement(305);
+      //        player.playAdvertisement(305);
       //      delay(500);
     }
     uint8_t getActive() {
@@ -362,10 +455,10 @@ class RepeatSingleModifier: public Modifier {
       delay(50);
       if (player.isPlaying()) return true;
       if (myFolder->mode == 3 || myFolder->mode == 9){
-        mp3.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
+        player.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
       }
       else{
-        mp3.playFolderTrack(myFolder->folder, currentTrack);
+        player.playFolderTrack(currentFolder(), currentTrack);
       }
       _lastTrackFinished = 0;
       return true;
@@ -387,23 +480,23 @@ class FeedbackModifier: public Modifier {
   public:
     virtual bool handleVolumeDown() {
       if (volume > mySettings.minVolume) {
-        mp3.playAdvertisement(volume - 1);
+        player.playAdvertisement(volume - 1);
       }
       else {
-        mp3.playAdvertisement(volume);
+        player.playAdvertisement(volume);
       }
-      delay(500);
+      watchdog.delay(500);
       Serial.println(F("== FeedbackModifier::handleVolumeDown()!"));
       return false;
     }
     virtual bool handleVolumeUp() {
-      if (volume < mySettings.maxVolume) {
-        mp3.playAdvertisement(volume + 1);
+      if (volume < batteryMonitor.limitVolume(mySettings.maxVolume)) {
+        player.playAdvertisement(volume + 1);
       }
       else {
-        mp3.playAdvertisement(volume);
+        player.playAdvertisement(volume);
       }
-      delay(500);
+      watchdog.delay(500);
       Serial.println(F("== FeedbackModifier::handleVolumeUp()!"));
       return false;
     }
@@ -414,8 +507,44 @@ class FeedbackModifier: public Modifier {
 };
 
 // Leider kann das Modul selbst keine Queue abspielen, daher müssen wir selbst die Queue verwalten
+// Bestimmt den Track nach dem aktuellen, bei Playlist-Karten inklusive des
+// nächsten Eintrags (dafür kann eine Anfrage an den DFPlayer nötig sein)
+static void prepareUpcomingTrack() {
+  upcoming.valid = true;
+  upcoming.fromTrack = currentTrack;
+  upcoming.fromEntry = currentEntry;
+  upcoming.track = 0;
+  upcoming.entry = currentEntry;
+  upcoming.firstTrack = firstTrack;
+  upcoming.numTracks = numTracksInFolder;
+
+  switch (myFolder->mode) {
+    case 2:
+    case 5:
+    case 8:
+      if (currentTrack != numTracksInFolder)
+        upcoming.track = currentTrack + 1;
+      break;
+    case 3:
+    case 9:
+      // Party Modus: am Ende der Queue wieder von vorne
+      upcoming.track = (currentTrack != numTracksInFolder - firstTrack + 1) ? currentTrack + 1 : 1;
+      break;
+    case PLAYLIST_MODE:
+      if (currentTrack != numTracksInFolder) {
+        upcoming.track = currentTrack + 1;
+      } else if (currentEntry + 1 < myFolder->special) {
+        PlaylistEntry &entry = myCard.playlist[currentEntry + 1];
+        upcoming.entry = currentEntry + 1;
+        upcoming.firstTrack = entry.firstTrack != 0 ? entry.firstTrack : 1;
+        upcoming.numTracks = entry.lastTrack != 0 ? entry.lastTrack : folderTrackCount(entry.folder);
+        upcoming.track = upcoming.firstTrack;
+      }
+      break;
+  }
+}
+
 static void nextTrack(uint16_t track) {
-  Serial.println(track);
   if (activeModifier != NULL)
     if (activeModifier->handleNext() == true)
       return;
@@ -430,75 +559,56 @@ static void nextTrack(uint16_t track) {
     // verarbeitet werden
     return;
 
-  Serial.println(F("=== nextTrack()"));
-
-  if (myFolder->mode == 1 || myFolder->mode == 7) {
-    Serial.println(F("Hörspielmodus ist aktiv -> keinen neuen Track spielen"));
-    standby.start(mySettings.standbyTimer * 60 * 1000);
-    //    mp3.sleep(); // Je nach Modul kommt es nicht mehr zurück aus dem Sleep!
-  }
-  if (myFolder->mode == 2 || myFolder->mode == 8) {
-    if (currentTrack != numTracksInFolder) {
-      currentTrack = currentTrack + 1;
-      mp3.playFolderTrack(myFolder->folder, currentTrack);
-      Serial.print(F("Albummodus ist aktiv -> nächster Track: "));
-      Serial.print(currentTrack);
-    } else
-      //      mp3.sleep();   // Je nach Modul kommt es nicht mehr zurück aus dem Sleep!
-      standby.start(mySettings.standbyTimer * 60 * 1000);
-    { }
-  }
-  if (myFolder->mode == 3 || myFolder->mode == 9) {
-    if (currentTrack != numTracksInFolder - firstTrack + 1) {
-      Serial.print(F("Party -> weiter in der Queue "));
-      currentTrack++;
-    } else {
-      Serial.println(F("Ende der Queue -> beginne von vorne"));
-      currentTrack = 1;
-      //// Wenn am Ende der Queue neu gemischt werden soll bitte die Zeilen wieder aktivieren
-      //     Serial.println(F("Ende der Queue -> mische neu"));
-      //     shuffleQueue();
-    }
-    Serial.println(queue[currentTrack - 1]);
-    mp3.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
+  // zuerst den nächsten Track starten, Ausgaben, Fortschritt und Standby
+  // Timer haben danach Zeit
+  if (!upcoming.valid || upcoming.fromTrack != currentTrack || upcoming.fromEntry != currentEntry)
+    prepareUpcomingTrack();
+  upcoming.valid = false;
+  bool playing = upcoming.track != 0;
+  if (playing) {
+    currentTrack = upcoming.track;
+    currentEntry = upcoming.entry;
+    firstTrack = upcoming.firstTrack;
+    numTracksInFolder = upcoming.numTracks;
+    if (myFolder->mode == 3 || myFolder->mode == 9)
+      player.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
+    else
+      player.playFolderTrack(currentFolder(), currentTrack);
   }
 
-  if (myFolder->mode == 4) {
-    Serial.println(F("Einzel Modus aktiv -> Strom sparen"));
-    //    mp3.sleep();      // Je nach Modul kommt es nicht mehr zurück aus dem Sleep!
+  Serial.println(track);
+  Serial.println(F("=== nextTrack()"));
+  if (playing) {
+    Serial.print(F("nächster Track: "));
+    Serial.println(currentTrack);
+    // Hörbuch Modus: Fortschritt im EEPROM abspeichern
+    if (myFolder->mode == 5)
+      eepromCache.update(myFolder->folder, currentTrack);
+    prepareUpcomingTrack();
+  }
+  // Admin Karten (Modus 6) spielen keine Tracks
+  else if (myFolder->mode != 6) {
+    Serial.println(F("kein weiterer Track -> Standby Timer starten"));
+    // Hörbuch Modus: Fortschritt zurück setzen
+    if (myFolder->mode == 5)
+      eepromCache.update(myFolder->folder, 1);
+    //    mp3.sleep(); // Je nach Modul kommt es nicht mehr zurück aus dem Sleep!
     standby.start(mySettings.standbyTimer * 60 * 1000);
   }
-  if (myFolder->mode == 5) {
-    if (currentTrack != numTracksInFolder) {
-      currentTrack = currentTrack + 1;
-      Serial.print(F("Hörbuch Modus ist aktiv -> nächster Track und "
-                     "Fortschritt speichern"));
-      Serial.println(currentTrack);
-      mp3.playFolderTrack(myFolder->folder, currentTrack);
-      // Fortschritt im EEPROM abspeichern
-      EEPROM.update(myFolder->folder, currentTrack);
-    } else {
-      //      mp3.sleep();  // Je nach Modul kommt es nicht mehr zurück aus dem Sleep!
-      // Fortschritt zurück setzen
-      EEPROM.update(myFolder->folder, 1);
-      standby.start(mySettings.standbyTimer * 60 * 1000);
-    }
-  }
-  delay(500);
 }
 
 static void previousTrack() {
   Serial.println(F("=== previousTrack()"));
   /*  if (myCard.mode == 1 || myCard.mode == 7) {
       Serial.println(F("Hörspielmodus ist aktiv -> Track von vorne spielen"));
-      mp3.playFolderTrack(myCard.folder, currentTrack);
+      player.playFolderTrack(myCard.folder, currentTrack);
     }*/
   if (myFolder->mode == 2 || myFolder->mode == 8) {
     Serial.println(F("Albummodus ist aktiv -> vorheriger Track"));
     if (currentTrack != firstTrack) {
       currentTrack = currentTrack - 1;
     }
-    mp3.playFolderTrack(myFolder->folder, currentTrack);
+    player.playFolderTrack(myFolder->folder, currentTrack);
   }
   if (myFolder->mode == 3 || myFolder->mode == 9) {
     if (currentTrack != 1) {
@@ -511,11 +621,11 @@ static void previousTrack() {
       currentTrack = numTracksInFolder;
     }
     Serial.println(queue[currentTrack - 1]);
-    mp3.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
+    player.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
   }
   if (myFolder->mode == 4) {
     Serial.println(F("Einzel Modus aktiv -> Track von vorne spielen"));
-    mp3.playFolderTrack(myFolder->folder, currentTrack);
+    player.playFolderTrack(myFolder->folder, currentTrack);
   }
   if (myFolder->mode == 5) {
     Serial.println(F("Hörbuch Modus ist aktiv -> vorheriger Track und "
@@ -523,16 +633,153 @@ static void previousTrack() {
     if (currentTrack != 1) {
       currentTrack = currentTrack - 1;
     }
-    mp3.playFolderTrack(myFolder->folder, currentTrack);
+    player.playFolderTrack(myFolder->folder, currentTrack);
     // Fortschritt im EEPROM abspeichern
-    EEPROM.update(myFolder->folder, currentTrack);
+    eepromCache.update(myFolder->folder, currentTrack);
   }
-  delay(1000);
+  if (myFolder->mode == PLAYLIST_MODE) {
+    Serial.println(F("Playlist Modus ist aktiv -> vorheriger Track"));
+    if (currentTrack != firstTrack) {
+      currentTrack = currentTrack - 1;
+    } else if (currentEntry != 0) {
+      currentEntry--;
+      selectPlaylistEntry();
+      currentTrack = numTracksInFolder;
+    }
+    player.playFolderTrack(currentFolder(), currentTrack);
+  }
+  prepareUpcomingTrack();
+  watchdog.delay(1000);
+}
+
+// Nummer des aktuellen Tracks ansagen
+static void announceTrackNumber() {
+  uint8_t advertTrack;
+  if (myFolder->mode == 3 || myFolder->mode == 9) {
+    advertTrack = (queue[currentTrack - 1]);
+  }
+  else {
+    advertTrack = currentTrack;
+  }
+  // Spezialmodus Von-Bis für Album und Party gibt die Dateinummer relativ zur Startposition wieder
+  if (myFolder->mode == 8 || myFolder->mode == 9) {
+    advertTrack = advertTrack - myFolder->special + 1;
+  }
+  player.playAdvertisement(advertTrack);
+}
+
+// Aktionen der Tasten (siehe ButtonLayout.hpp). Die Aktion ist zur Compilezeit
+// bekannt, übrig bleibt nur der Code des jeweiligen case
+template <ButtonAction action> void runButtonAction() {
+  switch (action) {
+    case ButtonAction::PlayPause:
+      if (activeModifier != NULL && activeModifier->handlePause())
+        return;
+      if (player.isPlaying()) {
+        mp3.pause();
+        standby.start(mySettings.standbyTimer * 60 * 1000);
+      }
+      else if (knownCard) {
+        mp3.start();
+        standby.stop();
+      }
+      break;
+    case ButtonAction::TrackNumber:
+      if (activeModifier != NULL && activeModifier->handlePause())
+        return;
+      announceTrackNumber();
+      break;
+    case ButtonAction::Next:
+      mySettings.invertVolumeButtons ? volumeUpButton() : nextButton();
+      break;
+    case ButtonAction::Previous:
+      mySettings.invertVolumeButtons ? volumeDownButton() : previousButton();
+      break;
+    case ButtonAction::VolumeUp:
+      mySettings.invertVolumeButtons ? nextButton() : volumeUpButton();
+      break;
+    case ButtonAction::VolumeDown:
+      mySettings.invertVolumeButtons ? previousButton() : volumeDownButton();
+      break;
+    case ButtonAction::ShortCut0:
+    case ButtonAction::ShortCut1:
+    case ButtonAction::ShortCut2:
+      // gesperrt wie die Pausetaste
+      if (activeModifier != NULL && activeModifier->handlePause())
+        return;
+      playShortCut((uint8_t)action - (uint8_t)ButtonAction::ShortCut0);
+      break;
+    case ButtonAction::None:
+      break;
+  }
+}
+
+// je nachdem, ob gerade etwas läuft - ohne Abfrage, wenn beide Aktionen gleich sind
+template <ButtonAction whilePlaying, ButtonAction whileIdle> void runButtonActions() {
+  if (whilePlaying == whileIdle)
+    runButtonAction<whilePlaying>();
+  else if (player.isPlaying())
+    runButtonAction<whilePlaying>();
+  else
+    runButtonAction<whileIdle>();
+}
+
+// kurzer Druck beim Loslassen, langer Druck nach LONG_PRESS
+template <uint8_t index> void handleButton() {
+  constexpr ButtonBinding binding = buttonLayout[index];
+  Button &button = ButtonSlot<index>::button;
+  bool &ignoreRelease = ButtonSlot<index>::ignoreRelease;
+
+  if (button.wasReleased()) {
+    if (!ignoreRelease)
+      runButtonActions<binding.shortPress, binding.idleShortPress>();
+    ignoreRelease = false;
+  }
+  else if ((binding.longPress != ButtonAction::None || binding.idleLongPress != ButtonAction::None)
+           && button.pressedFor(LONG_PRESS) && (binding.repeatLongPress || !ignoreRelease)) {
+    runButtonActions<binding.longPress, binding.idleLongPress>();
+    ignoreRelease = true;
+  }
+}
+
+// Schleife über alle Tasten des Layouts, wird beim Compilieren ausgerollt
+template <uint8_t index = 0, bool end = (index == buttonCount)> struct Buttons {
+  static void setup() {
+    pinMode(buttonLayout[index].pin, INPUT_PULLUP);
+    Buttons<index + 1>::setup();
+  }
+  static void read() {
+    ButtonSlot<index>::button.read();
+    Buttons<index + 1>::read();
+  }
+  static uint8_t pressed() {
+    return ButtonSlot<index>::button.isPressed() << index | Buttons<index + 1>::pressed();
+  }
+  static void handle() {
+    handleButton<index>();
+    Buttons<index + 1>::handle();
+  }
+};
+
+template <uint8_t index> struct Buttons<index, true> {
+  static void setup() {}
+  static void read() {}
+  static uint8_t pressed() {
+    return 0;
+  }
+  static void handle() {}
+};
+
+// Fehler des DFPlayers zählen und fehlgeschlagene Befehle wiederholen
+static void playerError(uint16_t errorCode) {
+  player.handleError(errorCode);
 }
 
 void setup() {
 
   Serial.begin(115200); // Es gibt ein paar Debug Ausgaben über die serielle Schnittstelle
+  eepromCache.begin();
+  watchdog.begin();
 
   // Wert für randomSeed() erzeugen durch das mehrfache Sammeln von rauschenden LSBs eines offenen Analogeingangs
   uint32_t ADC_LSB;
@@ -542,6 +789,7 @@ void setup() {
     ADCSeed ^= ADC_LSB << (i % 32);
   }
   randomSeed(ADCSeed); // Zufallsgenerator initialisieren
+  trace.begin(ADCSeed);
 
   // Dieser Hinweis darf nicht entfernt werden
   Serial.println(F("\n _____         _____ _____ _____ _____"));
@@ -563,10 +811,13 @@ void setup() {
 
   // DFPlayer Mini initialisieren
   Mp3Notify::RegisterOnPlayFinished(nextTrack);
+  Mp3Notify::RegisterOnError(playerError);
   mp3.begin();
   // Zwei Sekunden warten bis der DFPlayer Mini initialisiert ist
-  delay(2000);
-  volume = mySettings.initVolume;
+  watchdog.delay(2000);
+  // bei schwachem Akku gleich leiser starten
+  batteryMonitor.begin();
+  volume = batteryMonitor.limitVolume(mySettings.initVolume);
   mp3.setVolume(volume);
   mp3.setEq((DfMp3_Eq)(mySettings.eq - 1));
   // Fix für das Problem mit dem Timeout (ist jetzt in Upstream daher nicht mehr nötig!)
@@ -576,40 +827,63 @@ void setup() {
   SPI.begin();        // Init SPI bus
   cardManager.begin();
 
-  pinMode(buttonPause, INPUT_PULLUP);
-  pinMode(buttonUp, INPUT_PULLUP);
-  pinMode(buttonDown, INPUT_PULLUP);
-#ifdef FIVEBUTTONS
-  pinMode(buttonFourPin, INPUT_PULLUP);
-  pinMode(buttonFivePin, INPUT_PULLUP);
-#endif
+  Buttons<>::setup();
   pinMode(shutdownPin, OUTPUT);
   digitalWrite(shutdownPin, LOW);
 
 
   // RESET --- ALLE DREI KNÖPFE BEIM STARTEN GEDRÜCKT HALTEN -> alle EINSTELLUNGEN werden gelöscht
-  if (digitalRead(buttonPause) == LOW && digitalRead(buttonUp) == LOW &&
-      digitalRead(buttonDown) == LOW) {
+  if (digitalRead(buttonLayout[0].pin) == LOW && digitalRead(buttonLayout[1].pin) == LOW &&
+      digitalRead(buttonLayout[2].pin) == LOW) {
     Serial.println(F("Reset -> EEPROM wird gelöscht"));
-    for (uint16_t i = 0; i < EEPROM.length(); i++) {
-      EEPROM.update(i, 0);
-    }
+    eepromCache.reset();
     loadSettingsFromFlash(cardCookie, myFolder);
   }
 
+  statistics.begin();
 
   // Start Shortcut "at Startup" - e.g. Welcome Sound
   playShortCut(3);
 }
 
+// Befehle über die serielle Schnittstelle
+void handleSerialCommand() {
+  if (!Serial.available())
+    return;
+  switch (Serial.read()) {
+    case 's':
+      statistics.print();
+      break;
+    case 'c':
+      statistics.clear();
+      break;
+    case 'e':
+      player.printErrors();
+      break;
+    case 'w':
+      watchdog.print();
+      break;
+    case 'i':
+      idleSleep.print();
+      break;
+    case 't':
+      trace.print();
+      break;
+    case 'm':
+      eepromCache.print();
+      break;
+    case 'u':
+      player.printTransitions();
+      break;
+    case 'b':
+      batteryMonitor.print();
+      break;
+  }
+}
+
 void readButtons() {
-  pauseButton.read();
-  upButton.read();
-  downButton.read();
-#ifdef FIVEBUTTONS
-  buttonFour.read();
-  buttonFive.read();
-#endif
+  Buttons<>::read();
+  trace.buttons(Buttons<>::pressed());
 }
 
 void volumeUpButton() {
@@ -618,7 +892,7 @@ void volumeUpButton() {
       return;
 
   Serial.println(F("=== volumeUp()"));
-  if (volume < mySettings.maxVolume) {
+  if (volume < batteryMonitor.limitVolume(mySettings.maxVolume)) {
     mp3.increaseVolume();
     volume++;
   }
@@ -644,7 +918,7 @@ void nextButton() {
       return;
 
   nextTrack(random(65536));
-  delay(1000);
+  watchdog.delay(1000);
 }
 
 void previousButton() {
@@ -653,7 +927,7 @@ void previousButton() {
       return;
 
   previousTrack();
-  delay(1000);
+  watchdog.delay(1000);
 }
 
 void playFolder() {
@@ -661,7 +935,7 @@ void playFolder() {
   standby.stop();
   knownCard = true;
   _lastTrackFinished = 0;
-  numTracksInFolder = mp3.getFolderTrackCount(myFolder->folder);
+  numTracksInFolder = folderTrackCount(myFolder->folder);
   firstTrack = 1;
   Serial.print(numTracksInFolder);
   Serial.print(F(" Dateien in Ordner "));
@@ -672,13 +946,13 @@ void playFolder() {
     Serial.println(F("Hörspielmodus -> zufälligen Track wiedergeben"));
     currentTrack = random(1, numTracksInFolder + 1);
     Serial.println(currentTrack);
-    mp3.playFolderTrack(myFolder->folder, currentTrack);
+    player.playFolderTrack(myFolder->folder, currentTrack);
   }
   // Album Modus: kompletten Ordner spielen
   if (myFolder->mode == 2) {
     Serial.println(F("Album Modus -> kompletten Ordner wiedergeben"));
     currentTrack = 1;
-    mp3.playFolderTrack(myFolder->folder, currentTrack);
+    player.playFolderTrack(myFolder->folder, currentTrack);
   }
   // Party Modus: Ordner in zufälliger Reihenfolge
   if (myFolder->mode == 3) {
@@ -686,24 +960,24 @@ void playFolder() {
       F("Party Modus -> Ordner in zufälliger Reihenfolge wiedergeben"));
     shuffleQueue();
     currentTrack = 1;
-    mp3.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
+    player.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
   }
   // Einzel Modus: eine Datei aus dem Ordner abspielen
   if (myFolder->mode == 4) {
     Serial.println(
       F("Einzel Modus -> eine Datei aus dem Odrdner abspielen"));
     currentTrack = myFolder->special;
-    mp3.playFolderTrack(myFolder->folder, currentTrack);
+    player.playFolderTrack(myFolder->folder, currentTrack);
   }
   // Hörbuch Modus: kompletten Ordner spielen und Fortschritt merken
   if (myFolder->mode == 5) {
     Serial.println(F("Hörbuch Modus -> kompletten Ordner spielen und "
                      "Fortschritt merken"));
-    currentTrack = EEPROM.read(myFolder->folder);
+    currentTrack = eepromCache.read(myFolder->folder);
     if (currentTrack == 0 || currentTrack > numTracksInFolder) {
       currentTrack = 1;
     }
-    mp3.playFolderTrack(myFolder->folder, currentTrack);
+    player.playFolderTrack(myFolder->folder, currentTrack);
   }
   // Spezialmodus Von-Bin: Hörspiel: eine zufällige Datei aus dem Ordner
   if (myFolder->mode == 7) {
@@ -714,7 +988,7 @@ void playFolder() {
     numTracksInFolder = myFolder->special2;
     currentTrack = random(myFolder->special, numTracksInFolder + 1);
     Serial.println(currentTrack);
-    mp3.playFolderTrack(myFolder->folder, currentTrack);
+    player.playFolderTrack(myFolder->folder, currentTrack);
   }
 
   // Spezialmodus Von-Bis: Album: alle Dateien zwischen Start und Ende spielen
@@ -725,7 +999,7 @@ void playFolder() {
     Serial.println(myFolder->special2);
     numTracksInFolder = myFolder->special2;
     currentTrack = myFolder->special;
-    mp3.playFolderTrack(myFolder->folder, currentTrack);
+    player.playFolderTrack(myFolder->folder, currentTrack);
   }
 
   // Spezialmodus Von-Bis: Party Ordner in zufälliger Reihenfolge
@@ -736,8 +1010,20 @@ void playFolder() {
     numTracksInFolder = myFolder->special2;
     shuffleQueue();
     currentTrack = 1;
-    mp3.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
+    player.playFolderTrack(myFolder->folder, queue[currentTrack - 1]);
   }
+
+  // Playlist Modus: die Einträge der Karte nacheinander wie einen Ordner spielen
+  if (myFolder->mode == PLAYLIST_MODE && myFolder->special != 0) {
+    Serial.println(F("Playlist Modus -> Einträge der Karte nacheinander wiedergeben"));
+    currentEntry = 0;
+    selectPlaylistEntry();
+    currentTrack = firstTrack;
+    player.playFolderTrack(currentFolder(), currentTrack);
+  }
+
+  prepareUpcomingTrack();
+  statistics.countFolderPlay(currentFolder());
 }
 
 void playShortCut(uint8_t shortCut) {
@@ -747,16 +1033,55 @@ void playShortCut(uint8_t shortCut) {
     myFolder = &mySettings.shortCuts[shortCut];
     playFolder();
     standby.stop();
-    delay(1000);
+    watchdog.delay(1000);
   }
   else
     Serial.println(F("Shortcut not configured!"));
 }
 
+// Akku-Warnung, die angesagt wird, sobald wieder ein Track läuft
+bool batteryWarningPending = false;
+
+// Die Versorgungsspannung ist unter die nächste Stufe gefallen
+void batteryLevelChanged() {
+  // sauber ausschalten (Fortschritt und Statistik sind gespeichert), bevor
+  // der DFPlayer oder der Kartenleser wegen Unterspannung aussteigen
+  if (batteryMonitor.level() == BatteryLevel::Critical)
+    standby.powerOff();
+
+  // laute Stellen ziehen den meisten Strom
+  if (volume > batteryMonitor.limitVolume(volume)) {
+    volume = batteryMonitor.limitVolume(volume);
+    mp3.setVolume(volume);
+  }
+  // eine Ansage würde den angehaltenen (oder gerade startenden) Track
+  // ersetzen, dann kommt die Warnung erst beim Abspielen als Werbung
+  if (player.isPlaying())
+    player.playAdvertisement(BATTERY_LOW);
+  else if (knownCard)
+    batteryWarningPending = true;
+  else
+    player.queuePrompt(BATTERY_LOW);
+}
+
 void loop() {
 
+    // bis zum nächsten Durchlauf schlafen, falls nichts zu tun ist
+    idleSleep.waitForNextLoop();
+    watchdog.feed(WatchdogActivity::Loop);
     standby.loop();
-    mp3.loop();
+    player.loop();
+    statistics.loop();
+    if (batteryMonitor.loop())
+      batteryLevelChanged();
+    if (batteryWarningPending && player.isPlaying()) {
+      batteryWarningPending = false;
+      player.playAdvertisement(BATTERY_LOW);
+    }
+    handleSerialCommand();
+    // nach einem Reset veraltete EEPROM Bereiche nach und nach löschen
+    if (!player.isPlaying())
+      eepromCache.loop();
 
     // Modifier : WIP!
     if (activeModifier != NULL) {
@@ -770,143 +1095,32 @@ void loop() {
     // admin menu
     if ((pauseButton.pressedFor(LONG_PRESS) || upButton.pressedFor(LONG_PRESS) || downButton.pressedFor(LONG_PRESS)) && pauseButton.isPressed() && upButton.isPressed() && downButton.isPressed()) {
       mp3.pause();
+      unsigned long start = millis();
       do {
+        watchdog.feed(WatchdogActivity::AdminMenu);
         readButtons();
-      } while (pauseButton.isPressed() || upButton.isPressed() || downButton.isPressed());
+      } while ((pauseButton.isPressed() || upButton.isPressed() || downButton.isPressed())
+               && millis() - start < MENU_TIMEOUT);
       adminMenu();
     }
 
-    if (pauseButton.wasReleased()) {
-      if (activeModifier != NULL)
-        if (activeModifier->handlePause() == true)
-          return;
-      if (!ignorePauseButton)
-      {
-        if (player.isPlaying()) {
-          mp3.pause();
-          standby.start(mySettings.standbyTimer * 60 * 1000);
-        }
-        else if (knownCard) {
-          mp3.start();
-          standby.stop();
-        }
-      }
-      ignorePauseButton = false;
-    } else if (pauseButton.pressedFor(LONG_PRESS) && !ignorePauseButton) {
-      if (activeModifier != NULL)
-        if (activeModifier->handlePause() == true)
-          return;
-      if (player.isPlaying()) {
-        uint8_t advertTrack;
-        if (myFolder->mode == 3 || myFolder->mode == 9) {
-          advertTrack = (queue[currentTrack - 1]);
-        }
-        else {
-          advertTrack = currentTrack;
-        }
-        // Spezialmodus Von-Bis für Album und Party gibt die Dateinummer relativ zur Startposition wieder
-        if (myFolder->mode == 8 || myFolder->mode == 9) {
-          advertTrack = advertTrack - myFolder->special + 1;
-        }
-        mp3.playAdvertisement(advertTrack);
-      }
-      else {
-        playShortCut(0);
-      }
-      ignorePauseButton = true;
-    }
-
-    if (upButton.pressedFor(LONG_PRESS)) {
-#ifndef FIVEBUTTONS
-      if (player.isPlaying()) {
-        if (!mySettings.invertVolumeButtons) {
-          volumeUpButton();
-        }
-        else {
-          nextButton();
-        }
-      }
-      else {
-        playShortCut(1);
-      }
-      ignoreUpButton = true;
-#endif
-    } else if (upButton.wasReleased()) {
-        if (!ignoreUpButton)
-        {
-          if (!mySettings.invertVolumeButtons) {
-            nextButton();
-          }
-          else {
-            volumeUpButton();
-          }
-        }
-        ignoreUpButton = false;
-    }
-
-    if (downButton.pressedFor(LONG_PRESS)) {
-#ifndef FIVEBUTTONS
-      if (player.isPlaying()) {
-        if (!mySettings.invertVolumeButtons) {
-          volumeDownButton();
-        }
-        else {
-          previousButton();
-        }
-      }
-      else {
-        playShortCut(2);
-      }
-      ignoreDownButton = true;
-#endif
-    } else if (downButton.wasReleased()) {
-      if (!ignoreDownButton) {
-        if (!mySettings.invertVolumeButtons) {
-          previousButton();
-        }
-        else {
-          volumeDownButton();
-        }
-      }
-      ignoreDownButton = false;
-    }
-#ifdef FIVEBUTTONS
-    if (buttonFour.wasReleased()) {
-      if (isPlaying()) {
-        if (!mySettings.invertVolumeButtons) {
-          volumeUpButton();
-        }
-        else {
-          nextButton();
-        }
-      }
-      else {
-        playShortCut(1);
-      }
-    }
-    if (buttonFive.wasReleased()) {
-      if (isPlaying()) {
-        if (!mySettings.invertVolumeButtons) {
-          volumeDownButton();
-        }
-        else {
-          previousButton();
-        }
-      }
-      else {
-        playShortCut(2);
-      }
-    }
-#endif
+    Buttons<>::handle();
 
-    if (cardManager.readCard(myCard))
+    // bei schwachem Akku seltener nach Karten suchen, eine gefundene Karte
+    // aber ohne Pause fertig lesen. Die Karte wird erst nach myCard kopiert,
+    // wenn sie auch gespielt wird - sonst bleibt die laufende Karte erhalten.
+    NfcTagObject tappedCard;
+    if ((cardManager.reading() || batteryMonitor.cardPollDue()) && cardManager.readCard(tappedCard))
     {
-      if (handleReadCard(myCard)) {
-        if (myCard.cookie == cardCookie 
-            && myCard.nfcFolderSettings.folder != 0 
-            && myCard.nfcFolderSettings.mode != 0) {
+      trace.card(cardManager.GetReader().uid, tappedCard);
+      if (handleReadCard(tappedCard)) {
+        if (tappedCard.cookie == cardCookie 
+            && tappedCard.nfcFolderSettings.folder != 0 
+            && tappedCard.nfcFolderSettings.mode != 0) {
+          myCard = tappedCard;
+          myFolder = &myCard.nfcFolderSettings;
           playFolder();
-        } else if (myCard.cookie != cardCookie) {
+        } else if (tappedCard.cookie != cardCookie) {
           // Neue Karte konfigurieren
           knownCard = false;
           player.say(NEW_CARD);
@@ -917,10 +1131,11 @@ void loop() {
 }
 
 void adminMenu(bool fromCard) {
-    auto mfrc522 = cardManager.GetReader();
+    auto &mfrc522 = cardManager.GetReader();
   standby.stop();
   mp3.pause();
   Serial.println(F("=== adminMenu()"));
+  watchdog.feed(WatchdogActivity::AdminMenu);
   knownCard = false;
   if (fromCard == false) {
     // Admin menu has been locked - it still can be trigged via admin card
@@ -930,7 +1145,7 @@ void adminMenu(bool fromCard) {
     // Pin check
     else if (mySettings.adminMenuLocked == 2) {
       uint8_t pin[4];
-      mp3.playMp3FolderTrack(991);
+      player.playMp3FolderTrack(991);
       if (askCode(pin) == true) {
         if (memcmp(pin, mySettings.adminMenuPin, 4) == 0) {
           return;
@@ -944,20 +1159,23 @@ void adminMenu(bool fromCard) {
       uint8_t a = random(10, 20);
       uint8_t b = random(1, 10);
       uint8_t c;
-      player.say(SUM_OF);
-      player.say(a);
+      // die Aufgabe wird ohne Pausen angesagt, die Eingabe ist schon
+      // währenddessen möglich
+      player.cancelPrompts();
+      player.queuePrompt(SUM_OF);
+      player.queuePrompt(a);
 
       if (random(1, 3) == 2) {
         // a + b
         c = a + b;
-        player.say(PLUS);
+        player.queuePrompt(PLUS);
       } else {
         // a - b
         b = random(1, a);
         c = a - b;
-        player.say(MINUS);
+        player.queuePrompt(MINUS);
       }
-      player.say(b);
+      player.queuePrompt(b);
       Serial.println(c);
       uint8_t temp = voiceMenu(255, 0, 0, false);
       if (temp != c) {
@@ -965,7 +1183,7 @@ void adminMenu(bool fromCard) {
       }
     }
   }
-  int subMenu = voiceMenu(12, 900, 900, false, false, 0, true);
+  int subMenu = voiceMenu(13, 900, 900, false, false, 0, true);
   if (subMenu == 0)
     return;
   if (subMenu == 1) {
@@ -1009,15 +1227,11 @@ void adminMenu(bool fromCard) {
           case 4: tempCard.nfcFolderSettings.special = 60; break;
         }
       }
-      mp3.playMp3FolderTrack(PLACE_CARD);
-      do {
-        readButtons();
-        if (upButton.wasReleased() || downButton.wasReleased()) {
-          Serial.println(F("Abgebrochen!"));
-          mp3.playMp3FolderTrack(CANCELLED);
-          return;
-        }
-      } while (!mfrc522.PICC_IsNewCardPresent());
+      player.playMp3FolderTrack(PLACE_CARD);
+      if (!waitForNewCard()) {
+        player.playMp3FolderTrack(CANCELLED);
+        return;
+      }
 
       // RFID Karte wurde aufgelegt
       if (mfrc522.PICC_ReadCardSerial()) {
@@ -1033,7 +1247,7 @@ void adminMenu(bool fromCard) {
   else if (subMenu == 7) {
     uint8_t shortcut = voiceMenu(4, 940, 940);
     setupFolder(&mySettings.shortCuts[shortcut - 1]);
-    mp3.playMp3FolderTrack(400);
+    player.playMp3FolderTrack(400);
   }
   else if (subMenu == 8) {
     switch (voiceMenu(5, 960, 960)) {
@@ -1052,25 +1266,21 @@ void adminMenu(bool fromCard) {
     tempCard.version = 1;
     tempCard.nfcFolderSettings.mode = 4;
     tempCard.nfcFolderSettings.folder = voiceMenu(99, 301, 0, true);
-    uint8_t special = voiceMenu(mp3.getFolderTrackCount(tempCard.nfcFolderSettings.folder), 321, 0,
+    uint8_t special = voiceMenu(folderTrackCount(tempCard.nfcFolderSettings.folder), 321, 0,
                                 true, tempCard.nfcFolderSettings.folder);
-    uint8_t special2 = voiceMenu(mp3.getFolderTrackCount(tempCard.nfcFolderSettings.folder), 322, 0,
+    uint8_t special2 = voiceMenu(folderTrackCount(tempCard.nfcFolderSettings.folder), 322, 0,
                                  true, tempCard.nfcFolderSettings.folder, special);
 
     player.say(BATCH_CARD_INTRO);
     for (uint8_t x = special; x <= special2; x++) {
-      mp3.playMp3FolderTrack(x);
+      player.playMp3FolderTrack(x);
       tempCard.nfcFolderSettings.special = x;
       Serial.print(x);
       Serial.println(F(" Karte auflegen"));
-      do {
-        readButtons();
-        if (upButton.wasReleased() || downButton.wasReleased()) {
-          Serial.println(F("Abgebrochen!"));
-          mp3.playMp3FolderTrack(802);
-          return;
-        }
-      } while (!mfrc522.PICC_IsNewCardPresent());
+      if (!waitForNewCard()) {
+        player.playMp3FolderTrack(CANCELLED);
+        return;
+      }
 
       // RFID Karte wurde aufgelegt
       if (mfrc522.PICC_ReadCardSerial()) {
@@ -1095,11 +1305,9 @@ void adminMenu(bool fromCard) {
   }
   else if (subMenu == 11) {
     Serial.println(F("Reset -> EEPROM wird gelöscht"));
-    for (uint16_t i = 0; i < EEPROM.length(); i++) {
-      EEPROM.update(i, 0);
-    }
+    eepromCache.reset();
     resetSettings(cardCookie, myFolder);
-    mp3.playMp3FolderTrack(999);
+    player.playMp3FolderTrack(999);
   }
   // lock admin menu
   else if (subMenu == 12) {
@@ -1112,7 +1320,7 @@ void adminMenu(bool fromCard) {
     }
     else if (temp == 3) {
       uint8_t pin[4];
-      mp3.playMp3FolderTrack(991);
+      player.playMp3FolderTrack(991);
       if (askCode(pin)) {
         memcpy(mySettings.adminMenuPin, pin, 4);
         mySettings.adminMenuLocked = 2;
@@ -1123,13 +1331,60 @@ void adminMenu(bool fromCard) {
     }
 
   }
+  else if (subMenu == 13) {
+    // Create playlist card
+    NfcTagObject tempCard;
+    tempCard.cookie = cardCookie;
+    tempCard.version = 1;
+    tempCard.nfcFolderSettings.mode = PLAYLIST_MODE;
+    tempCard.nfcFolderSettings.special2 = 0;
+
+    // Einträge abfragen bis die Playlist voll ist oder mit einem langen
+    // Druck auf die Pausetaste beendet wird
+    player.say(PLAYLIST_CARD_INTRO);
+    uint8_t entries = 0;
+    while (entries < PLAYLIST_MAX_ENTRIES) {
+      PlaylistEntry &entry = tempCard.playlist[entries];
+      entry.folder = voiceMenu(99, 301, 0, true, 0, 0, true);
+      if (entry.folder == 0)
+        break;
+      uint16_t tracks = folderTrackCount(entry.folder);
+      entry.firstTrack = voiceMenu(tracks, 321, 0, true, entry.folder);
+      entry.lastTrack = voiceMenu(tracks, 322, 0, true, entry.folder, entry.firstTrack);
+      entries++;
+    }
+    if (entries == 0)
+      return;
+    tempCard.nfcFolderSettings.folder = tempCard.playlist[0].folder;
+    tempCard.nfcFolderSettings.special = entries;
+
+    player.playMp3FolderTrack(PLACE_CARD);
+    if (!waitForNewCard()) {
+      player.playMp3FolderTrack(CANCELLED);
+      return;
+    }
+
+    // RFID Karte wurde aufgelegt
+    if (mfrc522.PICC_ReadCardSerial()) {
+      Serial.println(F("schreibe Karte..."));
+      writeCard(tempCard);
+      delay(100);
+      mfrc522.PICC_HaltA();
+      mfrc522.PCD_StopCrypto1();
+      player.waitForTrackToFinish();
+    }
+  }
   writeSettingsToFlash(myFolder);
   standby.start(mySettings.standbyTimer * 60 * 1000);
 }
 
 bool askCode(uint8_t *code) {
   uint8_t x = 0;
+  unsigned long start = millis();
   while (x < 4) {
+    watchdog.feed(WatchdogActivity::AskCode);
+    if (millis() - start > MENU_TIMEOUT)
+      return false;
     readButtons();
     if (pauseButton.pressedFor(LONG_PRESS))
       break;
@@ -1148,19 +1403,31 @@ uint8_t voiceMenu(int numberOfOptions, int startMessage, int messageOffset,
   uint8_t returnValue = defaultValue;
   if (startMessage != 0)
   {
-    player.say(startMessage);
+    player.queuePrompt(startMessage);
   }
 
   Serial.print(F("=== voiceMenu() ("));
   Serial.print(numberOfOptions);
   Serial.println(F(" Options)"));
+  unsigned long lastInput = millis();
   do {
+    watchdog.feed(WatchdogActivity::VoiceMenu);
+    player.loop();
+    if (millis() - lastInput > MENU_TIMEOUT) {
+      Serial.println(F("Keine Eingabe -> Abbruch"));
+      return defaultValue;
+    }
+    if (upButton.isPressed() || downButton.isPressed() || pauseButton.isPressed())
+      lastInput = millis();
     if (Serial.available() > 0) {
       int optionSerial = Serial.parseInt();
       if (optionSerial != 0 && optionSerial <= numberOfOptions)
         return optionSerial;
     }
     readButtons();
+    // jede Taste bricht laufende Ansagen ab
+    if (upButton.wasPressed() || downButton.wasPressed() || pauseButton.wasPressed())
+      player.cancelPrompts();
     if (pauseButton.pressedFor(LONG_PRESS)) {
       player.say(CANCELLED);
       ignorePauseButton = true;
@@ -1174,26 +1441,28 @@ uint8_t voiceMenu(int numberOfOptions, int startMessage, int messageOffset,
         Serial.println(F(" ==="));
         return returnValue;
       }
-      delay(1000);
+      watchdog.delay(1000);
     }
 
+    // gedrückt halten springt weiter, sobald die Zahl angesagt ist
     if (upButton.pressedFor(LONG_PRESS)) {
+      if (player.promptsPending())
+        continue;
       returnValue = min(returnValue + 10, numberOfOptions);
       Serial.println(returnValue);
-      player.say(messageOffset + returnValue);
+      player.queuePrompt(messageOffset + returnValue);
       ignoreUpButton = true;
     } else if (upButton.wasReleased()) {
       if (!ignoreUpButton) {
         returnValue = min(returnValue + 1, numberOfOptions);
         Serial.println(returnValue);
-        player.say(messageOffset + returnValue);
+        player.queuePrompt(messageOffset + returnValue);
         if (preview) {
           if (previewFromFolder == 0) {
-            mp3.playFolderTrack(returnValue, 1);
+            player.queueFolderTrack(returnValue, 1);
           } else {
-            mp3.playFolderTrack(previewFromFolder, returnValue);
+            player.queueFolderTrack(previewFromFolder, returnValue);
           }
-          delay(1000);
         }
       } else {
         ignoreUpButton = false;
@@ -1201,23 +1470,24 @@ uint8_t voiceMenu(int numberOfOptions, int startMessage, int messageOffset,
     }
 
     if (downButton.pressedFor(LONG_PRESS)) {
+      if (player.promptsPending())
+        continue;
       returnValue = max(returnValue - 10, 1);
       Serial.println(returnValue);
-      player.say(messageOffset + returnValue);
+      player.queuePrompt(messageOffset + returnValue);
       ignoreDownButton = true;
     } else if (downButton.wasReleased()) {
       if (!ignoreDownButton) {
         returnValue = max(returnValue - 1, 1);
         Serial.println(returnValue);
-        player.say(messageOffset + returnValue);
+        player.queuePrompt(messageOffset + returnValue);
         if (preview) {
           if (previewFromFolder == 0) {
-            mp3.playFolderTrack(returnValue, 1);
+            player.queueFolderTrack(returnValue, 1);
           }
           else {
-            mp3.playFolderTrack(previewFromFolder, returnValue);
+            player.queueFolderTrack(previewFromFolder, returnValue);
           }
-          delay(1000);
         }
       } else {
         ignoreDownButton = false;
@@ -1226,20 +1496,30 @@ uint8_t voiceMenu(int numberOfOptions, int startMessage, int messageOffset,
   } while (true);
 }
 
-void resetCard() {
-    auto mfrc522 = cardManager.GetReader();
-  player.say(PLACE_CARD);
+// Wartet bis eine Karte aufgelegt wird - Abbruch mit Hoch/Runter oder wenn
+// nach PLACE_CARD_TIMEOUT noch keine Karte aufgelegt wurde
+bool waitForNewCard() {
+  auto &mfrc522 = cardManager.GetReader();
+  unsigned long start = millis();
   do {
-    pauseButton.read();
-    upButton.read();
-    downButton.read();
-
-    if (upButton.wasReleased() || downButton.wasReleased()) {
-      Serial.print(F("Abgebrochen!"));
-      player.say(CANCELLED);
-      return;
+    watchdog.feed(WatchdogActivity::WaitForCard);
+    readButtons();
+    if (upButton.wasReleased() || downButton.wasReleased() || millis() - start > PLACE_CARD_TIMEOUT) {
+      Serial.println(F("Abgebrochen!"));
+      return false;
     }
   } while (!mfrc522.PICC_IsNewCardPresent());
+  trace.cardPlaced();
+  return true;
+}
+
+void resetCard() {
+    auto &mfrc522 = cardManager.GetReader();
+  player.say(PLACE_CARD);
+  if (!waitForNewCard()) {
+    player.say(CANCELLED);
+    return;
+  }
 
   if (!mfrc522.PICC_ReadCardSerial())
     return;
@@ -1258,11 +1538,11 @@ bool setupFolder(FolderSettings * theFolder) {
   if (theFolder->mode == 0) return false;
 
   //  // Hörbuchmodus -> Fortschritt im EEPROM auf 1 setzen
-  //  EEPROM.update(theFolder->folder, 1);
+  //  eepromCache.update(theFolder->folder, 1);
 
   // Einzelmodus -> Datei abfragen
   if (theFolder->mode == 4)
-    theFolder->special = voiceMenu(mp3.getFolderTrackCount(theFolder->folder), 320, 0,
+    theFolder->special = voiceMenu(folderTrackCount(theFolder->folder), 320, 0,
                                    true, theFolder->folder);
   // Admin Funktionen
   if (theFolder->mode == 6) {
@@ -1272,9 +1552,9 @@ bool setupFolder(FolderSettings * theFolder) {
   }
   // Spezialmodus Von-Bis
   if (theFolder->mode == 7 || theFolder->mode == 8 || theFolder->mode == 9) {
-    theFolder->special = voiceMenu(mp3.getFolderTrackCount(theFolder->folder), 321, 0,
+    theFolder->special = voiceMenu(folderTrackCount(theFolder->folder), 321, 0,
                                    true, theFolder->folder);
-    theFolder->special2 = voiceMenu(mp3.getFolderTrackCount(theFolder->folder), 322, 0,
+    theFolder->special2 = voiceMenu(folderTrackCount(theFolder->folder), 322, 0,
                                     true, theFolder->folder, theFolder->special);
   }
   return true;
@@ -1288,15 +1568,18 @@ void setupCard() {
   {
     // Karte ist konfiguriert -> speichern
     mp3.pause();
+    unsigned long start = millis();
     do {
-    } while (player.isPlaying());
+      watchdog.feed(WatchdogActivity::WaitForPlayer);
+    } while (player.isPlaying() && millis() - start < 1000);
     writeCard(newCard);
   }
-  delay(1000);
+  watchdog.delay(1000);
 }
 
 bool handleReadCard(NfcTagObject &readTag)
 {
+  statistics.count(STATISTICS_CARD_TAPS);
   if (readTag.cookie == cardCookie)
   {
     if (activeModifier != NULL && readTag.nfcFolderSettings.folder != 0)
@@ -1315,18 +1598,18 @@ bool handleReadCard(NfcTagObject &readTag)
           Serial.println(F("modifier removed"));
           if (player.isPlaying())
           {
-            mp3.playAdvertisement(261);
+            player.playAdvertisement(261);
           }
           else
           {
             mp3.start();
             delay(100);
-            mp3.playAdvertisement(261);
+            player.playAdvertisement(261);
             delay(100);
             mp3.pause();
           }
 
-          delay(2000);
+          watchdog.delay(2000);
           return false;
         }
       }
@@ -1335,18 +1618,19 @@ bool handleReadCard(NfcTagObject &readTag)
       {
         if (player.isPlaying())
         {
-          mp3.playAdvertisement(260);
+          player.playAdvertisement(260);
         }
         else
         {
           mp3.start();
           delay(100);
-          mp3.playAdvertisement(260);
+          player.playAdvertisement(260);
           delay(100);
           mp3.pause();
         }
       }
 
+      statistics.countModifier(readTag.nfcFolderSettings.mode);
       switch (readTag.nfcFolderSettings.mode)
       {
       case 0:
@@ -1372,19 +1656,18 @@ bool handleReadCard(NfcTagObject &readTag)
         activeModifier = new RepeatSingleModifier();
         break;
       }
-      delay(2000);
+      watchdog.delay(2000);
       return false;
     }
     else
     {
       Serial.println(readTag.nfcFolderSettings.folder);
-      myFolder = &readTag.nfcFolderSettings;
-      Serial.println(myFolder->folder);
     }
     return true;
   }
   else
   {
+    statistics.count(STATISTICS_NEW_CARDS);
     return true;
   }
 }
@@ -1392,17 +1675,22 @@ bool handleReadCard(NfcTagObject &readTag)
 void writeCard(NfcTagObject nfcTag) {
   auto result = cardManager.writeCard(nfcTag);
 
-  if (result == CardManagerError::CardManagerAuthenticationFailed)
+  // Karte erst bestätigen, wenn sie geschrieben und zurückgelesen wurde
+  if (result == CardManagerError::CardManagerSuccess)
   {
-    mp3.playMp3FolderTrack(401);
+    player.playMp3FolderTrack(400);
   }
-  else if (result == CardManagerError::CardManagerWriteFailed)
+  else if (result == CardManagerError::CardManagerTagTooSmall)
+  {
+    player.playMp3FolderTrack(CARD_TOO_SMALL);
+  }
+  else
   {
-    mp3.playMp3FolderTrack(400);
+    player.playMp3FolderTrack(401);
   }
 
   Serial.println();
-  delay(2000);
+  watchdog.delay(2000);
 }
 
 
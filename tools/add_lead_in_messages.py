@@ -4,7 +4,7 @@
 # So - when played e.g. on a TonUINO - you first will hear the title of the track, then the track itself.
 
 
-import argparse, base64, json, os, re, subprocess, sys, text_to_speech
+import argparse, json, multiprocessing, multiprocessing.pool, os, re, shutil, subprocess, sys, tempfile, threading, text_to_speech
 
 
 argFormatter = lambda prog: argparse.RawDescriptionHelpFormatter(prog, max_help_position=27, width=100)
@@ -21,6 +21,7 @@ text_to_speech.addArgumentsToArgparser(argparser)
 argparser.add_argument('--file-regex', type=str, default=None, help="The regular expression to use for parsing the mp3 file name. If missing the whole file name except a leading number will be used as track title.")
 argparser.add_argument('--title-pattern', type=str, default=None, help="The pattern to use as track title. May contain groups of `--file-regex`, e.g. '\\1'")
 argparser.add_argument('--add-numbering', action='store_true', help='Whether to add a three-digit number to the mp3 files (suitable for DFPlayer Mini)')
+argparser.add_argument('-j', '--jobs', type=int, default=multiprocessing.cpu_count(), help='The number of files to process in parallel. (default: number of CPUs)')
 argparser.add_argument('--dry-run', action='store_true', help='Dry run: Only prints what the script would do, without actually creating files')
 args = argparser.parse_args()
 
@@ -29,17 +30,14 @@ text_to_speech.checkArgs(argparser, args)
 fileRegex = re.compile(args.file_regex if args.file_regex is not None else '\\d*(.*)')
 titlePattern = args.title_pattern if args.title_pattern is not None else '\\1'
 
-mp3FileIndex = 0
-
 
 def fail(msg):
     print('ERROR: ' + msg)
     sys.exit(1)
 
 
-def addLeadInMessage(inputPath, outputPath):
-    global mp3FileIndex
-
+def collectJobs(inputPath, outputPath, jobs):
+    """Collects the (text, input file, output file) jobs. Output directories are created on the way."""
     if not os.path.exists(inputPath):
         fail('Input does not exist: ' + os.path.abspath(inputPath))
 
@@ -52,73 +50,137 @@ def addLeadInMessage(inputPath, outputPath):
 
         mp3FileIndex = 0
         for child in sorted(os.listdir(inputPath)):
-            addLeadInMessage(os.path.join(inputPath, child), os.path.join(outputPath, child))
-
+            childInputPath = os.path.join(inputPath, child)
+            childOutputPath = os.path.join(outputPath, child)
+            if os.path.isdir(childInputPath):
+                collectJobs(childInputPath, childOutputPath, jobs)
+                continue
+            if os.path.splitext(child)[1].lower() != '.mp3':
+                print('Ignoring {} (no mp3 file)'.format(os.path.abspath(childInputPath)))
+                continue
+            if args.add_numbering:
+                childOutputPath = os.path.join(outputPath, '{:0>3}_{}'.format(mp3FileIndex + 1, child))
+                mp3FileIndex += 1
+            addJob(childInputPath, childOutputPath, jobs)
         return
 
-    inputFileNameSplit = os.path.splitext(os.path.basename(inputPath))
-    inputFileName = inputFileNameSplit[0]
-    inputFileExt = inputFileNameSplit[1].lower()
-
-    if inputFileExt != '.mp3':
+    if os.path.splitext(inputPath)[1].lower() != '.mp3':
         print('Ignoring {} (no mp3 file)'.format(os.path.abspath(inputPath)))
         return
-
     if args.add_numbering:
         outputPathSplit = os.path.split(outputPath)
-        outputPath = os.path.join(outputPathSplit[0], '{:0>3}_{}'.format(mp3FileIndex + 1, outputPathSplit[1]))
-        mp3FileIndex += 1
+        outputPath = os.path.join(outputPathSplit[0], '{:0>3}_{}'.format(1, outputPathSplit[1]))
+    addJob(inputPath, outputPath, jobs)
 
+
+def addJob(inputPath, outputPath, jobs):
     if os.path.isfile(outputPath):
         print('Skipping {} (file already exists)'.format(os.path.abspath(outputPath)))
         return
 
+    inputFileName = os.path.splitext(os.path.basename(inputPath))[0]
     text = re.sub(fileRegex, titlePattern, inputFileName).replace('_', ' ').strip()
     print('Adding lead-in "{}" to {}'.format(text, os.path.abspath(outputPath)))
-
-    if not args.dry_run:
-        tempLeadInFile = 'temp-lead-in.mp3'
-        tempLeadInFileAdjusted = 'temp-lead-in_adjusted.mp3'
-        text_to_speech.textToSpeechUsingArgs(text=text, targetFile=tempLeadInFile, args=args)
-
-        # Adjust sample rate and mono/stereo
-        print('Detecting sample rate and channels')
-        detectionInfo = detectAudioData(inputPath)
-        if detectionInfo is None:
+    jobs.append((text, inputPath, outputPath))
+
+
+class LeadInCache:
+    """
+    Creates each lead-in (title, sample rate, channels) only once per run - even if several
+    workers need it at the same time. The speech itself is cached across runs by text_to_speech.
+    """
+
+    def __init__(self, tempDir):
+        self.tempDir = tempDir
+        self.lock = threading.Lock()
+        self.entries = {}
+
+    def get(self, text, audioData):
+        key = (text, audioData['sampleRate'], audioData['channels']) if audioData is not None else (text, None, None)
+        with self.lock:
+            entry = self.entries.get(key)
+            if entry is None:
+                entry = { 'lock': threading.Lock(), 'created': False, 'file': None, 'index': len(self.entries) }
+                self.entries[key] = entry
+
+        with entry['lock']:
+            if not entry['created']:
+                entry['file'] = self.create(text, audioData, entry['index'])
+                entry['created'] = True
+            return entry['file']
+
+    def create(self, text, audioData, index):
+        """Returns the lead-in file or None if creating it failed"""
+        leadInFile = os.path.join(self.tempDir, 'lead-in-{}.mp3'.format(index))
+        text_to_speech.textToSpeechUsingArgs(text=text, targetFile=leadInFile, args=args)
+        if audioData is None:
             # We can't adjust
             print('Detecting sample rate and channels failed -> Skipping adjustment')
-            tempLeadInFileAdjusted = tempLeadInFile
-        else:
-            print('Adjust sample rate to {} and channels to {}'.format(detectionInfo['sampleRate'], detectionInfo['channels']))
-            subprocess.call([ 'ffmpeg', '-i', tempLeadInFile, '-vn', '-ar', detectionInfo['sampleRate'], '-ac', detectionInfo['channels'], tempLeadInFileAdjusted ])
+            return leadInFile
 
-        print('Concat')
-        subprocess.call([ 'ffmpeg', '-i', 'concat:{}|{}'.format(tempLeadInFileAdjusted, inputPath), '-acodec', 'copy', outputPath, '-map_metadata', '0:1' ])
-
-        os.remove(tempLeadInFile)
-        os.remove(tempLeadInFileAdjusted)
-        print('\n')
+        # Adjust sample rate and mono/stereo
+        adjustedFile = os.path.join(self.tempDir, 'lead-in-{}_adjusted.mp3'.format(index))
+        if subprocess.call([ 'ffmpeg', '-loglevel', 'error', '-i', leadInFile, '-vn', '-ar', audioData['sampleRate'], '-ac', audioData['channels'], adjustedFile ]) != 0 or not os.path.isfile(adjustedFile):
+            print('ERROR: Adjusting the lead-in "{}" failed'.format(text))
+            return None
+        return adjustedFile
 
 
 def detectAudioData(mp3File):
+    """Probes sample rate and channels of the first audio stream with a single ffprobe call"""
     try:
-        output = subprocess.check_output([ 'ffmpeg', '-i', mp3File, '-hide_banner' ], stderr=subprocess.STDOUT)
-    except Exception, e:
-        output = str(e.output)
-
-    match = re.match('.*Stream #\\d+:\\d+: Audio: mp3, (\\d+) Hz, (mono|stereo), .*', output, re.S)
-    if match:
-        return {
-            'sampleRate': match.group(1),
-            'channels': '2' if match.group(2) == 'stereo' else '1'
-        }
-    else:
+        output = subprocess.check_output([ 'ffprobe', '-v', 'quiet', '-print_format', 'json', '-show_streams', '-select_streams', 'a:0', mp3File ])
+        streams = json.loads(output.decode('utf-8'))['streams']
+    except Exception:
         return None
 
+    if not streams or 'sample_rate' not in streams[0] or 'channels' not in streams[0]:
+        return None
+    return {
+        'sampleRate': str(streams[0]['sample_rate']),
+        'channels': str(streams[0]['channels'])
+    }
+
+
+def processJob(job, leadInCache):
+    """Returns True if the output file was created"""
+    text, inputPath, outputPath = job
+    jobTempDir = tempfile.mkdtemp(prefix='lead-in-job-')
+    try:
+        leadInFile = leadInCache.get(text, detectAudioData(inputPath))
+
+        # Concat into the job's temp dir first, so no half-written output is left on errors
+        tempOutputFile = os.path.join(jobTempDir, 'output.mp3')
+        if (leadInFile is not None and
+                subprocess.call([ 'ffmpeg', '-loglevel', 'error', '-i', 'concat:{}|{}'.format(leadInFile, inputPath), '-acodec', 'copy', tempOutputFile, '-map_metadata', '0:1' ]) == 0 and
+                os.path.isfile(tempOutputFile)):
+            shutil.move(tempOutputFile, outputPath)
+            print('Created {}'.format(os.path.abspath(outputPath)))
+            return True
+        print('ERROR: Creating {} failed'.format(os.path.abspath(outputPath)))
+        return False
+    finally:
+        shutil.rmtree(jobTempDir, ignore_errors=True)
+
 
 if not os.path.exists(args.output) and not args.dry_run:
     outputParent = os.path.dirname(os.path.abspath(args.output))
     if not os.path.isdir(outputParent):
         fail('Parent of output is no directory: ' + os.path.abspath(outputParent))
 
-addLeadInMessage(args.input, args.output)
+jobs = []
+collectJobs(args.input, args.output, jobs)
+
+if not args.dry_run and jobs:
+    runTempDir = tempfile.mkdtemp(prefix='lead-in-')
+    leadInCache = LeadInCache(runTempDir)
+    pool = multiprocessing.pool.ThreadPool(max(args.jobs, 1))
+    try:
+        # `map_async` + `get` with timeout keeps Ctrl+C working
+        results = pool.map_async(lambda job: processJob(job, leadInCache), jobs, chunksize=1).get(7 * 86400)
+    finally:
+        pool.terminate()
+        shutil.rmtree(runTempDir, ignore_errors=True)
+
+    if not all(results):
+        fail('{} files could not be created'.format(results.count(False)))
@@ -0,0 +1,330 @@
+#!/usr/bin/python
+
+# Builds the content of a TonUINO SD card (folders `01` - `99` holding `001.mp3`, `002.mp3`, ...)
+# from a tagged music library and a mapping file. Tracks are transcoded in parallel into a format
+# the DFPlayer Mini plays reliably. Re-runs only transcode what has changed.
+
+
+import argparse, io, json, multiprocessing, multiprocessing.pool, os, re, subprocess, sys, create_sd_manifest, mp3_info, text_to_speech
+
+
+audioExtensions = [ '.mp3', '.m4a', '.mp4', '.aac', '.flac', '.ogg', '.oga', '.opus', '.wav', '.wma', '.aiff', '.aif' ]
+
+# Names usable in the mapping file for the playback modes of the firmware
+modeByName = {
+    'hoerspiel': 1, 'audio-drama': 1,
+    'album': 2,
+    'party': 3,
+    'einzel': 4, 'single': 4,
+    'hoerbuch': 5, 'audiobook': 5,
+}
+
+manifestVersion = 1
+maxTracksPerFolder = 255
+
+mappingLineRe = re.compile('^(\\d{1,2})\\s*\\|\\s*([^|]*?)\\s*(?:\\|\\s*(\\S+)\\s*)?$')
+trackFileRe = re.compile('^\\d{3}\\.mp3$', re.I)
+naturalSortRe = re.compile('(\\d+)')
+
+failedTracks = []
+
+
+def fail(msg):
+    print('ERROR: ' + msg)
+    sys.exit(1)
+
+
+def naturalSortKey(text):
+    return [ int(part) if part.isdigit() else part.lower() for part in naturalSortRe.split(text) ]
+
+
+def readMapping(mappingFile):
+    """
+    Reads the mapping file. Each line maps a SD card folder to a directory or file of the library:
+
+        # folder | source (relative to the library) | mode (optional, default: album)
+        01 | Kinderlieder/Best of | party
+        02 | Hoerbuecher/Der kleine Drache | hoerbuch
+    """
+    folders = {}
+    with io.open(mappingFile, encoding='utf-8') as f:
+        for lineNumber, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith('#'):
+                continue
+            match = mappingLineRe.match(line)
+            if not match:
+                fail('{}:{}: Expected `folder | source | mode`: {}'.format(mappingFile, lineNumber, line))
+            folder = int(match.group(1))
+            if folder < 1 or folder > 99:
+                fail('{}:{}: Folder must be between 1 and 99'.format(mappingFile, lineNumber))
+            if folder in folders:
+                fail('{}:{}: Folder {:0>2} is mapped twice'.format(mappingFile, lineNumber, folder))
+            modeName = (match.group(3) or 'album').lower()
+            mode = int(modeName) if modeName.isdigit() else modeByName.get(modeName)
+            if mode is None or mode < 1 or mode > 5:
+                fail('{}:{}: Unknown mode `{}` (use one of: {})'.format(mappingFile, lineNumber, modeName, ', '.join(sorted(modeByName))))
+            folders[folder] = { 'source': match.group(2), 'mode': mode }
+    return folders
+
+
+def findAudioFiles(libraryDir, source):
+    sourcePath = os.path.join(libraryDir, source)
+    if os.path.isfile(sourcePath):
+        return [ source ]
+    if not os.path.isdir(sourcePath):
+        fail('Source does not exist: ' + os.path.abspath(sourcePath))
+
+    result = []
+    for dirPath, dirNames, fileNames in os.walk(sourcePath):
+        dirNames[:] = [ name for name in dirNames if not name.startswith('.') ]
+        for fileName in fileNames:
+            if not fileName.startswith('.') and os.path.splitext(fileName)[1].lower() in audioExtensions:
+                result.append(os.path.relpath(os.path.join(dirPath, fileName), libraryDir))
+    return result
+
+
+def parseTagNumber(value):
+    """Parses tag numbers like `3` or `3/12`"""
+    match = re.match('\\s*(\\d+)', value or '')
+    return int(match.group(1)) if match else None
+
+
+def probeTags(path):
+    """Returns the (lower-cased) tags of an audio file using ffprobe"""
+    try:
+        output = subprocess.check_output([ 'ffprobe', '-v', 'quiet', '-print_format', 'json', '-show_format', path ])
+        tags = json.loads(output.decode('utf-8')).get('format', {}).get('tags', {})
+    except Exception:
+        return {}
+    return dict((key.lower(), value) for key, value in tags.items())
+
+
+def getFingerprint(libraryDir, source, args):
+    stat = os.stat(os.path.join(libraryDir, source))
+    return [ source, stat.st_size, int(stat.st_mtime), args.bitrate, args.sample_rate, args.channels ]
+
+
+def planFolder(libraryDir, folderMapping, pool):
+    """Returns the tracks of a folder in play order: disc number, track number, then file path"""
+    sources = findAudioFiles(libraryDir, folderMapping['source'])
+    allTags = pool.map(lambda source: probeTags(os.path.join(libraryDir, source)), sources)
+
+    tracks = []
+    for source, tags in zip(sources, allTags):
+        tracks.append({
+            'source': source,
+            'title': tags.get('title') or os.path.splitext(os.path.basename(source))[0],
+            'sortKey': (parseTagNumber(tags.get('disc')) or 0, parseTagNumber(tags.get('track')) or 0, naturalSortKey(source))
+        })
+    tracks.sort(key=lambda track: track['sortKey'])
+    for track in tracks:
+        del track['sortKey']
+    return tracks
+
+
+def replaceFile(sourceFile, targetFile):
+    if os.path.exists(targetFile):
+        os.remove(targetFile)
+    os.rename(sourceFile, targetFile)
+
+
+def transcode(sourceFile, targetFile, args):
+    """
+    Transcodes into CBR mp3 without any tags: The DFPlayer struggles with VBR files and large ID3 tags
+    (like embedded cover art) delay the start of a track noticeably.
+    """
+    tempFile = targetFile + '.tmp.mp3'
+    command = [ 'ffmpeg', '-loglevel', 'error', '-y', '-i', sourceFile, '-map', '0:a:0', '-map_metadata', '-1',
+        '-codec:a', 'libmp3lame', '-b:a', args.bitrate, '-ar', str(args.sample_rate), '-ac', str(args.channels),
+        '-id3v2_version', '0', '-write_id3v1', '0', tempFile ]
+    if subprocess.call(command) != 0 or not os.path.isfile(tempFile):
+        if os.path.exists(tempFile):
+            os.remove(tempFile)
+        return False
+    replaceFile(tempFile, targetFile)
+    return True
+
+
+def getCards(folder, folderMapping, tracks):
+    """Returns the card settings (like the FolderSettings of the firmware) to create for a folder"""
+    mode = folderMapping['mode']
+    if mode == 4:
+        # Single mode: One card per track
+        return [ { 'folder': folder, 'mode': mode, 'special': index + 1, 'special2': 0, 'title': track['title'] }
+            for index, track in enumerate(tracks) ]
+    return [ { 'folder': folder, 'mode': mode, 'special': 0, 'special2': 0, 'title': os.path.splitext(os.path.basename(os.path.normpath(folderMapping['source'])))[0] } ]
+
+
+def loadManifest(manifestFile):
+    if not os.path.isfile(manifestFile):
+        return { 'version': manifestVersion, 'folders': {} }
+    with io.open(manifestFile, encoding='utf-8') as f:
+        manifest = json.load(f)
+    if manifest.get('version') != manifestVersion:
+        print('Ignoring manifest of other version: ' + manifestFile)
+        return { 'version': manifestVersion, 'folders': {} }
+    return manifest
+
+
+def writeManifest(manifest, manifestFile):
+    tempFile = manifestFile + '.tmp'
+    with io.open(tempFile, 'w', encoding='utf-8') as f:
+        f.write(json.dumps(manifest, indent=2, sort_keys=True, ensure_ascii=False))
+    replaceFile(tempFile, manifestFile)
+
+
+def buildFolder(folder, folderMapping, oldFolder, args, pool):
+    """Brings one folder of the SD card up to date. Returns the new manifest entry of the folder."""
+    folderName = '{:0>2}'.format(folder)
+    folderPath = os.path.join(args.output, folderName)
+    tracks = planFolder(args.library, folderMapping, pool)
+    if not tracks:
+        print('WARNING: Folder {}: No audio files found in {}'.format(folderName, folderMapping['source']))
+    if len(tracks) > maxTracksPerFolder:
+        print('WARNING: Folder {}: {} tracks, only {} are supported'.format(folderName, len(tracks), maxTracksPerFolder))
+        tracks = tracks[:maxTracksPerFolder]
+
+    if not os.path.isdir(folderPath) and not args.dry_run:
+        os.mkdir(folderPath)
+
+    # Existing files we can keep (maybe under another number, if the play order has changed)
+    reusable = {}
+    for oldTrack in (oldFolder or {}).get('tracks', []):
+        oldFile = os.path.join(folderPath, oldTrack['file'])
+        if os.path.isfile(oldFile) and os.path.getsize(oldFile) == oldTrack.get('size'):
+            reusable[json.dumps(oldTrack['fingerprint'])] = oldTrack
+
+    moves = []
+    transcodes = []
+    for index, track in enumerate(tracks):
+        track['file'] = '{:0>3}.mp3'.format(index + 1)
+        track['fingerprint'] = getFingerprint(args.library, track['source'], args)
+        oldTrack = reusable.pop(json.dumps(track['fingerprint']), None)
+        if oldTrack is None:
+            transcodes.append(track)
+        else:
+            track['size'] = oldTrack['size']
+            track['duration'] = oldTrack.get('duration')
+            if oldTrack['file'] != track['file']:
+                moves.append((oldTrack['file'], track['file']))
+
+    print('Folder {}: {} tracks ({} to transcode, {} to renumber)'.format(folderName, len(tracks), len(transcodes), len(moves)))
+    if args.dry_run:
+        return None
+
+    # Renumber via temporary names, so no file is overwritten before it was moved itself
+    for oldFile, newFile in moves:
+        os.rename(os.path.join(folderPath, oldFile), os.path.join(folderPath, newFile + '.move'))
+    transcodedFiles = set(track['file'] for track in transcodes)
+    keptFiles = set(track['file'] for track in tracks if track['file'] not in transcodedFiles)
+    for fileName in os.listdir(folderPath):
+        if trackFileRe.match(fileName) and fileName not in keptFiles:
+            os.remove(os.path.join(folderPath, fileName))
+    for oldFile, newFile in moves:
+        replaceFile(os.path.join(folderPath, newFile + '.move'), os.path.join(folderPath, newFile))
+
+    def transcodeTrack(track):
+        targetFile = os.path.join(folderPath, track['file'])
+        if not transcode(os.path.join(args.library, track['source']), targetFile, args):
+            print('ERROR: Transcoding {} failed'.format(track['source']))
+            return False
+        track['size'] = os.path.getsize(targetFile)
+        duration = mp3_info.getMp3Duration(targetFile)
+        track['duration'] = int(round(duration)) if duration is not None else None
+        print('Created {}/{} - {}'.format(folderName, track['file'], track['title']))
+        return True
+
+    results = pool.map(transcodeTrack, transcodes, chunksize=1)
+    failed = set(track['file'] for track, ok in zip(transcodes, results) if not ok)
+    failedTracks.extend(failed)
+
+    return {
+        'source': folderMapping['source'],
+        'mode': folderMapping['mode'],
+        'tracks': [ track for track in tracks if track['file'] not in failed ],
+        'cards': getCards(folder, folderMapping, tracks) if tracks else []
+    }
+
+
+def removeFolder(folderName, oldFolder, args):
+    """Removes the tracks of a folder which isn't mapped anymore (other files are left untouched)"""
+    folderPath = os.path.join(args.output, folderName)
+    print('Folder {}: Not mapped anymore -> removing {} tracks'.format(folderName, len(oldFolder.get('tracks', []))))
+    if args.dry_run or not os.path.isdir(folderPath):
+        return
+    for track in oldFolder.get('tracks', []):
+        trackFile = os.path.join(folderPath, track['file'])
+        if os.path.isfile(trackFile):
+            os.remove(trackFile)
+    if not os.listdir(folderPath):
+        os.rmdir(folderPath)
+
+
+if __name__ == '__main__':
+    argFormatter = lambda prog: argparse.RawDescriptionHelpFormatter(prog, max_help_position=30, width=100)
+    argparser = text_to_speech.PatchedArgumentParser(
+        description=
+            'Builds the content of a TonUINO SD card from a music library and a mapping file.\n\n' +
+            'Each line of the mapping file maps a SD card folder to a directory (or file) of the library:\n\n' +
+            '    # folder | source (relative to the library) | mode (optional, default: album)\n' +
+            '    01 | Kinderlieder/Best of | party\n' +
+            '    02 | Hoerbuecher/Der kleine Drache | hoerbuch\n\n' +
+            'Modes: hoerspiel (audio-drama), album, party, einzel (single), hoerbuch (audiobook)\n\n' +
+            'Tracks are ordered by disc number, track number and path and transcoded into `NN/NNN.mp3`.\n' +
+            'The manifest written to the output directory remembers what was built, so re-runs only transcode\n' +
+            'new or changed tracks. It also lists the cards to create for each folder.',
+        usage='%(prog)s -l path/to/library -m mapping.txt -o path/to/sd-card [optional arguments...]',
+        formatter_class=argFormatter)
+    argparser.add_argument('-l', '--library', type=str, required=True, help='The root directory of the music library')
+    argparser.add_argument('-m', '--mapping', type=str, required=True, help='The mapping file')
+    argparser.add_argument('-o', '--output', type=str, required=True, help='The root directory of the SD card content (will be created if not existing)')
+    argparser.add_argument('--manifest', type=str, default=None, help='The manifest file. (default: `tonuino_sd.json` in the output directory)')
+    argparser.add_argument('--bitrate', type=str, default='128k', help='The (constant) bitrate to transcode to. (default: 128k)')
+    argparser.add_argument('--sample-rate', type=int, default=44100, help='The sample rate to transcode to. (default: 44100)')
+    argparser.add_argument('--channels', type=int, choices=[1, 2], default=2, help='The number of channels to transcode to. (default: 2)')
+    argparser.add_argument('--firmware-manifest', type=str, default=None, help='Also write the header for `-D SD_MANIFEST` (see create_sd_manifest.py), e.g. `include/SdManifestData.hpp`')
+    argparser.add_argument('-j', '--jobs', type=int, default=multiprocessing.cpu_count(), help='The number of tracks to transcode in parallel. (default: number of CPUs)')
+    argparser.add_argument('--dry-run', action='store_true', help='Dry run: Only prints what the script would do, without actually creating files')
+    args = argparser.parse_args()
+
+    if not os.path.isdir(args.library):
+        fail('Library is no directory: ' + os.path.abspath(args.library))
+    if not os.path.isdir(args.output):
+        if os.path.exists(args.output):
+            fail('Output is no directory: ' + os.path.abspath(args.output))
+        if not args.dry_run:
+            os.makedirs(args.output)
+
+    manifestFile = args.manifest if args.manifest is not None else os.path.join(args.output, 'tonuino_sd.json')
+    mapping = readMapping(args.mapping)
+    manifest = loadManifest(manifestFile)
+    oldFolders = manifest['folders']
+
+    pool = multiprocessing.pool.ThreadPool(max(args.jobs, 1))
+    try:
+        newFolders = {}
+        for folder in sorted(mapping):
+            folderName = '{:0>2}'.format(folder)
+            newFolders[folderName] = buildFolder(folder, mapping[folder], oldFolders.get(folderName), args, pool)
+        for folderName in sorted(oldFolders):
+            if int(folderName) not in mapping:
+                removeFolder(folderName, oldFolders[folderName], args)
+    finally:
+        pool.terminate()
+
+    if args.dry_run:
+        sys.exit(0)
+
+    manifest = { 'version': manifestVersion, 'folders': newFolders }
+    writeManifest(manifest, manifestFile)
+    print('Written {}'.format(manifestFile))
+
+    if args.firmware_manifest is not None:
+        durations = [[] for i in range(99)]
+        for folderName, folder in newFolders.items():
+            durations[int(folderName) - 1] = [ min(track.get('duration') or 0, 0xFFFF) for track in folder['tracks'] ]
+        create_sd_manifest.writeHeader(durations, True, args.firmware_manifest)
+
+    if failedTracks:
+        fail('{} tracks could not be transcoded'.format(len(failedTracks)))
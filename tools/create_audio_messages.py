@@ -3,7 +3,7 @@
 # Creates the audio messages needed by TonUINO.
 
 
-import argparse, os, re, shutil, sys, text_to_speech
+import argparse, multiprocessing.pool, os, re, shutil, sys, threading, time, text_to_speech
 
 
 if __name__ == '__main__':
@@ -11,14 +11,17 @@ if __name__ == '__main__':
     argparser = text_to_speech.PatchedArgumentParser(
         description=
             'Creates the audio messages needed by TonUINO.\n\n' +
-            text_to_speech.textToSpeechDescription,
+            text_to_speech.textToSpeechDescription + '\n\n' +
+            'Generated messages are cached (see `--cache-dir`), so only new or changed messages are synthesized.',
         usage='%(prog)s [optional arguments...]',
         formatter_class=argFormatter)
     argparser.add_argument('-i', '--input', type=str, default='.', help='The directory where `audio_messages_*.txt` files are located. (default: current directory)')
     argparser.add_argument('-o', '--output', type=str, default='sd-card', help='The directory where to create the audio messages. (default: `sd-card`)')
     text_to_speech.addArgumentsToArgparser(argparser)
     argparser.add_argument('--skip-numbers', action='store_true', help='If set, no number messages will be generated (`0001.mp3` - `0255.mp3`)')
-    argparser.add_argument('--only-new', action='store_true', help='If set, only new messages will be created.')
+    argparser.add_argument('--only-new', action='store_true', help='If set, only messages whose file doesn\'t exist yet will be created.')
+    argparser.add_argument('-j', '--jobs', type=int, default=multiprocessing.cpu_count(), help='The number of messages to generate in parallel. (default: number of CPUs)')
+    argparser.add_argument('--benchmark', action='store_true', help='If set, the throughput (messages per second) is reported at the end.')
     args = argparser.parse_args()
 
 
@@ -38,12 +41,13 @@ if __name__ == '__main__':
         os.mkdir(targetDir + '/mp3')
 
 
+    # Collect all messages as (text, target file, copies of the target file)
+    messages = []
     if not args.skip_numbers:
         for i in range(1,256):
             targetFile1 = '{}/mp3/{:0>4}.mp3'.format(targetDir, i)
             targetFile2 = '{}/advert/{:0>4}.mp3'.format(targetDir, i)
-            text_to_speech.textToSpeechUsingArgs(text='{}'.format(i), targetFile=targetFile1, args=args)
-            shutil.copy(targetFile1, targetFile2)
+            messages.append(('{}'.format(i), targetFile1, [ targetFile2 ]))
 
     with open(audioMessagesFile) as f:
         lineRe = re.compile('^([^|]+)\\|(.*)$')
@@ -54,4 +58,30 @@ if __name__ == '__main__':
                 if args.only_new and os.path.isfile(targetDir + "/" + fileName):
                     continue
                 text = match.group(2)
-                text_to_speech.textToSpeechUsingArgs(text=text, targetFile=targetDir + "/" + fileName, args=args)
+                messages.append((text, targetDir + "/" + fileName, []))
+
+
+    synthesizedCount = [ 0 ]
+    countLock = threading.Lock()
+
+    def createMessage(message):
+        text, targetFile, copies = message
+        if text_to_speech.textToSpeechUsingArgs(text=text, targetFile=targetFile, args=args):
+            with countLock:
+                synthesizedCount[0] += 1
+        for copy in copies:
+            if not text_to_speech.filesAreEqual(targetFile, copy):
+                shutil.copy(targetFile, copy)
+
+    startTime = time.time()
+    pool = multiprocessing.pool.ThreadPool(max(args.jobs, 1))
+    try:
+        # `map_async` + `get` with timeout keeps Ctrl+C working
+        pool.map_async(createMessage, messages, chunksize=1).get(86400)
+    finally:
+        pool.terminate()
+    duration = time.time() - startTime
+
+    print('\n{} messages, {} synthesized, {} taken from cache'.format(len(messages), synthesizedCount[0], len(messages) - synthesizedCount[0]))
+    if args.benchmark:
+        print('Benchmark: {:.1f} s, {:.1f} messages/s using {} jobs'.format(duration, len(messages) / max(duration, 0.001), args.jobs))
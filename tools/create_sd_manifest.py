@@ -0,0 +1,133 @@
+#!/usr/bin/python
+
+# Creates a manifest of the SD card content (track counts and durations per folder),
+# so the firmware doesn't have to ask the DFPlayer.
+
+
+import argparse, os, re, struct, sys, mp3_info, text_to_speech
+
+
+trackFileRe = re.compile('^(\\d{3}).*\\.(mp3|wav)$', re.I)
+folderRe = re.compile('^\\d{2}$')
+
+manifestMagic = b'TNM1'
+
+
+def fail(msg):
+    print('ERROR: ' + msg)
+    sys.exit(1)
+
+
+def scanSdCard(sdCardDir, withDurations):
+    """Returns a list of 99 lists (one per folder 01 - 99) holding the track durations in seconds"""
+    folders = [[] for i in range(99)]
+    for folderName in sorted(os.listdir(sdCardDir)):
+        folderPath = os.path.join(sdCardDir, folderName)
+        if not folderRe.match(folderName) or not os.path.isdir(folderPath) or int(folderName) == 0:
+            continue
+
+        trackFiles = sorted(name for name in os.listdir(folderPath) if trackFileRe.match(name) and not name.startswith('._'))
+        if len(trackFiles) > 255:
+            print('WARNING: Folder {} has {} tracks, only 255 are supported'.format(folderName, len(trackFiles)))
+            trackFiles = trackFiles[:255]
+
+        durations = []
+        for index, trackFile in enumerate(trackFiles):
+            if int(trackFileRe.match(trackFile).group(1)) != index + 1:
+                print('WARNING: Track numbering has gaps in folder {} at {}'.format(folderName, trackFile))
+            duration = None
+            if withDurations and trackFile.lower().endswith('.mp3'):
+                duration = mp3_info.getMp3Duration(os.path.join(folderPath, trackFile))
+                if duration is None:
+                    print('WARNING: Can\'t determine duration of {}'.format(os.path.join(folderPath, trackFile)))
+            durations.append(min(int(round(duration)), 0xFFFF) if duration is not None else 0)
+
+        folders[int(folderName) - 1] = durations
+        print('Folder {}: {} tracks'.format(folderName, len(durations)))
+    return folders
+
+
+def writeBinaryManifest(folders, withDurations, outputFile):
+    """
+    Layout (little endian):
+      4 bytes   magic `TNM1`
+      1 byte    flags (bit 0: durations included)
+      99 bytes  track count of folder 01 - 99
+      2 bytes   duration in seconds per track (folder by folder), if included
+    """
+    data = bytearray(manifestMagic)
+    data.append(1 if withDurations else 0)
+    data.extend(len(durations) for durations in folders)
+    if withDurations:
+        for durations in folders:
+            for duration in durations:
+                data.extend(struct.pack('<H', duration))
+    with open(outputFile, 'wb') as f:
+        f.write(data)
+    print('Written {} ({} bytes)'.format(outputFile, len(data)))
+
+
+def writeHeader(folders, withDurations, outputFile):
+    lines = [
+        '#pragma once',
+        '',
+        '// Generated by tools/create_sd_manifest.py - do not edit!',
+        '',
+        'static const uint8_t sdManifestTrackCounts[99] PROGMEM = {',
+        '    ' + ', '.join(str(len(durations)) for durations in folders),
+        '};',
+    ]
+    if withDurations:
+        firstIndex = 0
+        firstIndices = []
+        for durations in folders:
+            firstIndices.append(firstIndex)
+            firstIndex += len(durations)
+        allDurations = [duration for durations in folders for duration in durations]
+        lines += [
+            '',
+            '#define SD_MANIFEST_DURATIONS',
+            '',
+            '// index of the first track of each folder in sdManifestDurations',
+            'static const uint16_t sdManifestFirstTrack[99] PROGMEM = {',
+            '    ' + ', '.join(str(index) for index in firstIndices),
+            '};',
+            '',
+            '// track durations in seconds',
+            'static const uint16_t sdManifestDurations[{}] PROGMEM = {{'.format(max(len(allDurations), 1)),
+        ]
+        for i in range(0, len(allDurations), 16):
+            lines.append('    ' + ', '.join(str(duration) for duration in allDurations[i:i + 16]) + ',')
+        if not allDurations:
+            lines.append('    0')
+        lines.append('};')
+
+    with open(outputFile, 'w') as f:
+        f.write('\n'.join(lines) + '\n')
+    print('Written {}'.format(outputFile))
+
+
+if __name__ == '__main__':
+    argFormatter = lambda prog: argparse.RawDescriptionHelpFormatter(prog, max_help_position=30, width=100)
+    argparser = text_to_speech.PatchedArgumentParser(
+        description=
+            'Creates a manifest of the SD card content (track count and track durations of the folders 01 - 99).\n\n' +
+            'The generated header is compiled into the firmware (PROGMEM) when building with `-D SD_MANIFEST`.\n' +
+            'The firmware then knows the track counts without asking the DFPlayer. Re-run this tool (and flash\n' +
+            'again) whenever the content of the SD card changes!',
+        usage='%(prog)s -i path/to/sd-card [optional arguments...]',
+        formatter_class=argFormatter)
+    argparser.add_argument('-i', '--input', type=str, required=True, help='The root directory of the SD card (containing the folders `01` - `99`)')
+    argparser.add_argument('-o', '--output', type=str, default='include/SdManifestData.hpp', help='The header to generate. (default: `include/SdManifestData.hpp`)')
+    argparser.add_argument('--binary', type=str, default=None, help='Additionally write the manifest as compact binary file')
+    argparser.add_argument('--skip-durations', action='store_true', help='If set, only the track counts are included (saves flash memory)')
+    args = argparser.parse_args()
+
+    if not os.path.isdir(args.input):
+        fail('Input is no directory: ' + os.path.abspath(args.input))
+
+    withDurations = not args.skip_durations
+    folders = scanSdCard(args.input, withDurations)
+    writeHeader(folders, withDurations, args.output)
+    if args.binary is not None:
+        writeBinaryManifest(folders, withDurations, args.binary)
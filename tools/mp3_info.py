@@ -0,0 +1,103 @@
+#!/usr/bin/python
+
+# Determines the duration of mp3 files without any external tools.
+
+
+import argparse, os, struct, sys
+
+
+bitratesKbps = {
+    # (mpeg1, layer): bitrates by index
+    (True, 1): [0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448],
+    (True, 2): [0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384],
+    (True, 3): [0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320],
+    (False, 1): [0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256],
+    (False, 2): [0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160],
+    (False, 3): [0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160],
+}
+sampleRatesByVersion = {
+    3: [44100, 48000, 32000],  # MPEG 1
+    2: [22050, 24000, 16000],  # MPEG 2
+    0: [11025, 12000, 8000],   # MPEG 2.5
+}
+
+
+def parseFrameHeader(data, pos):
+    """Returns (frameLength, samplesPerFrame, sampleRate, mpeg1, mono) or None"""
+    if pos + 4 > len(data) or data[pos] != 0xFF or (data[pos + 1] & 0xE0) != 0xE0:
+        return None
+
+    version = (data[pos + 1] >> 3) & 0x03
+    layer = 4 - ((data[pos + 1] >> 1) & 0x03)
+    bitrateIndex = data[pos + 2] >> 4
+    sampleRateIndex = (data[pos + 2] >> 2) & 0x03
+    padding = (data[pos + 2] >> 1) & 0x01
+    mono = (data[pos + 3] >> 6) == 3
+    if version == 1 or layer == 4 or bitrateIndex in (0, 15) or sampleRateIndex == 3:
+        return None
+
+    mpeg1 = version == 3
+    bitrate = bitratesKbps[(mpeg1, layer)][bitrateIndex] * 1000
+    sampleRate = sampleRatesByVersion[version][sampleRateIndex]
+    if layer == 1:
+        return ((12 * bitrate // sampleRate + padding) * 4, 384, sampleRate, mpeg1, mono)
+    samplesPerFrame = 1152 if layer == 2 or mpeg1 else 576
+    return (samplesPerFrame // 8 * bitrate // sampleRate + padding, samplesPerFrame, sampleRate, mpeg1, mono)
+
+
+def skipId3v2(data):
+    if len(data) >= 10 and data[0:3] == b'ID3':
+        size = (data[6] << 21) | (data[7] << 14) | (data[8] << 7) | data[9]
+        footer = 10 if data[5] & 0x10 else 0
+        return 10 + size + footer
+    return 0
+
+
+def getMp3Duration(mp3File):
+    """Returns the duration of an mp3 file in seconds (float) or None if it isn't a valid mp3 file"""
+    with open(mp3File, 'rb') as f:
+        data = bytearray(f.read())
+
+    pos = skipId3v2(data)
+    # Sync to the first frame which is followed by another one
+    while pos < len(data):
+        header = parseFrameHeader(data, pos)
+        if header is not None and (pos + header[0] == len(data) or parseFrameHeader(data, pos + header[0]) is not None):
+            break
+        pos += 1
+    else:
+        return None
+
+    frameLength, samplesPerFrame, sampleRate, mpeg1, mono = header
+
+    # VBR files carry the number of frames in a Xing/Info or VBRI header
+    sideInfoLength = (17 if mono else 32) if mpeg1 else (9 if mono else 17)
+    xingPos = pos + 4 + sideInfoLength
+    if data[xingPos:xingPos + 4] in (b'Xing', b'Info'):
+        flags = struct.unpack('>I', bytes(data[xingPos + 4:xingPos + 8]))[0]
+        if flags & 0x01:
+            frames = struct.unpack('>I', bytes(data[xingPos + 8:xingPos + 12]))[0]
+            return float(frames * samplesPerFrame) / sampleRate
+    if data[pos + 36:pos + 40] == b'VBRI':
+        frames = struct.unpack('>I', bytes(data[pos + 50:pos + 54]))[0]
+        return float(frames * samplesPerFrame) / sampleRate
+
+    # Otherwise count the frames
+    samples = 0
+    while True:
+        header = parseFrameHeader(data, pos)
+        if header is None:
+            break
+        samples += header[1]
+        pos += header[0]
+    return float(samples) / sampleRate
+
+
+if __name__ == '__main__':
+    argparser = argparse.ArgumentParser(description='Prints the duration of mp3 files.')
+    argparser.add_argument('files', nargs='+', help='The mp3 files')
+    args = argparser.parse_args()
+
+    for mp3File in args.files:
+        duration = getMp3Duration(mp3File)
+        print('{}: {}'.format(mp3File, 'invalid' if duration is None else '{:.2f} s'.format(duration)))
@@ -0,0 +1,178 @@
+#!/usr/bin/python
+
+# Converts the voice prompts of the SD card (`mp3/` and `advert/`) into small mono CBR mp3 files without
+# tags and trims the silence at their start and end. The DFPlayer starts such files sooner and the menus
+# don't wait for silence. Reports the size and the playback time saved, also for a walk through the whole
+# admin menu.
+
+
+import argparse, hashlib, multiprocessing, multiprocessing.pool, os, re, shutil, subprocess, sys, mp3_info
+
+
+promptFolders = [ 'mp3', 'advert' ]
+promptFileRe = re.compile('^(\\d{4}).*\\.mp3$', re.I)
+
+# The prompts of a walk through the whole admin menu with every option announced once (see `adminMenu()`,
+# `setupFolder()` and `voiceMenu()` in main.cpp): the menu, its submenus and options, configuring a card
+# and the numbers 1 - 30 of the volume menus.
+adminMenuWalk = (list(range(1, 31)) + [ 300, 301 ] + list(range(310, 323)) + list(range(330, 333)) + [ 400, 401, 800, 802 ] +
+    list(range(900, 914)) + list(range(920, 927)) + list(range(930, 938)) + list(range(940, 945)) + list(range(960, 966)) +
+    list(range(970, 977)) + list(range(980, 985)) + list(range(991, 995)) + [ 999 ])
+
+
+def fail(msg):
+    print('ERROR: ' + msg)
+    sys.exit(1)
+
+
+def findPrompts(sdCardDir):
+    """Returns the prompt files as (folder, file name, number)"""
+    prompts = []
+    for folder in promptFolders:
+        folderPath = os.path.join(sdCardDir, folder)
+        if not os.path.isdir(folderPath):
+            continue
+        for fileName in sorted(os.listdir(folderPath)):
+            match = promptFileRe.match(fileName)
+            if match:
+                prompts.append((folder, fileName, int(match.group(1))))
+    return prompts
+
+
+def isOptimized(promptFile, args):
+    """True if the file has no ID3v2 tag or Xing/Info frame and already is in the target format"""
+    with open(promptFile, 'rb') as f:
+        data = bytearray(f.read(1024))
+    if mp3_info.skipId3v2(data) != 0:
+        return False
+    header = mp3_info.parseFrameHeader(data, 0)
+    if header is None:
+        return False
+    frameLength, samplesPerFrame, sampleRate, mpeg1, mono = header
+    sideInfoLength = (17 if mono else 32) if mpeg1 else (9 if mono else 17)
+    if data[4 + sideInfoLength:8 + sideInfoLength] in (b'Xing', b'Info'):
+        return False
+    layer = 4 - ((data[1] >> 1) & 0x03)
+    bitrate = mp3_info.bitratesKbps[(mpeg1, layer)][data[2] >> 4]
+    return mono == (args.channels == 1) and sampleRate == args.sample_rate and bitrate == int(args.bitrate[:-1])
+
+
+def fileDigest(path):
+    with open(path, 'rb') as f:
+        return hashlib.sha1(f.read()).hexdigest()
+
+
+def convert(sourceFile, args):
+    """
+    Converts into CBR mp3 without tags, the silence at both ends is cut down to `--keep-silence`. No Xing
+    header either: in a CBR file it's only an extra silent frame for the DFPlayer. Returns the converted
+    temp file or None.
+    """
+    trim = 'silenceremove=start_periods=1:start_threshold=-{}dB:start_silence={}'.format(args.silence_db, args.keep_silence)
+    tempFile = sourceFile + '.tmp.mp3'
+    command = [ 'ffmpeg', '-loglevel', 'error', '-y', '-i', sourceFile, '-map', '0:a:0', '-map_metadata', '-1',
+        '-af', ','.join([ trim, 'areverse', trim, 'areverse' ]),
+        '-codec:a', 'libmp3lame', '-b:a', args.bitrate, '-ar', str(args.sample_rate), '-ac', str(args.channels),
+        '-id3v2_version', '0', '-write_id3v1', '0', '-write_xing', '0', tempFile ]
+    if subprocess.call(command) != 0 or not os.path.isfile(tempFile):
+        if os.path.exists(tempFile):
+            os.remove(tempFile)
+        return None
+    return tempFile
+
+
+def formatSize(size):
+    return '{:.1f} MB'.format(size / 1024.0 / 1024.0)
+
+
+def formatSeconds(seconds):
+    return '{:.1f} s'.format(seconds)
+
+
+def formatChange(before, after, formatter):
+    saved = before - after
+    percent = 100.0 * saved / before if before else 0
+    return '{} -> {} (saved {}, {:.0f}%)'.format(formatter(before), formatter(after), formatter(saved), percent)
+
+
+if __name__ == '__main__':
+    argFormatter = lambda prog: argparse.RawDescriptionHelpFormatter(prog, max_help_position=30, width=100)
+    argparser = argparse.ArgumentParser(
+        description=
+            'Converts the voice prompts of the SD card (`mp3/` and `advert/`) into small mono CBR mp3 files\n' +
+            'without tags and trims the silence at their start and end. Files already in the target format are\n' +
+            'skipped, identical prompts (like the numbers in both folders) are converted only once.',
+        formatter_class=argFormatter)
+    argparser.add_argument('-o', '--output', type=str, default='sd-card', help='The directory holding `mp3/` and `advert/`. (default: `sd-card`)')
+    argparser.add_argument('--bitrate', type=str, default='32k', help='The (constant) bitrate to convert to. (default: 32k)')
+    argparser.add_argument('--sample-rate', type=int, default=22050, help='The sample rate to convert to. (default: 22050)')
+    argparser.add_argument('--channels', type=int, choices=[1, 2], default=1, help='The number of channels to convert to. (default: 1)')
+    argparser.add_argument('--silence-db', type=int, default=50, help='Audio below -N dB counts as silence. (default: 50)')
+    argparser.add_argument('--keep-silence', type=float, default=0.05, help='Seconds of silence kept at both ends. (default: 0.05)')
+    argparser.add_argument('-j', '--jobs', type=int, default=multiprocessing.cpu_count(), help='The number of prompts to convert in parallel. (default: number of CPUs)')
+    argparser.add_argument('--dry-run', action='store_true', help='Dry run: Only reports the prompts which would be converted, without changing files')
+    args = argparser.parse_args()
+
+    if not re.match('^\\d+k$', args.bitrate):
+        fail('The bitrate has to be given in kbps, like `32k`')
+    prompts = findPrompts(args.output)
+    if not prompts:
+        fail('No prompts found in ' + os.path.abspath(args.output))
+
+    # Per file: size and duration before and after
+    stats = {}
+    for folder, fileName, number in prompts:
+        path = os.path.join(args.output, folder, fileName)
+        size = os.path.getsize(path)
+        duration = mp3_info.getMp3Duration(path) or 0
+        stats[path] = { 'folder': folder, 'number': number, 'sizeBefore': size, 'sizeAfter': size,
+            'durationBefore': duration, 'durationAfter': duration }
+
+    # Identical prompts are converted once and copied
+    pending = [ path for path in sorted(stats) if not isOptimized(path, args) ]
+    copiesByDigest = {}
+    for path in pending:
+        copiesByDigest.setdefault(fileDigest(path), []).append(path)
+    groups = sorted(copiesByDigest.values())
+
+    print('{} prompts, {} to convert ({} different)'.format(len(stats), len(pending), len(groups)))
+    if args.dry_run:
+        for paths in groups:
+            print('Would convert {}{}'.format(paths[0], ' (+{} copies)'.format(len(paths) - 1) if len(paths) > 1 else ''))
+
+    failed = []
+
+    def convertGroup(paths):
+        tempFile = convert(paths[0], args)
+        if not tempFile:
+            failed.extend(paths)
+            return
+        size = os.path.getsize(tempFile)
+        duration = mp3_info.getMp3Duration(tempFile) or 0
+        for path in paths[1:]:
+            shutil.copyfile(tempFile, path)
+        # Replacing the first file last, an interrupted run converts the group again
+        if os.path.exists(paths[0]):
+            os.remove(paths[0])
+        os.rename(tempFile, paths[0])
+        for path in paths:
+            stats[path]['sizeAfter'] = size
+            stats[path]['durationAfter'] = duration
+        print('Converted {}{}'.format(paths[0], ' (+{} copies)'.format(len(paths) - 1) if len(paths) > 1 else ''))
+
+    if not args.dry_run and groups:
+        pool = multiprocessing.pool.ThreadPool(max(args.jobs, 1))
+        try:
+            # `map_async` + `get` with timeout keeps Ctrl+C working
+            pool.map_async(convertGroup, groups, chunksize=1).get(86400)
+        finally:
+            pool.terminate()
+
+    walk = [ stat for stat in stats.values() if stat['folder'] == 'mp3' and stat['number'] in adminMenuWalk ]
+    print('')
+    print('Size:                 ' + formatChange(sum(stat['sizeBefore'] for stat in stats.values()), sum(stat['sizeAfter'] for stat in stats.values()), formatSize))
+    print('Playback time:        ' + formatChange(sum(stat['durationBefore'] for stat in stats.values()), sum(stat['durationAfter'] for stat in stats.values()), formatSeconds))
+    print('Admin menu walk ({}): '.format(len(walk)) + formatChange(sum(stat['durationBefore'] for stat in walk), sum(stat['durationAfter'] for stat in walk), formatSeconds))
+
+    if failed:
+        fail('{} prompts could not be converted'.format(len(failed)))
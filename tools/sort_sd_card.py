@@ -0,0 +1,636 @@
+#!/usr/bin/python
+
+# Sorts the directory entries of a TonUINO SD card (FAT12/16/32), removes deleted entries and junk
+# files (like macOS `._*` files) and reports how many directory entries the DFPlayer has to scan.
+#
+# The DFPlayer Mini doesn't sort: It walks the FAT directory entries in on-disk order, both when
+# looking up a track and when counting the tracks of a folder. Files copied in the "wrong" order
+# play out of order, and every deleted or junk entry makes each lookup slower.
+
+
+import argparse, io, os, re, shutil, struct, sys, time, text_to_speech
+
+
+junkNames = set(name.lower() for name in [ '.DS_Store', '.Trashes', '.Spotlight-V100', '.fseventsd', '.TemporaryItems',
+    '.apdisk', '.VolumeIcon.icns', '.metadata_never_index', 'Thumbs.db', 'desktop.ini' ])
+
+fatPartitionTypes = [ 0x01, 0x04, 0x06, 0x0b, 0x0c, 0x0e ]
+
+ATTR_READ_ONLY = 0x01
+ATTR_VOLUME_ID = 0x08
+ATTR_DIRECTORY = 0x10
+ATTR_ARCHIVE = 0x20
+ATTR_LONG_NAME = 0x0f
+
+SLOT_SIZE = 32
+SLOT_END = 0x00
+SLOT_DELETED = 0xe5
+
+shortNameChars = re.compile('^[A-Z0-9$%\'\\-_@~`!(){}^#&]*$')
+
+
+def fail(msg):
+    print('ERROR: ' + msg)
+    sys.exit(1)
+
+
+def isJunk(name):
+    return name.startswith('._') or name.lower() in junkNames
+
+
+def sortKey(name):
+    return name.upper()
+
+
+def lfnChecksum(shortName):
+    checksum = 0
+    for b in bytearray(shortName):
+        checksum = (((checksum & 1) << 7) + (checksum >> 1) + b) & 0xff
+    return checksum
+
+
+class DirEntry:
+    """A directory entry: the long file name slots (if any) followed by the short name slot"""
+
+    def __init__(self, slots, position):
+        self.slots = slots
+        self.position = position    # number of slots to scan (from the start of the directory) to find this entry
+        sfn = slots[-1]
+        self.shortName = bytes(sfn[0:11])
+        self.attr = sfn[11]
+        self.firstCluster = (struct.unpack_from('<H', sfn, 20)[0] << 16) | struct.unpack_from('<H', sfn, 26)[0]
+        self.size = struct.unpack_from('<I', sfn, 28)[0]
+        self.name = self.getLongName() or self.getShortName(sfn[12])
+
+    def getShortName(self, ntFlags):
+        base = self.shortName[0:8].decode('cp437').rstrip()
+        ext = self.shortName[8:11].decode('cp437').rstrip()
+        if ntFlags & 0x08:
+            base = base.lower()
+        if ntFlags & 0x10:
+            ext = ext.lower()
+        return base + '.' + ext if ext and not self.isVolumeLabel() else base + ext
+
+    def getLongName(self):
+        if len(self.slots) == 1:
+            return None
+        data = bytearray()
+        for slot in reversed(self.slots[:-1]):
+            data += slot[1:11] + slot[14:26] + slot[28:32]
+        name = data.decode('utf-16-le', 'replace')
+        end = name.find(u'\x00')
+        return name[:end] if end >= 0 else name.rstrip(u'\uffff')
+
+    def isDirectory(self):
+        return (self.attr & ATTR_DIRECTORY) != 0
+
+    def isVolumeLabel(self):
+        return (self.attr & ATTR_VOLUME_ID) != 0
+
+    def isDotEntry(self):
+        return self.shortName in (b'.          ', b'..         ')
+
+    def data(self):
+        return b''.join(bytes(slot) for slot in self.slots)
+
+
+class Directory:
+    """The parsed content of a directory, including the statistics needed for verification"""
+
+    def __init__(self, path, firstCluster):
+        self.path = path
+        self.firstCluster = firstCluster    # 0 for the fixed root directory of FAT12/16
+        self.entries = []
+        self.slotCount = 0
+        self.deletedSlots = 0
+        self.orphanSlots = 0
+
+    def subDirectories(self):
+        return [ entry for entry in self.entries if entry.isDirectory() and not entry.isDotEntry() and not entry.isVolumeLabel() ]
+
+    def sortableEntries(self):
+        return [ entry for entry in self.entries if not entry.isDotEntry() and not entry.isVolumeLabel() ]
+
+    def isSorted(self):
+        names = [ sortKey(entry.name) for entry in self.sortableEntries() ]
+        return names == sorted(names)
+
+    def junkEntries(self):
+        return [ entry for entry in self.sortableEntries() if isJunk(entry.name) ]
+
+
+class FatVolume:
+    """A FAT12/16/32 file system in an image file or on a block device (with or without partition table)"""
+
+    def __init__(self, imageFile, readOnly=False):
+        self.readOnly = readOnly
+        self.file = io.open(imageFile, 'rb' if readOnly else 'r+b')
+        self.offset = self.findFileSystem()
+
+        bootSector = self.read(0, 512)
+        (self.bytesPerSector, self.sectorsPerCluster, self.reservedSectors, self.numFats, self.rootEntryCount,
+            totalSectors16, media, fatSize16) = struct.unpack_from('<HBHBHHBH', bootSector, 11)
+        totalSectors32, fatSize32, extFlags, fsVersion, self.rootCluster, self.fsInfoSector = struct.unpack_from('<IIHHIH', bootSector, 32)
+        self.totalSectors = totalSectors16 or totalSectors32
+        self.fatSize = fatSize16 or fatSize32
+        self.clusterSize = self.bytesPerSector * self.sectorsPerCluster
+
+        rootDirSectors = (self.rootEntryCount * SLOT_SIZE + self.bytesPerSector - 1) // self.bytesPerSector
+        self.rootDirOffset = (self.reservedSectors + self.numFats * self.fatSize) * self.bytesPerSector
+        self.firstDataOffset = self.rootDirOffset + rootDirSectors * self.bytesPerSector
+        self.clusterCount = (self.totalSectors - self.firstDataOffset // self.bytesPerSector) // self.sectorsPerCluster
+        if self.clusterCount < 4085:
+            self.fatBits = 12
+        elif self.clusterCount < 65525:
+            self.fatBits = 16
+        else:
+            self.fatBits = 32
+        if self.fatBits != 32:
+            self.rootCluster = 0
+        self.endOfChain = { 12: 0xff8, 16: 0xfff8, 32: 0x0ffffff8 }[self.fatBits]
+
+        self.fat = bytearray(self.read(self.reservedSectors * self.bytesPerSector, self.fatSize * self.bytesPerSector))
+        self.fatChanged = False
+
+    def findFileSystem(self):
+        """Returns the offset of the (first) FAT file system - either at the start or in the first FAT partition"""
+        sector = bytearray(self.readAbsolute(0, 512))
+        if len(sector) < 512 or sector[510:512] != b'\x55\xaa':
+            fail('No FAT file system found (missing boot signature)')
+        bytesPerSector, sectorsPerCluster = struct.unpack_from('<HB', sector, 11)
+        if sector[0] in (0xeb, 0xe9) and bytesPerSector in (512, 1024, 2048, 4096) and sectorsPerCluster in (1, 2, 4, 8, 16, 32, 64, 128):
+            return 0
+        for i in range(4):
+            partitionType = sector[446 + i * 16 + 4]
+            startSector = struct.unpack_from('<I', sector, 446 + i * 16 + 8)[0]
+            if partitionType in fatPartitionTypes and startSector != 0:
+                return startSector * 512
+        fail('No FAT partition found')
+
+    def readAbsolute(self, offset, length):
+        self.file.seek(offset)
+        return self.file.read(length)
+
+    def read(self, offset, length):
+        return self.readAbsolute(self.offset + offset, length)
+
+    def write(self, offset, data):
+        if not self.readOnly:
+            self.file.seek(self.offset + offset)
+            self.file.write(data)
+
+    def close(self):
+        if self.fatChanged and not self.readOnly:
+            for i in range(self.numFats):
+                self.write((self.reservedSectors + i * self.fatSize) * self.bytesPerSector, bytes(self.fat))
+            self.invalidateFsInfo()
+        self.file.close()
+
+    def invalidateFsInfo(self):
+        """The free cluster count of FAT32 is only a hint - mark it as unknown instead of recalculating it"""
+        if self.fatBits != 32 or self.fsInfoSector in (0, 0xffff):
+            return
+        fsInfoOffset = self.fsInfoSector * self.bytesPerSector
+        if struct.unpack('<I', self.read(fsInfoOffset, 4))[0] == 0x41615252:
+            self.write(fsInfoOffset + 488, struct.pack('<II', 0xffffffff, 0xffffffff))
+
+    def getFatEntry(self, cluster):
+        if self.fatBits == 12:
+            value = struct.unpack_from('<H', self.fat, cluster + cluster // 2)[0]
+            return value >> 4 if cluster & 1 else value & 0xfff
+        if self.fatBits == 16:
+            return struct.unpack_from('<H', self.fat, cluster * 2)[0]
+        return struct.unpack_from('<I', self.fat, cluster * 4)[0] & 0x0fffffff
+
+    def setFatEntry(self, cluster, value):
+        self.fatChanged = True
+        if self.fatBits == 12:
+            pos = cluster + cluster // 2
+            old = struct.unpack_from('<H', self.fat, pos)[0]
+            value = (old & 0x000f) | (value << 4) if cluster & 1 else (old & 0xf000) | value
+            struct.pack_into('<H', self.fat, pos, value)
+        elif self.fatBits == 16:
+            struct.pack_into('<H', self.fat, cluster * 2, value)
+        else:
+            old = struct.unpack_from('<I', self.fat, cluster * 4)[0]
+            struct.pack_into('<I', self.fat, cluster * 4, (old & 0xf0000000) | value)
+
+    def getChain(self, firstCluster):
+        chain = []
+        cluster = firstCluster
+        while 2 <= cluster < self.endOfChain and len(chain) <= self.clusterCount:
+            chain.append(cluster)
+            cluster = self.getFatEntry(cluster)
+        return chain
+
+    def freeChain(self, firstCluster):
+        for cluster in self.getChain(firstCluster):
+            self.setFatEntry(cluster, 0)
+
+    def clusterOffset(self, cluster):
+        return self.firstDataOffset + (cluster - 2) * self.clusterSize
+
+    def getRegions(self, firstCluster):
+        """Returns the (offset, length) regions holding a directory"""
+        if firstCluster == 0:
+            return [ (self.rootDirOffset, self.rootEntryCount * SLOT_SIZE) ]
+        return [ (self.clusterOffset(cluster), self.clusterSize) for cluster in self.getChain(firstCluster) ]
+
+    def readDirectory(self, path, firstCluster):
+        directory = Directory(path, firstCluster)
+        data = bytearray(b''.join(self.read(offset, length) for offset, length in self.getRegions(firstCluster)))
+        lfnSlots = []
+        for pos in range(0, len(data) - SLOT_SIZE + 1, SLOT_SIZE):
+            slot = data[pos:pos + SLOT_SIZE]
+            directory.slotCount += 1
+            if slot[0] == SLOT_END:
+                directory.slotCount -= 1
+                break
+            if slot[0] == SLOT_DELETED:
+                directory.deletedSlots += 1
+                directory.orphanSlots += len(lfnSlots)
+                lfnSlots = []
+                continue
+            if slot[11] & 0x3f == ATTR_LONG_NAME:
+                if slot[0] & 0x40:
+                    directory.orphanSlots += len(lfnSlots)
+                    lfnSlots = []
+                lfnSlots.append(slot)
+                continue
+            if lfnSlots and (lfnSlots[0][0] & 0x1f != len(lfnSlots) or any(lfn[13] != lfnChecksum(slot[0:11]) for lfn in lfnSlots)):
+                directory.orphanSlots += len(lfnSlots)
+                lfnSlots = []
+            directory.entries.append(DirEntry(lfnSlots + [ slot ], directory.slotCount))
+            lfnSlots = []
+        directory.orphanSlots += len(lfnSlots)
+        return directory
+
+    def writeDirectory(self, directory, entries):
+        """Rewrites a directory with the given entries (in this order). Clusters not needed anymore are freed."""
+        data = b''.join(entry.data() for entry in entries)
+        if directory.firstCluster != 0:
+            chain = self.getChain(directory.firstCluster)
+            neededClusters = max(1, (len(data) + self.clusterSize - 1) // self.clusterSize)
+            if neededClusters < len(chain):
+                self.setFatEntry(chain[neededClusters - 1], 0x0fffffff & ((1 << self.fatBits) - 1))
+                for cluster in chain[neededClusters:]:
+                    self.setFatEntry(cluster, 0)
+        pos = 0
+        for offset, length in self.getRegions(directory.firstCluster):
+            chunk = data[pos:pos + length]
+            self.write(offset, chunk + b'\x00' * (length - len(chunk)))
+            pos += length
+
+    def freeEntry(self, path, entry):
+        """Frees the clusters of a file or (recursively) of a directory"""
+        if entry.isDirectory() and entry.firstCluster != 0:
+            for child in self.readDirectory(path, entry.firstCluster).entries:
+                if not child.isDotEntry():
+                    self.freeEntry(path + '/' + child.name, child)
+        if entry.firstCluster != 0:
+            self.freeChain(entry.firstCluster)
+
+
+def sortVolume(volume, directory=None):
+    """Sorts and compacts all directories recursively and removes junk. Returns the number of removed junk entries."""
+    if directory is None:
+        directory = volume.readDirectory('', volume.rootCluster)
+
+    removed = 0
+    kept = []
+    for entry in directory.entries:
+        if not entry.isDotEntry() and not entry.isVolumeLabel() and isJunk(entry.name):
+            print('Removing {}/{}'.format(directory.path, entry.name))
+            volume.freeEntry(directory.path + '/' + entry.name, entry)
+            removed += 1
+        else:
+            kept.append(entry)
+
+    dotEntries = [ entry for entry in kept if entry.isDotEntry() ]
+    labels = [ entry for entry in kept if entry.isVolumeLabel() and not entry.isDotEntry() ]
+    others = sorted((entry for entry in kept if entry not in dotEntries and entry not in labels), key=lambda entry: sortKey(entry.name))
+    volume.writeDirectory(directory, dotEntries + labels + others)
+
+    for entry in others:
+        if entry.isDirectory() and entry.firstCluster != 0:
+            removed += sortVolume(volume, volume.readDirectory(directory.path + '/' + entry.name, entry.firstCluster))
+    return removed
+
+
+def verifyVolume(volume):
+    """
+    Prints for the root directory and each folder how many directory entries (32 byte slots) the DFPlayer
+    has to scan per lookup. Returns the number of directories needing a sort.
+    """
+    root = volume.readDirectory('', volume.rootCluster)
+    directories = [ root ] + [ volume.readDirectory('/' + entry.name, entry.firstCluster) for entry in root.subDirectories() if entry.firstCluster != 0 ]
+
+    problems = 0
+    lookups = []
+    for directory in directories:
+        entries = directory.sortableEntries()
+        scanned = [ entry.position for entry in entries ]
+        lookups += scanned
+        junk = directory.junkEntries()
+        issues = []
+        if not directory.isSorted():
+            issues.append('not sorted')
+        if directory.deletedSlots or directory.orphanSlots:
+            issues.append('{} deleted slots'.format(directory.deletedSlots + directory.orphanSlots))
+        if junk:
+            issues.append('{} junk entries'.format(len(junk)))
+        if issues:
+            problems += 1
+        print('{:<10} {:>4} entries in {:>4} slots, scanned per lookup: avg {:>6.1f}, max {:>4}{}'.format(
+            directory.path or '/', len(entries), directory.slotCount,
+            float(sum(scanned)) / len(scanned) if scanned else 0, max(scanned) if scanned else 0,
+            ' - ' + ', '.join(issues) if issues else ''))
+
+    print('Total: {} lookups, scanned slots avg {:.1f}, max {} - {} of {} directories need sorting'.format(
+        len(lookups), float(sum(lookups)) / len(lookups) if lookups else 0, max(lookups) if lookups else 0, problems, len(directories)))
+    return problems
+
+
+class FatImageBuilder:
+    """Builds a FAT32 image from a directory tree: all directories sorted, files stored contiguously"""
+
+    bytesPerSector = 512
+    reservedSectors = 32
+    numFats = 2
+
+    def __init__(self, imageFile, size, label):
+        totalSectors = size // self.bytesPerSector
+        self.sectorsPerCluster = 8 if size <= 8 << 30 else 16 if size <= 16 << 30 else 32 if size <= 32 << 30 else 64
+        while True:
+            self.fatSize = ((totalSectors - self.reservedSectors) // self.sectorsPerCluster + 2) * 4 // self.bytesPerSector + 1
+            self.clusterCount = (totalSectors - self.reservedSectors - self.numFats * self.fatSize) // self.sectorsPerCluster
+            if self.clusterCount >= 65525 or self.sectorsPerCluster == 1:
+                break
+            self.sectorsPerCluster //= 2
+        if self.clusterCount < 65525:
+            fail('Image too small for FAT32 (needs at least 33 MB)')
+
+        self.totalSectors = totalSectors
+        self.clusterSize = self.bytesPerSector * self.sectorsPerCluster
+        self.firstDataOffset = (self.reservedSectors + self.numFats * self.fatSize) * self.bytesPerSector
+        self.label = (label.upper().encode('cp437', 'replace') + b' ' * 11)[:11]
+        self.fat = bytearray(self.fatSize * self.bytesPerSector)
+        struct.pack_into('<II', self.fat, 0, 0x0ffffff8, 0x0fffffff)
+        self.nextCluster = 2
+
+        self.file = io.open(imageFile, 'w+b')
+        self.file.truncate(totalSectors * self.bytesPerSector)
+
+    def build(self, sourceDir):
+        rootCluster = self.addDirectory(sourceDir, None)
+        for i in range(self.numFats):
+            self.write((self.reservedSectors + i * self.fatSize) * self.bytesPerSector, bytes(self.fat))
+        for sector in (0, 6):
+            self.write(sector * self.bytesPerSector, self.bootSector(rootCluster))
+        for sector in (1, 7):
+            self.write(sector * self.bytesPerSector, self.fsInfoSector())
+        self.file.close()
+
+    def write(self, offset, data):
+        self.file.seek(offset)
+        self.file.write(data)
+
+    def bootSector(self, rootCluster):
+        data = bytearray(512)
+        data[0:3] = b'\xeb\x58\x90'
+        data[3:11] = b'MSWIN4.1'
+        struct.pack_into('<HBHBHHBHHHII', data, 11, self.bytesPerSector, self.sectorsPerCluster, self.reservedSectors,
+            self.numFats, 0, 0, 0xf8, 0, 63, 255, 0, self.totalSectors)
+        struct.pack_into('<IHHIHH', data, 36, self.fatSize, 0, 0, rootCluster, 1, 6)
+        struct.pack_into('<BBBI', data, 64, 0x80, 0, 0x29, int(time.time()) & 0xffffffff)
+        data[71:82] = self.label
+        data[82:90] = b'FAT32   '
+        data[510:512] = b'\x55\xaa'
+        return bytes(data)
+
+    def fsInfoSector(self):
+        data = bytearray(512)
+        struct.pack_into('<I', data, 0, 0x41615252)
+        struct.pack_into('<III', data, 484, 0x61417272, self.clusterCount + 2 - self.nextCluster, self.nextCluster)
+        struct.pack_into('<I', data, 508, 0xaa550000)
+        return bytes(data)
+
+    def allocate(self, clusters):
+        """Allocates contiguous clusters. Returns the first cluster (0 if no clusters are needed)."""
+        if clusters == 0:
+            return 0
+        first = self.nextCluster
+        if first + clusters > self.clusterCount + 2:
+            fail('Image is too small for the content')
+        for cluster in range(first, first + clusters):
+            struct.pack_into('<I', self.fat, cluster * 4, cluster + 1 if cluster < first + clusters - 1 else 0x0fffffff)
+        self.nextCluster += clusters
+        return first
+
+    def clusterOffset(self, cluster):
+        return self.firstDataOffset + (cluster - 2) * self.clusterSize
+
+    def addDirectory(self, path, parentCluster):
+        """Writes a directory and (recursively) its content. Returns the first cluster of the directory."""
+        names = sorted((name for name in os.listdir(path) if not isJunk(name)), key=sortKey)
+        shortNames = set()
+        children = []
+        for name in names:
+            shortName, ntFlags, needsLfn = makeShortName(name, shortNames)
+            children.append((name, shortName, ntFlags, needsLfn))
+
+        isRoot = parentCluster is None
+        slotCount = 1 if isRoot else 2
+        slotCount += sum(1 + (lfnSlotCount(name) if needsLfn else 0) for name, shortName, ntFlags, needsLfn in children)
+        ownCluster = self.allocate(max(1, (slotCount * SLOT_SIZE + self.clusterSize - 1) // self.clusterSize))
+
+        mtime = os.path.getmtime(path)
+        if isRoot:
+            data = makeShortEntry(self.label, ATTR_VOLUME_ID, 0, 0, 0, mtime)
+        else:
+            data = makeShortEntry(b'.          ', ATTR_DIRECTORY, 0, ownCluster, 0, mtime)
+            data += makeShortEntry(b'..         ', ATTR_DIRECTORY, 0, parentCluster or 0, 0, mtime)
+
+        for name, shortName, ntFlags, needsLfn in children:
+            childPath = os.path.join(path, name)
+            if needsLfn:
+                data += makeLfnSlots(name, shortName)
+            if os.path.isdir(childPath):
+                childCluster = self.addDirectory(childPath, ownCluster)
+                data += makeShortEntry(shortName, ATTR_DIRECTORY, ntFlags, childCluster, 0, os.path.getmtime(childPath))
+            else:
+                size = os.path.getsize(childPath)
+                childCluster = self.allocate((size + self.clusterSize - 1) // self.clusterSize)
+                self.copyFile(childPath, childCluster)
+                data += makeShortEntry(shortName, ATTR_ARCHIVE, ntFlags, childCluster, size, os.path.getmtime(childPath))
+
+        self.write(self.clusterOffset(ownCluster), data)
+        return ownCluster
+
+    def copyFile(self, sourceFile, firstCluster):
+        if firstCluster == 0:
+            return
+        self.file.seek(self.clusterOffset(firstCluster))
+        with io.open(sourceFile, 'rb') as f:
+            shutil.copyfileobj(f, self.file, 1 << 20)
+
+
+def makeShortName(name, existing):
+    """Returns (11 byte short name, NT case flags, whether a long name is needed)"""
+    base, dot, ext = name.rpartition('.')
+    if not dot or not base:
+        base, ext = name, ''
+    ntFlags = 0
+    for part, flag in ((base, 0x08), (ext, 0x10)):
+        if part.islower():
+            ntFlags |= flag
+    upperBase, upperExt = base.upper(), ext.upper()
+    if (1 <= len(base) <= 8 and len(ext) <= 3 and shortNameChars.match(upperBase) and shortNameChars.match(upperExt)
+            and (base.islower() or base == upperBase) and (ext.islower() or ext == upperExt)):
+        shortName = (upperBase.ljust(8) + upperExt.ljust(3)).encode('ascii')
+        if shortName not in existing:
+            existing.add(shortName)
+            return shortName, ntFlags, False
+
+    # Generate a unique `BASIS~N.EXT` short name
+    clean = lambda text: ''.join(c if shortNameChars.match(c) else '_' for c in text.upper().replace(' ', '').replace('.', ''))
+    basis, basisExt = clean(base) or '_', clean(ext)[:3]
+    for n in range(1, 1000000):
+        suffix = '~{}'.format(n)
+        shortName = (basis[:8 - len(suffix)] + suffix).ljust(8).encode('ascii') + basisExt.ljust(3).encode('ascii')
+        if shortName not in existing:
+            existing.add(shortName)
+            return shortName, 0, True
+    fail('Too many similar names: ' + name)
+
+
+def lfnSlotCount(name):
+    return (len(name.encode('utf-16-le')) // 2 + 12) // 13
+
+
+def makeLfnSlots(name, shortName):
+    chars = bytearray(name.encode('utf-16-le'))
+    count = lfnSlotCount(name)
+    if len(chars) < count * 26:
+        chars += b'\x00\x00'
+    chars += b'\xff' * (count * 26 - len(chars))
+    checksum = lfnChecksum(shortName)
+    data = b''
+    for seq in range(count, 0, -1):
+        part = chars[(seq - 1) * 26:seq * 26]
+        slot = bytearray(SLOT_SIZE)
+        slot[0] = seq | (0x40 if seq == count else 0)
+        slot[1:11] = part[0:10]
+        slot[11] = ATTR_LONG_NAME
+        slot[13] = checksum
+        slot[14:26] = part[10:22]
+        slot[28:32] = part[22:26]
+        data += bytes(slot)
+    return data
+
+
+def fatDateTime(timestamp):
+    t = time.localtime(max(timestamp, 315532800))
+    return ((max(t.tm_year, 1980) - 1980) << 9) | (t.tm_mon << 5) | t.tm_mday, (t.tm_hour << 11) | (t.tm_min << 5) | (t.tm_sec // 2)
+
+
+def makeShortEntry(shortName, attr, ntFlags, firstCluster, size, mtime):
+    date, time_ = fatDateTime(mtime)
+    return struct.pack('<11sBBBHHHHHHHI', shortName, attr, ntFlags, 0, time_, date, date,
+        firstCluster >> 16, time_, date, firstCluster & 0xffff, size)
+
+
+def sortMountedDirectory(path):
+    """
+    Rebuilds a directory of a mounted card in sorted order: All entries are moved into a fresh directory
+    (so they are appended in this order), which then replaces the old one. Moving files within a file system
+    only touches the directory entries - no file data is copied.
+    """
+    for name in os.listdir(path):
+        childPath = os.path.join(path, name)
+        if os.path.isdir(childPath) and not isJunk(name):
+            sortMountedDirectory(childPath)
+
+    tempPath = path + '.sorting'
+    os.mkdir(tempPath)
+    for name in sorted(os.listdir(path), key=sortKey):
+        os.rename(os.path.join(path, name), os.path.join(tempPath, name))
+    os.rmdir(path)
+    os.rename(tempPath, path)
+
+
+def removeMountedJunk(rootDir):
+    removed = 0
+    for dirPath, dirNames, fileNames in os.walk(rootDir):
+        for name in dirNames + fileNames:
+            if isJunk(name):
+                junkPath = os.path.join(dirPath, name)
+                print('Removing ' + junkPath)
+                if os.path.isdir(junkPath):
+                    shutil.rmtree(junkPath)
+                else:
+                    os.remove(junkPath)
+                removed += 1
+        dirNames[:] = [ name for name in dirNames if not isJunk(name) ]
+    return removed
+
+
+def parseSize(text):
+    match = re.match('^(\\d+)([KMG]?)$', text.upper())
+    if not match:
+        raise argparse.ArgumentTypeError('Invalid size: ' + text)
+    return int(match.group(1)) << { '': 0, 'K': 10, 'M': 20, 'G': 30 }[match.group(2)]
+
+
+if __name__ == '__main__':
+    argFormatter = lambda prog: argparse.RawDescriptionHelpFormatter(prog, max_help_position=30, width=100)
+    argparser = text_to_speech.PatchedArgumentParser(
+        description=
+            'Sorts the directory entries of a TonUINO SD card, removes deleted entries and junk files (like `._*`).\n\n' +
+            'The DFPlayer walks the directory entries in on-disk order - so tracks copied in the wrong order play\n' +
+            'out of order and each deleted or junk entry slows down every lookup.\n\n' +
+            'The target may be:\n' +
+            '  - a FAT12/16/32 image file or block device (unmounted!): directories are rewritten in place\n' +
+            '  - the directory of a mounted card: all folders are rebuilt in sorted order (the order within the\n' +
+            '    root directory can only be fixed on an image or device)\n' +
+            '  - a new image file with `--build-from`: a FAT32 image is created from a directory tree',
+        usage='%(prog)s target [optional arguments...]',
+        formatter_class=argFormatter)
+    argparser.add_argument('target', type=str, help='The image file, block device or mounted directory')
+    argparser.add_argument('--verify', action='store_true', help='Only report the entries scanned per lookup (image or device only). Exits with 1 if a directory needs sorting')
+    argparser.add_argument('--build-from', type=str, default=None, help='Create a new FAT32 image from this directory')
+    argparser.add_argument('--size', type=parseSize, default=parseSize('64M'), help='The size of the image to create, e.g. `512M` or `2G`. (default: 64M)')
+    argparser.add_argument('--label', type=str, default='TONUINO', help='The volume label of the image to create. (default: TONUINO)')
+    argparser.add_argument('--dry-run', action='store_true', help='Dry run: Only prints what the script would do, without changing anything')
+    args = argparser.parse_args()
+
+    if args.build_from is not None:
+        if not os.path.isdir(args.build_from):
+            fail('Source is no directory: ' + os.path.abspath(args.build_from))
+        if args.dry_run:
+            sys.exit(0)
+        FatImageBuilder(args.target, args.size, args.label).build(args.build_from)
+        print('Written ' + args.target)
+    elif os.path.isdir(args.target):
+        if args.verify:
+            fail('Verifying needs an image file or block device')
+        if args.dry_run:
+            sys.exit(0)
+        removed = removeMountedJunk(args.target)
+        for name in sorted(os.listdir(args.target), key=sortKey):
+            if os.path.isdir(os.path.join(args.target, name)):
+                sortMountedDirectory(os.path.join(args.target, name))
+        print('Sorted all folders, removed {} junk entries'.format(removed))
+        sys.exit(0)
+    elif not args.verify:
+        volume = FatVolume(args.target, readOnly=args.dry_run)
+        removed = sortVolume(volume)
+        volume.close()
+        print('Sorted all directories, removed {} junk entries'.format(removed))
+
+    if not os.path.exists(args.target):
+        fail('Target does not exist: ' + os.path.abspath(args.target))
+    volume = FatVolume(args.target, readOnly=True)
+    problems = verifyVolume(volume)
+    volume.close()
+    sys.exit(1 if args.verify and problems else 0)
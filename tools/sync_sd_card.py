@@ -0,0 +1,166 @@
+#!/usr/bin/python
+
+# Updates the content of a (mounted) TonUINO SD card from a source directory, writing only what has changed.
+# A manifest on the card remembers size and hash of each file, so the card doesn't have to be read again.
+
+
+import argparse, hashlib, io, json, multiprocessing, multiprocessing.pool, os, shutil, sys, time, sort_sd_card, text_to_speech
+
+
+manifestName = 'tonuino_sync.json'
+manifestVersion = 1
+
+
+def fail(msg):
+    print('ERROR: ' + msg)
+    sys.exit(1)
+
+
+def hashFile(path):
+    sha1 = hashlib.sha1()
+    with io.open(path, 'rb') as f:
+        for chunk in iter(lambda: f.read(1 << 20), b''):
+            sha1.update(chunk)
+    return sha1.hexdigest()
+
+
+def scanTree(rootDir):
+    """Returns the relative paths (with `/` as separator) of all files, ignoring junk and the manifest"""
+    result = []
+    for dirPath, dirNames, fileNames in os.walk(rootDir):
+        dirNames[:] = [ name for name in dirNames if not sort_sd_card.isJunk(name) ]
+        for fileName in fileNames:
+            relPath = os.path.relpath(os.path.join(dirPath, fileName), rootDir).replace(os.sep, '/')
+            if not sort_sd_card.isJunk(fileName) and relPath != manifestName:
+                result.append(relPath)
+    return sorted(result)
+
+
+def loadManifest(cardDir):
+    manifestFile = os.path.join(cardDir, manifestName)
+    if not os.path.isfile(manifestFile):
+        return {}
+    with io.open(manifestFile, encoding='utf-8') as f:
+        manifest = json.load(f)
+    return manifest.get('files', {}) if manifest.get('version') == manifestVersion else {}
+
+
+def writeManifest(cardDir, files):
+    with io.open(os.path.join(cardDir, manifestName), 'w', encoding='utf-8') as f:
+        f.write(json.dumps({ 'version': manifestVersion, 'files': files }, indent=0, sort_keys=True, ensure_ascii=False))
+
+
+def copyInPlace(sourceFile, targetFile):
+    """
+    Overwrites the target instead of replacing it: this keeps the directory entry at its position, while
+    creating a new file (and renaming it) may put the entry anywhere in the directory.
+    """
+    with io.open(sourceFile, 'rb') as source:
+        with io.open(targetFile, 'r+b' if os.path.exists(targetFile) else 'wb') as target:
+            shutil.copyfileobj(source, target, 1 << 20)
+            target.truncate()
+
+
+def planSync(sourceFiles, sourceInfo, cardFiles, cardInfo, keepExtra):
+    """
+    Returns (files to write, files to delete, folders to rebuild). A folder has to be rebuilt in sorted order
+    if entries are deleted or a new file sorts before an existing one - otherwise new files are just appended.
+    """
+    toWrite = [ path for path in sourceFiles if cardInfo.get(path) != sourceInfo[path] ]
+    toDelete = [ path for path in cardFiles if path not in sourceInfo and not keepExtra ]
+
+    folders = {}
+    for path in cardFiles:
+        folders.setdefault(os.path.dirname(path), []).append(path)
+    deleted = set(toDelete)
+    toRebuild = set(os.path.dirname(path) for path in deleted)
+    for path in toWrite:
+        folder = os.path.dirname(path)
+        if path not in cardInfo and any(sort_sd_card.sortKey(os.path.basename(path)) < sort_sd_card.sortKey(os.path.basename(existing))
+                for existing in folders.get(folder, []) if existing not in deleted):
+            toRebuild.add(folder)
+    toRebuild.discard('')
+    return toWrite, toDelete, sorted(toRebuild)
+
+
+if __name__ == '__main__':
+    argFormatter = lambda prog: argparse.RawDescriptionHelpFormatter(prog, max_help_position=30, width=100)
+    argparser = text_to_speech.PatchedArgumentParser(
+        description=
+            'Updates the content of a mounted TonUINO SD card from a source directory, writing only changed files.\n\n' +
+            'Files are compared by size and SHA-1 hash. The hashes of the card are kept in `{}` on the card,\n'.format(manifestName) +
+            'so only the source is read (cards synced for the first time are read once).\n\n' +
+            'New files are written in sorted order. Folders where files are deleted or where new files sort before\n' +
+            'existing ones are rebuilt in sorted order afterwards (see sort_sd_card.py), so the DFPlayer keeps\n' +
+            'playing the tracks in the right order.',
+        usage='%(prog)s -i path/to/source -o path/to/mounted/card [optional arguments...]',
+        formatter_class=argFormatter)
+    argparser.add_argument('-i', '--input', type=str, required=True, help='The source directory (e.g. the output of build_sd_card.py)')
+    argparser.add_argument('-o', '--output', type=str, required=True, help='The root directory of the mounted SD card')
+    argparser.add_argument('--keep-extra', action='store_true', help='Keep files on the card which are not part of the source')
+    argparser.add_argument('--rehash-card', action='store_true', help='Ignore the manifest on the card and hash all files of the card again')
+    argparser.add_argument('-j', '--jobs', type=int, default=multiprocessing.cpu_count(), help='The number of files to hash in parallel. (default: number of CPUs)')
+    argparser.add_argument('--dry-run', action='store_true', help='Dry run: Only prints what the script would do, without changing the card')
+    args = argparser.parse_args()
+
+    for path in (args.input, args.output):
+        if not os.path.isdir(path):
+            fail('No directory: ' + os.path.abspath(path))
+
+    startTime = time.time()
+    pool = multiprocessing.pool.ThreadPool(max(args.jobs, 1))
+    try:
+        sourceFiles = scanTree(args.input)
+        sourceHashes = pool.map(lambda path: hashFile(os.path.join(args.input, path)), sourceFiles)
+        sourceInfo = dict((path, [ os.path.getsize(os.path.join(args.input, path)), sha1 ]) for path, sha1 in zip(sourceFiles, sourceHashes))
+
+        # Trust the manifest for files whose size still matches, hash all others
+        cardFiles = scanTree(args.output)
+        cardInfo = {} if args.rehash_card else loadManifest(args.output)
+        cardInfo = dict((path, info) for path, info in cardInfo.items()
+            if path in cardFiles and os.path.getsize(os.path.join(args.output, path)) == info[0])
+        unknownFiles = [ path for path in cardFiles if path not in cardInfo ]
+        if unknownFiles:
+            print('Hashing {} files of the card not in the manifest'.format(len(unknownFiles)))
+        for path, sha1 in zip(unknownFiles, pool.map(lambda path: hashFile(os.path.join(args.output, path)), unknownFiles)):
+            cardInfo[path] = [ os.path.getsize(os.path.join(args.output, path)), sha1 ]
+    finally:
+        pool.terminate()
+
+    toWrite, toDelete, toRebuild = planSync(sourceFiles, sourceInfo, cardFiles, cardInfo, args.keep_extra)
+    totalBytes = sum(info[0] for info in sourceInfo.values())
+    writeBytes = sum(sourceInfo[path][0] for path in toWrite)
+    print('{} files to write ({} bytes), {} to delete, {} folders to rebuild, {} unchanged'.format(
+        len(toWrite), writeBytes, len(toDelete), len(toRebuild), len(sourceFiles) - len(toWrite)))
+    if args.dry_run:
+        for path in toWrite:
+            print('Write ' + path)
+        for path in toDelete:
+            print('Delete ' + path)
+        for folder in toRebuild:
+            print('Rebuild ' + folder)
+        sys.exit(0)
+
+    # Files leave the manifest before they are touched and the manifest is written even if the sync is
+    # interrupted, so the next run only re-writes what wasn't finished
+    try:
+        for path in toDelete:
+            print('Deleting ' + path)
+            cardInfo.pop(path, None)
+            os.remove(os.path.join(args.output, path))
+        for path in toWrite:
+            print('Writing ' + path)
+            cardInfo.pop(path, None)
+            targetFile = os.path.join(args.output, path)
+            if not os.path.isdir(os.path.dirname(targetFile)):
+                os.makedirs(os.path.dirname(targetFile))
+            copyInPlace(os.path.join(args.input, path), targetFile)
+            cardInfo[path] = sourceInfo[path]
+        for folder in toRebuild:
+            print('Rebuilding {} in sorted order'.format(folder))
+            sort_sd_card.sortMountedDirectory(os.path.join(args.output, folder))
+    finally:
+        writeManifest(args.output, cardInfo)
+
+    print('Done in {:.1f}s: written {} of {} bytes, saved {} bytes ({:.0f}%)'.format(time.time() - startTime, writeBytes, totalBytes,
+        totalBytes - writeBytes, 100.0 * (totalBytes - writeBytes) / totalBytes if totalBytes else 100))
@@ -3,7 +3,12 @@
 # Converts text into spoken language saved to an mp3 file.
 
 
-import argparse, base64, json, os, subprocess, sys, urllib
+import argparse, base64, hashlib, json, os, shutil, subprocess, sys, tempfile
+
+try:
+    from urllib import urlencode
+except ImportError:
+    from urllib.parse import urlencode
 
 
 class PatchedArgumentParser(argparse.ArgumentParser):
@@ -26,6 +31,13 @@ amazonVoiceByLang = {
     'de': 'Vicki',
     'en': 'Joanna',
 }
+espeakVoiceByLang = {
+    'de': 'de',
+    'en': 'en-us',
+}
+
+# Increase when the synthesis parameters change, so cached messages are generated again
+cacheVersion = 1
 
 
 textToSpeechDescription = """
@@ -33,8 +45,9 @@ The following text-to-speech engines are supported:
 - With `--use-say` the text-to-speech engine of MacOS is used (command `say`).
 - With `--use-amazon` Amazon Polly is used. Requires the AWS CLI to be installed and configured. See: https://aws.amazon.com/cli/
 - With `--use-google-key=ABCD` Google text-to-speech is used. See: https://cloud.google.com/text-to-speech/
+- With `--use-espeak` the local, offline engine `espeak-ng` is used. See: https://github.com/espeak-ng/espeak-ng
 
-Amazon Polly sounds best, Google text-to-speech is second, MacOS `say` sounds worst.'
+Amazon Polly sounds best, Google text-to-speech is second, MacOS `say` sounds worse, `espeak-ng` worst (but fastest).'
 """.strip()
 
 def addArgumentsToArgparser(argparser):
@@ -42,20 +55,83 @@ def addArgumentsToArgparser(argparser):
     argparser.add_argument('--use-say', action='store_true', default=None, help="If set, the MacOS tool `say` will be used.")
     argparser.add_argument('--use-amazon', action='store_true', default=None, help="If set, Amazon Polly is used. If missing the MacOS tool `say` will be used.")
     argparser.add_argument('--use-google-key', type=str, default=None, help="The API key of the Google text-to-speech account to use.")
+    argparser.add_argument('--use-espeak', action='store_true', default=None, help="If set, the offline engine `espeak-ng` will be used.")
+    argparser.add_argument('--cache-dir', type=str, default='.tts-cache', help="The directory where generated messages are cached. (default: `.tts-cache`)")
+    argparser.add_argument('--no-cache', action='store_true', help="If set, the cache isn't used.")
 
 
 def checkArgs(argparser, args):
-    if not args.use_say and not args.use_amazon and args.use_google_key is None:
-        print('ERROR: You have to provide one of the arguments `--use-say`, `--use-amazon` or `--use-google-key`\n')
+    if not args.use_say and not args.use_amazon and args.use_google_key is None and not args.use_espeak:
+        print('ERROR: You have to provide one of the arguments `--use-say`, `--use-amazon`, `--use-google-key` or `--use-espeak`\n')
         argparser.print_help()
         sys.exit(2)
 
 
-def textToSpeechUsingArgs(text, targetFile, args):
-    textToSpeech(text, targetFile, lang=args.lang, useAmazon=args.use_amazon, useGoogleKey=args.use_google_key)
+def getEngineAndVoice(lang, useAmazon=False, useGoogleKey=None, useEspeak=False):
+    if useAmazon:
+        return ('amazon', amazonVoiceByLang[lang])
+    elif useGoogleKey:
+        return ('google', googleVoiceByLang[lang]['name'])
+    elif useEspeak:
+        return ('espeak', espeakVoiceByLang[lang])
+    else:
+        return ('say', sayVoiceByLang[lang])
 
 
-def textToSpeech(text, targetFile, lang='de', useAmazon=False, useGoogleKey=None):
+def textToSpeechUsingArgs(text, targetFile, args):
+    """Returns True if the message was synthesized and False if it was taken from the cache"""
+    if args.no_cache:
+        textToSpeech(text, targetFile, lang=args.lang, useAmazon=args.use_amazon, useGoogleKey=args.use_google_key, useEspeak=args.use_espeak)
+        return True
+    return cachedTextToSpeech(text, targetFile, args.cache_dir, lang=args.lang, useAmazon=args.use_amazon, useGoogleKey=args.use_google_key, useEspeak=args.use_espeak)
+
+
+def cachedTextToSpeech(text, targetFile, cacheDir, lang='de', useAmazon=False, useGoogleKey=None, useEspeak=False):
+    """
+    Like `textToSpeech`, but messages are cached by the hash of (text, voice, language, engine),
+    so they are only synthesized again if one of them changed.
+    Returns True if the message was synthesized and False if it was taken from the cache.
+    """
+    engine, voice = getEngineAndVoice(lang, useAmazon, useGoogleKey, useEspeak)
+    key = json.dumps([cacheVersion, engine, voice, lang, text])
+    digest = hashlib.sha1(key.encode('utf-8')).hexdigest()
+    cacheFile = os.path.join(cacheDir, digest[:2], digest + '.mp3')
+
+    synthesized = False
+    if not os.path.isfile(cacheFile):
+        if not os.path.isdir(os.path.dirname(cacheFile)):
+            try:
+                os.makedirs(os.path.dirname(cacheFile))
+            except OSError:
+                pass  # Created by another worker in the meantime
+        # Write to a temp file first, so an interrupted or failed run doesn't leave broken files in the cache
+        fd, tempFile = tempfile.mkstemp(suffix='.mp3', dir=os.path.dirname(cacheFile))
+        os.close(fd)
+        try:
+            textToSpeech(text, tempFile, lang=lang, useAmazon=useAmazon, useGoogleKey=useGoogleKey, useEspeak=useEspeak)
+            if os.path.getsize(tempFile) == 0:
+                raise RuntimeError('Text-to-speech created an empty file for: ' + text)
+        except:
+            os.remove(tempFile)
+            raise
+        os.rename(tempFile, cacheFile)
+        synthesized = True
+
+    if not filesAreEqual(cacheFile, targetFile):
+        shutil.copyfile(cacheFile, targetFile)
+    return synthesized
+
+
+def filesAreEqual(file1, file2):
+    if not os.path.isfile(file2) or os.path.getsize(file1) != os.path.getsize(file2):
+        return False
+    with open(file1, 'rb') as f1:
+        with open(file2, 'rb') as f2:
+            return f1.read() == f2.read()
+
+
+def textToSpeech(text, targetFile, lang='de', useAmazon=False, useGoogleKey=None, useEspeak=False):
+    """Raises an exception if one of the tools fails"""
     print('\nGenerating: ' + targetFile + ' - ' + text)
     if useAmazon:
         response = subprocess.check_output(['aws', 'polly', 'synthesize-speech', '--output-format', 'mp3',
@@ -82,10 +158,22 @@ def textToSpeech(text, targetFile, lang='de', useAmazon=False, useGoogleKey=None
 
         with open(targetFile, 'wb') as f:
             f.write(mp3Data)
+    elif useEspeak:
+        fd, tempWav = tempfile.mkstemp(suffix='.wav')
+        os.close(fd)
+        try:
+            subprocess.check_call([ 'espeak-ng', '-v', espeakVoiceByLang[lang], '-w', tempWav, text ])
+            subprocess.check_call([ 'ffmpeg', '-y', '-loglevel', 'error', '-i', tempWav, '-acodec', 'libmp3lame', '-ab', '128k', '-ac', '1', targetFile ])
+        finally:
+            os.remove(tempWav)
     else:
-        subprocess.call([ 'say', '-v', sayVoiceByLang[lang], '-o', 'temp.aiff', text ])
-        subprocess.call([ 'ffmpeg', '-y', '-i', 'temp.aiff', '-acodec', 'libmp3lame', '-ab', '128k', '-ac', '1', targetFile ])
-        os.remove('temp.aiff')
+        fd, tempAiff = tempfile.mkstemp(suffix='.aiff')
+        os.close(fd)
+        try:
+            subprocess.check_call([ 'say', '-v', sayVoiceByLang[lang], '-o', tempAiff, text ])
+            subprocess.check_call([ 'ffmpeg', '-y', '-i', tempAiff, '-acodec', 'libmp3lame', '-ab', '128k', '-ac', '1', targetFile ])
+        finally:
+            os.remove(tempAiff)
 
 
 def postJson(url, postBody, headers = None):
@@ -99,7 +187,7 @@ def postJson(url, postBody, headers = None):
 
 
 def postForm(url, formData):
-    response = subprocess.check_output(['curl', '-H', 'Content-Type: application/x-www-form-urlencoded; charset=utf-8', '--data', urllib.urlencode(formData), url])
+    response = subprocess.check_output(['curl', '-H', 'Content-Type: application/x-www-form-urlencoded; charset=utf-8', '--data', urlencode(formData), url])
     return json.loads(response)
 
 